@@ -0,0 +1,632 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Animated output: a burst of frames written as one animated PNG or GIF.
+
+  Each frame is compared with the previous one and only the bounding box
+  of the changed pixels is encoded.  Inside that box, pixels that did not
+  change are made transparent and blended over the previous frame, which
+  leaves long runs for the compressor; a box where every pixel changed is
+  stored opaque instead.  Frames that change nothing just extend the
+  previous frame's delay.
+
+  GIF frames get their own exact palette when the changed pixels have at
+  most 255 colors (typical for UI), and otherwise use a shared 6x7x6
+  color cube.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+
+#define ANIM_GIF  0
+#define ANIM_APNG 1
+
+// GIF: palette index left transparent
+const int g_gif_transparent = 255;
+
+// GIF: colors in the shared color cube
+const int g_gif_cube_colors = 6 * 7 * 6;
+
+
+struct AnimWriter
+{
+    StreamWriter *stream;
+    int format;                 // ANIM_GIF or ANIM_APNG
+    int width, height;
+    unsigned char *prev;        // last frame, width*4 bytes per row
+    bool have_prev;
+    int frames;                 // frames written
+    unsigned int seq;           // APNG chunk sequence number
+
+    // the newest frame waits here until its delay is known
+    bool pending;
+    std::vector<unsigned char> data;    // encoded pixels
+    int x, y, w, h;                     // where they go
+    bool blend;                         // over the previous frame
+    int delay;                          // milliseconds
+};
+
+
+// Find the bounding box of pixels that differ between two frames.
+// Returns false if nothing changed.
+bool anim_changed_rect(const unsigned char *a, int a_stride,
+                       const unsigned char *b, int b_stride,
+                       int width, int height, int *x, int *y, int *w, int *h)
+{
+    int row_bytes = width * 4;
+    int top = 0, bottom = height;
+    while (top < height &&
+           memcmp(a + top * a_stride, b + top * b_stride, row_bytes) == 0)
+        top++;
+    if (top == height)
+        return false;
+    while (memcmp(a + (bottom-1) * a_stride, b + (bottom-1) * b_stride,
+                  row_bytes) == 0)
+        bottom--;
+
+    int left = width, right = 0;
+    for (int i=top; i<bottom; i++) {
+        const unsigned int *pa = (const unsigned int*) (a + i * a_stride);
+        const unsigned int *pb = (const unsigned int*) (b + i * b_stride);
+        int j = 0;
+        while (j < left && pa[j] == pb[j])
+            j++;
+        left = j;
+        j = width;
+        while (j > right && pa[j-1] == pb[j-1])
+            j--;
+        right = j;
+    }
+
+    *x = left;
+    *y = top;
+    *w = right - left;
+    *h = bottom - top;
+    return true;
+}
+
+
+void put16le(std::vector<unsigned char> *out, int v)
+{
+    out->push_back(v & 0xff);
+    out->push_back((v >> 8) & 0xff);
+}
+
+
+void put32be(unsigned char *p, unsigned int v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+
+//=============================================================================
+// GIF
+
+// LZW codes are packed from the least significant bit into data
+// sub-blocks of up to 255 bytes
+struct GifBits
+{
+    std::vector<unsigned char> *out;
+    unsigned char block[256];   // length byte, then data
+    unsigned int bits;
+    int nbits;
+};
+
+
+void gif_put(GifBits *g, int code, int width)
+{
+    g->bits |= (unsigned int) code << g->nbits;
+    g->nbits += width;
+    while (g->nbits >= 8) {
+        g->block[++g->block[0]] = g->bits & 0xff;
+        g->bits >>= 8;
+        g->nbits -= 8;
+        if (g->block[0] == 255) {
+            g->out->insert(g->out->end(), g->block, g->block + 256);
+            g->block[0] = 0;
+        }
+    }
+}
+
+
+// Compress palette indices with GIF's variable-width LZW
+void gif_lzw(const unsigned char *indices, int size,
+             std::vector<unsigned char> *out)
+{
+    const int min_size = 8;
+    const int clear = 1 << min_size;
+    const int eoi = clear + 1;
+    const int hash_size = 8192;
+
+    // dictionary: (prefix code << 8 | next index) -> code
+    int *keys = (int*) malloc(hash_size * sizeof(int));
+    short *codes = (short*) malloc(hash_size * sizeof(short));
+    for (int i=0; i<hash_size; i++)
+        keys[i] = -1;
+
+    out->push_back(min_size);
+    GifBits g;
+    g.out = out;
+    g.block[0] = 0;
+    g.bits = 0;
+    g.nbits = 0;
+    int code_size = min_size + 1;
+    int next = eoi + 1;
+
+    gif_put(&g, clear, code_size);
+    int prefix = size > 0 ? indices[0] : 0;
+    for (int i=1; i<size; i++) {
+        int key = (prefix << 8) | indices[i];
+        unsigned int h = ((unsigned int) key * 2654435761u) >> 19;
+        while (keys[h] != -1 && keys[h] != key)
+            h = (h + 1) & (hash_size - 1);
+        if (keys[h] == key) {
+            prefix = codes[h];
+            continue;
+        }
+
+        gif_put(&g, prefix, code_size);
+        keys[h] = key;
+        codes[h] = next++;
+        if (next > (1 << code_size) && code_size < 12)
+            code_size++;
+        if (next == 4096) {
+            // dictionary full: start over
+            gif_put(&g, clear, code_size);
+            for (int j=0; j<hash_size; j++)
+                keys[j] = -1;
+            code_size = min_size + 1;
+            next = eoi + 1;
+        }
+        prefix = indices[i];
+    }
+    if (size > 0) {
+        gif_put(&g, prefix, code_size);
+        // the decoder adds one more entry after the last code, and may
+        // widen its codes for it
+        if (next == (1 << code_size) && code_size < 12)
+            code_size++;
+    }
+    gif_put(&g, eoi, code_size);
+    if (g.nbits > 0)
+        gif_put(&g, 0, 8 - g.nbits);
+
+    if (g.block[0] > 0)
+        out->insert(out->end(), g.block, g.block + 1 + g.block[0]);
+    out->push_back(0);
+
+    free(keys);
+    free(codes);
+}
+
+
+// Index of the color cube entry nearest to a pixel
+inline int gif_cube_index(const unsigned char *p)
+{
+    int r = (p[2] * 5 + 127) / 255;
+    int g = (p[1] * 6 + 127) / 255;
+    int b = (p[0] * 5 + 127) / 255;
+    return (r * 7 + g) * 6 + b;
+}
+
+
+void gif_write_cube(std::vector<unsigned char> *out)
+{
+    for (int i=0; i<256; i++) {
+        if (i < g_gif_cube_colors) {
+            out->push_back((i / 42) * 255 / 5);
+            out->push_back((i / 6 % 7) * 255 / 6);
+            out->push_back((i % 6) * 255 / 5);
+        } else {
+            out->push_back(0);
+            out->push_back(0);
+            out->push_back(0);
+        }
+    }
+}
+
+
+// Encode the box (x,y,w,h) of a frame as a GIF image, graphic control
+// extension first.  'mask' marks the pixels that changed.  The delay is
+// filled in later by gif_set_delay().
+void gif_encode(const unsigned char *pixels, int stride,
+                const unsigned char *mask, int x, int y, int w, int h,
+                bool blend, std::vector<unsigned char> *out)
+{
+    unsigned char *indices = (unsigned char*) malloc(w * h);
+
+    // try an exact palette of the changed pixels
+    const int table_size = 1024;
+    unsigned int keys[table_size];
+    unsigned char values[table_size];
+    memset(keys, 0, sizeof(keys));
+    unsigned int palette[256];
+    int ncolors = 0;
+    bool exact = true;
+
+    for (int i=0; i<h && exact; i++) {
+        const unsigned char *row = pixels + (y+i) * stride + x*4;
+        for (int j=0; j<w; j++) {
+            if (!mask[i*w + j]) {
+                indices[i*w + j] = g_gif_transparent;
+                continue;
+            }
+            unsigned int color = (row[j*4+2] << 16) | (row[j*4+1] << 8) |
+                row[j*4];
+            unsigned int key = color + 1;
+            unsigned int k = (color * 2654435761u) >> 22;
+            while (keys[k] && keys[k] != key)
+                k = (k + 1) & (table_size - 1);
+            if (!keys[k]) {
+                if (ncolors == 255) {
+                    exact = false;
+                    break;
+                }
+                keys[k] = key;
+                values[k] = ncolors;
+                palette[ncolors++] = color;
+            }
+            indices[i*w + j] = values[k];
+        }
+    }
+
+    if (!exact) {
+        for (int i=0; i<h; i++) {
+            const unsigned char *row = pixels + (y+i) * stride + x*4;
+            for (int j=0; j<w; j++)
+                indices[i*w + j] = mask[i*w + j] ?
+                    gif_cube_index(row + j*4) : g_gif_transparent;
+        }
+    }
+
+    // graphic control extension: keep the previous frame underneath
+    out->push_back(0x21);
+    out->push_back(0xf9);
+    out->push_back(4);
+    out->push_back((1 << 2) | (blend ? 1 : 0));
+    put16le(out, 0);
+    out->push_back(g_gif_transparent);
+    out->push_back(0);
+
+    // image descriptor, with a local palette if it is exact
+    out->push_back(0x2c);
+    put16le(out, x);
+    put16le(out, y);
+    put16le(out, w);
+    put16le(out, h);
+    if (exact) {
+        out->push_back(0x80 | 7);
+        for (int i=0; i<256; i++) {
+            unsigned int color = i < ncolors ? palette[i] : 0;
+            out->push_back(color >> 16);
+            out->push_back((color >> 8) & 0xff);
+            out->push_back(color & 0xff);
+        }
+    } else {
+        out->push_back(0);
+    }
+
+    gif_lzw(indices, w * h, out);
+    free(indices);
+}
+
+
+// Set the delay of an image from gif_encode()
+void gif_set_delay(std::vector<unsigned char> *image, int delay)
+{
+    int centis = (delay + 5) / 10;
+    if (centis > 65535)
+        centis = 65535;
+    (*image)[4] = centis & 0xff;
+    (*image)[5] = centis >> 8;
+}
+
+
+//=============================================================================
+// APNG
+
+// Write a PNG chunk
+bool png_write_chunk(StreamWriter *stream, const char *type,
+                     const unsigned char *data, int size)
+{
+    unsigned char head[8];
+    put32be(head, size);
+    memcpy(head + 4, type, 4);
+    unsigned char tail[4];
+    put32be(tail, crc32_update(crc32_update(0, head + 4, 4), data, size));
+    return stream_write(stream, head, 8) &&
+        stream_write(stream, data, size) &&
+        stream_write(stream, tail, 4);
+}
+
+
+// Filter a row of 'row_bytes' bytes with 'bpp' bytes per pixel into
+// 'dst' (filter type, then residuals), picking the filter (none, sub, or
+// up) with the smallest residuals.  'up' is the row above, or zeros.
+void png_filter_row(const unsigned char *cur, const unsigned char *up,
+                    int row_bytes, int bpp, unsigned char *dst)
+{
+    long cost[3] = {0, 0, 0};
+    for (int k=0; k<row_bytes; k++) {
+        cost[0] += (signed char) cur[k] < 0 ? -(signed char) cur[k] :
+            (signed char) cur[k];
+        signed char s = cur[k] - (k >= bpp ? cur[k-bpp] : 0);
+        signed char u = cur[k] - up[k];
+        cost[1] += s < 0 ? -s : s;
+        cost[2] += u < 0 ? -u : u;
+    }
+    int filter = 0;
+    if (cost[1] < cost[filter]) filter = 1;
+    if (cost[2] < cost[filter]) filter = 2;
+
+    dst[0] = filter;
+    for (int k=0; k<row_bytes; k++) {
+        unsigned char pred = 0;
+        if (filter == 1)
+            pred = k >= bpp ? cur[k-bpp] : 0;
+        else if (filter == 2)
+            pred = up[k];
+        dst[1 + k] = cur[k] - pred;
+    }
+}
+
+
+// Encode the box (x,y,w,h) of a frame as zlib-compressed, filtered RGBA
+// rows.  Pixels outside 'mask' become transparent black.
+void apng_encode(const unsigned char *pixels, int stride,
+                 const unsigned char *mask, int x, int y, int w, int h,
+                 std::vector<unsigned char> *out)
+{
+    int row_bytes = w * 4;
+    unsigned char *raw = (unsigned char*) malloc((row_bytes + 1) * h);
+    unsigned char *line = (unsigned char*) malloc(row_bytes * 2);
+    unsigned char *cur = line, *up = line + row_bytes;
+    memset(up, 0, row_bytes);
+
+    for (int i=0; i<h; i++) {
+        const unsigned char *row = pixels + (y+i) * stride + x*4;
+        for (int j=0; j<w; j++) {
+            unsigned char *q = cur + j*4;
+            if (mask && !mask[i*w + j]) {
+                memset(q, 0, 4);
+            } else {
+                q[0] = row[j*4+2];
+                q[1] = row[j*4+1];
+                q[2] = row[j*4];
+                q[3] = 255;
+            }
+        }
+
+        png_filter_row(cur, up, row_bytes, 4, raw + i * (row_bytes + 1));
+
+        unsigned char *tmp = up;
+        up = cur;
+        cur = tmp;
+    }
+
+    deflate_compress(raw, (row_bytes + 1) * h, out);
+    free(raw);
+    free(line);
+}
+
+
+//=============================================================================
+// Writer
+
+// Get the animation format for a file name, or -1
+int anim_format(const char *filename)
+{
+    int len = strlen(filename);
+    if (len > 4 && strcasecmp(filename + len - 4, ".gif") == 0)
+        return ANIM_GIF;
+    if (len > 4 && strcasecmp(filename + len - 4, ".png") == 0)
+        return ANIM_APNG;
+    return -1;
+}
+
+
+// Start an animation of the given format on a file stream
+bool anim_open(AnimWriter *anim, StreamWriter *stream, int format,
+               int width, int height)
+{
+    anim->stream = stream;
+    anim->format = format;
+    anim->width = width;
+    anim->height = height;
+    anim->prev = (unsigned char*) malloc(width * 4 * height);
+    anim->have_prev = false;
+    anim->frames = 0;
+    anim->seq = 0;
+    anim->pending = false;
+    if (!anim->prev) {
+        printf("error: out of memory\n");
+        return false;
+    }
+
+    bool ret;
+    std::vector<unsigned char> head;
+    if (anim->format == ANIM_GIF) {
+        // header, screen with the color cube as global palette, and
+        // loop forever
+        const char *magic = "GIF89a";
+        head.insert(head.end(), magic, magic + 6);
+        put16le(&head, width);
+        put16le(&head, height);
+        head.push_back(0xf7);
+        head.push_back(0);
+        head.push_back(0);
+        gif_write_cube(&head);
+        const unsigned char loop[19] = {
+            0x21, 0xff, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E',
+            '2', '.', '0', 3, 1, 0, 0, 0};
+        head.insert(head.end(), loop, loop + 19);
+        ret = stream_write(anim->stream, &head[0], head.size());
+    } else {
+        const unsigned char signature[8] = {
+            0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        unsigned char ihdr[13];
+        put32be(ihdr, width);
+        put32be(ihdr + 4, height);
+        ihdr[8] = 8;        // bits per sample
+        ihdr[9] = 6;        // RGBA
+        ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+        // frame count is filled in by anim_close()
+        unsigned char actl[8];
+        put32be(actl, 0);
+        put32be(actl + 4, 0);   // loop forever
+        ret = stream_write(anim->stream, signature, 8) &&
+            png_write_chunk(anim->stream, "IHDR", ihdr, 13) &&
+            png_write_chunk(anim->stream, "acTL", actl, 8);
+    }
+
+    // anim_close() is not called after a failed open
+    if (!ret) {
+        free(anim->prev);
+        anim->prev = NULL;
+    }
+    return ret;
+}
+
+
+// Write out the pending frame
+bool anim_flush(AnimWriter *anim)
+{
+    if (!anim->pending)
+        return true;
+    anim->pending = false;
+    anim->frames++;
+
+    if (anim->format == ANIM_GIF) {
+        gif_set_delay(&anim->data, anim->delay);
+        return stream_write(anim->stream, &anim->data[0], anim->data.size());
+    }
+
+    unsigned char fctl[26];
+    put32be(fctl, anim->seq++);
+    put32be(fctl + 4, anim->w);
+    put32be(fctl + 8, anim->h);
+    put32be(fctl + 12, anim->x);
+    put32be(fctl + 16, anim->y);
+    int delay = anim->delay > 65535 ? 65535 : anim->delay;
+    fctl[20] = delay >> 8;
+    fctl[21] = delay & 0xff;
+    fctl[22] = 1000 >> 8;
+    fctl[23] = 1000 & 0xff;
+    fctl[24] = 0;                       // dispose: none
+    fctl[25] = anim->blend ? 1 : 0;     // blend: over or source
+    if (!png_write_chunk(anim->stream, "fcTL", fctl, 26))
+        return false;
+
+    // the first frame is also the default image
+    if (anim->frames == 1)
+        return png_write_chunk(anim->stream, "IDAT", &anim->data[0],
+                               anim->data.size());
+
+    // fdAT is IDAT data after a sequence number
+    anim->data.insert(anim->data.begin(), 4, 0);
+    put32be(&anim->data[0], anim->seq++);
+    return png_write_chunk(anim->stream, "fdAT", &anim->data[0],
+                           anim->data.size());
+}
+
+
+// Add a frame shown 'elapsed' milliseconds after the previous one
+bool anim_add(AnimWriter *anim, const unsigned char *pixels, int stride,
+              int elapsed)
+{
+    int x = 0, y = 0, w = anim->width, h = anim->height;
+    int prev_stride = anim->width * 4;
+
+    if (anim->have_prev) {
+        anim->delay += elapsed;
+        if (!anim_changed_rect(anim->prev, prev_stride, pixels, stride,
+                               anim->width, anim->height, &x, &y, &w, &h))
+            return true;
+    }
+
+    // mark which pixels of the box changed
+    unsigned char *mask = (unsigned char*) malloc(w * h);
+    int changed = 0;
+    for (int i=0; i<h; i++) {
+        const unsigned int *cur = (const unsigned int*)
+            (pixels + (y+i) * stride) + x;
+        const unsigned int *old = (const unsigned int*)
+            (anim->prev + (y+i) * prev_stride) + x;
+        for (int j=0; j<w; j++) {
+            mask[i*w + j] = !anim->have_prev || cur[j] != old[j];
+            changed += mask[i*w + j];
+        }
+    }
+    bool blend = changed < w * h;
+
+    if (!anim_flush(anim)) {
+        free(mask);
+        return false;
+    }
+
+    anim->data.clear();
+    if (anim->format == ANIM_GIF)
+        gif_encode(pixels, stride, mask, x, y, w, h, blend, &anim->data);
+    else
+        apng_encode(pixels, stride, blend ? mask : NULL, x, y, w, h,
+                    &anim->data);
+    free(mask);
+
+    anim->pending = true;
+    anim->x = x;
+    anim->y = y;
+    anim->w = w;
+    anim->h = h;
+    anim->blend = blend;
+    anim->delay = 0;
+
+    for (int i=0; i<h; i++)
+        memcpy(anim->prev + (y+i) * prev_stride + x*4,
+               pixels + (y+i) * stride + x*4, w * 4);
+    anim->have_prev = true;
+    return true;
+}
+
+
+// Finish the animation, showing the last frame for 'delay' milliseconds
+bool anim_close(AnimWriter *anim, int delay)
+{
+    bool ret = true;
+    if (anim->pending) {
+        anim->delay += delay;
+        ret = anim_flush(anim);
+    }
+
+    if (anim->format == ANIM_GIF) {
+        const unsigned char trailer = 0x3b;
+        ret = ret && stream_write(anim->stream, &trailer, 1);
+    } else {
+        ret = ret && png_write_chunk(anim->stream, "IEND", NULL, 0);
+
+        // patch the frame count into acTL
+        unsigned char actl[12];
+        put32be(actl, anim->frames);
+        put32be(actl + 4, 0);
+        put32be(actl + 8, crc32_update(crc32_update(0,
+            (const unsigned char*) "acTL", 4), actl, 8));
+        ret = ret && stream_patch(anim->stream, 8 + 25 + 8, actl, 4) &&
+            stream_patch(anim->stream, 8 + 25 + 8 + 8, actl + 8, 4);
+    }
+
+    free(anim->prev);
+    anim->prev = NULL;
+    anim->data.clear();
+    return ret;
+}
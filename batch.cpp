@@ -0,0 +1,279 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Batch comparison: compare every PNG and BMP of a directory of new
+  screenshots with the file of the same name in a directory of
+  baselines, in one process, and summarize the results as JSON.
+
+  Each pair is one task on the thread pool.  Its workers take the next
+  pair as soon as they finish one, and the largest files are queued
+  first so that no big pair is left for the end.  BMP files are mapped
+  into memory and compared in place; other images are decoded with
+  GDI+.  Diff images are only made for pairs that fail.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+// windows includes
+#include <windows.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+
+enum {
+    BATCH_PASS,
+    BATCH_FAIL,         // the images differ
+    BATCH_SIZE,         // the images have different sizes
+    BATCH_ERROR         // an image could not be read
+};
+
+
+// How the pairs are compared, as with --compare
+struct BatchSettings
+{
+    const char *base_dir;
+    const char *new_dir;
+    const char *diff_dir;       // where diff images go, or NULL
+    int tol;
+    long long max_count;
+    int ssim_scales;            // 0 to count pixels
+    double ssim_min;
+};
+
+
+// A pair of files with the same name, and how it compared
+struct BatchPair
+{
+    const BatchSettings *settings;
+    std::string name;
+    long long size;             // bytes of both files
+
+    int status;
+    long long differ;
+    int max_diff;
+    double score;
+    bool diff_saved;
+};
+
+
+// An image read for comparison: a mapped BMP or a decoded frame
+struct BatchImage
+{
+    BitmapView view;
+    Frame decoded;
+    bool mapped;
+};
+
+
+// Names (lowercase, to pair them) of the PNG and BMP files in 'dir'
+bool batch_list(const char *dir, std::map<std::string, BatchPair> *files)
+{
+    std::string pattern = std::string(dir) + "\\*";
+    WIN32_FIND_DATA data;
+    HANDLE find = FindFirstFile(pattern.c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        printf("error: cannot read directory '%s'\n", dir);
+        return false;
+    }
+
+    do {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+        int len = strlen(data.cFileName);
+        if (len < 5 || (strcasecmp(data.cFileName + len - 4, ".png") != 0 &&
+                        strcasecmp(data.cFileName + len - 4, ".bmp") != 0))
+            continue;
+
+        std::string key = data.cFileName;
+        for (unsigned int i=0; i<key.size(); i++)
+            key[i] = tolower(key[i]);
+        BatchPair &pair = (*files)[key];
+        pair.name = data.cFileName;
+        pair.size = ((long long) data.nFileSizeHigh << 32) |
+            data.nFileSizeLow;
+    } while (FindNextFile(find, &data));
+
+    FindClose(find);
+    return true;
+}
+
+
+bool batch_load(const char *dir, const std::string &name, BatchImage *image)
+{
+    std::string path = std::string(dir) + "\\" + name;
+    int len = name.size();
+    image->mapped = len > 4 &&
+        strcasecmp(name.c_str() + len - 4, ".bmp") == 0 &&
+        bmp_map_file(path.c_str(), &image->view);
+    return image->mapped || load_image_file(path.c_str(), &image->decoded);
+}
+
+
+const Frame *batch_frame(const BatchImage *image)
+{
+    return image->mapped ? &image->view.frame : &image->decoded;
+}
+
+
+void batch_free(BatchImage *image)
+{
+    if (image->mapped)
+        bmp_unmap(&image->view);
+    else
+        frame_free(&image->decoded);
+}
+
+
+// Compare one pair, then redo it with a diff image if it failed
+void batch_task(void *arg)
+{
+    BatchPair *pair = (BatchPair*) arg;
+    const BatchSettings *s = pair->settings;
+    pair->differ = 0;
+    pair->max_diff = 0;
+    pair->score = 0.0;
+    pair->diff_saved = false;
+
+    BatchImage base, shot;
+    if (!batch_load(s->base_dir, pair->name, &base)) {
+        pair->status = BATCH_ERROR;
+        return;
+    }
+    if (!batch_load(s->new_dir, pair->name, &shot)) {
+        batch_free(&base);
+        pair->status = BATCH_ERROR;
+        return;
+    }
+    const Frame *a = batch_frame(&base), *b = batch_frame(&shot);
+
+    if (a->width != b->width || a->height != b->height) {
+        pair->status = BATCH_SIZE;
+    } else if (s->ssim_scales > 0) {
+        bool ok = ssim_frames(a, b, NULL, s->ssim_scales, NULL,
+                              &pair->score, false);
+        pair->status = !ok ? BATCH_ERROR :
+            pair->score < s->ssim_min ? BATCH_FAIL : BATCH_PASS;
+    } else {
+        CompareResult result;
+        compare_frames(a, b, s->tol, s->max_count, NULL, NULL, &result);
+        pair->differ = result.differ;
+        pair->max_diff = result.max_diff;
+        pair->status = result.differ > s->max_count ?
+            BATCH_FAIL : BATCH_PASS;
+    }
+
+    Frame mask;
+    if (pair->status == BATCH_FAIL && s->diff_dir &&
+        frame_create(&mask, 0, 0, b->width, b->height)) {
+        if (s->ssim_scales > 0) {
+            ssim_frames(a, b, NULL, s->ssim_scales, &mask, &pair->score,
+                        false);
+        } else {
+            // without the early stop, to count every difference
+            CompareResult result;
+            compare_frames(a, b, s->tol, (long long) b->width * b->height,
+                           NULL, &mask, &result);
+            pair->differ = result.differ;
+            pair->max_diff = result.max_diff;
+            compare_mask_image(&mask, b, NULL);
+        }
+
+        std::string path = std::string(s->diff_dir) + "\\" + pair->name;
+        pair->diff_saved = save_frame(&mask, path.c_str());
+        if (!pair->diff_saved)
+            printf("error: cannot save diff image '%s'\n", path.c_str());
+        frame_free(&mask);
+    }
+
+    batch_free(&base);
+    batch_free(&shot);
+}
+
+
+//=============================================================================
+// Running a batch
+
+// The pairs of a batch, by name, and the files without a partner
+struct BatchSummary
+{
+    std::vector<BatchPair> pairs;
+    std::vector<std::string> only_base, only_new;
+    int counts[4];              // pairs with each status
+    double seconds;
+};
+
+
+bool batch_size_more(const BatchPair *a, const BatchPair *b)
+{
+    return a->size > b->size;
+}
+
+
+// Compare the same-named PNG and BMP files of two directories on all
+// cores
+bool batch_compare(const BatchSettings *settings, BatchSummary *summary)
+{
+    std::map<std::string, BatchPair> base_files, new_files;
+    if (!batch_list(settings->base_dir, &base_files) ||
+        !batch_list(settings->new_dir, &new_files))
+        return false;
+    if (settings->diff_dir)
+        CreateDirectory(settings->diff_dir, NULL);
+
+    // pair the names; both maps are sorted by key, so the pairs are too
+    summary->pairs.clear();
+    summary->only_base.clear();
+    summary->only_new.clear();
+    std::map<std::string, BatchPair>::iterator i = base_files.begin();
+    std::map<std::string, BatchPair>::iterator j = new_files.begin();
+    while (i != base_files.end() || j != new_files.end()) {
+        if (j == new_files.end() ||
+            (i != base_files.end() && i->first < j->first)) {
+            summary->only_base.push_back(i->second.name);
+            ++i;
+        } else if (i == base_files.end() || j->first < i->first) {
+            summary->only_new.push_back(j->second.name);
+            ++j;
+        } else {
+            BatchPair pair = j->second;
+            pair.settings = settings;
+            pair.size += i->second.size;
+            pair.status = BATCH_ERROR;
+            summary->pairs.push_back(pair);
+            ++i;
+            ++j;
+        }
+    }
+
+    // queue the largest first
+    std::vector<BatchPair*> order;
+    for (unsigned int k=0; k<summary->pairs.size(); k++)
+        order.push_back(&summary->pairs[k]);
+    std::sort(order.begin(), order.end(), batch_size_more);
+
+    DWORD start = GetTickCount();
+    ThreadPool pool;
+    png_startup();
+    bool ret = pool_init(&pool, 0);
+    if (ret) {
+        for (unsigned int k=0; k<order.size(); k++)
+            pool_add(&pool, batch_task, order[k]);
+        pool_free(&pool);
+    }
+    png_shutdown();
+    summary->seconds = (GetTickCount() - start) / 1000.0;
+
+    memset(summary->counts, 0, sizeof(summary->counts));
+    for (unsigned int k=0; k<summary->pairs.size(); k++)
+        summary->counts[summary->pairs[k].status]++;
+    return ret;
+}
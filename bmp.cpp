@@ -2,6 +2,7 @@
 
 // c includes
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
 
@@ -215,3 +216,172 @@ bool save_bitmap_file(HBITMAP hBmp, HDC hDC, const char *filename)
     return true;
 }
 // End of Mark Hammond copyrighted code.
+
+
+// Encode 32-bit pixels (top row first) as a BMP file in memory.  '*data'
+// is allocated with malloc().
+bool encode_bitmap_memory(const unsigned char *pixels, int width, int height,
+                          int stride, unsigned char **data, int *size)
+{
+    BITMAPFILEHEADER hdr;
+    BITMAPINFOHEADER info;
+    int row = width * 4;
+
+    memset(&info, 0, sizeof(info));
+    info.biSize = sizeof(BITMAPINFOHEADER);
+    info.biWidth = width;
+    info.biHeight = -height; // top-down rows
+    info.biPlanes = 1;
+    info.biBitCount = 32;
+    info.biCompression = BI_RGB;
+    info.biSizeImage = row * height;
+
+    hdr.bfType = 0x4d42;        // 0x42 = "B" 0x4d = "M" 
+    hdr.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+    hdr.bfSize = hdr.bfOffBits + info.biSizeImage;
+    hdr.bfReserved1 = 0;
+    hdr.bfReserved2 = 0;
+
+    *size = hdr.bfSize;
+    *data = (unsigned char*) malloc(*size);
+    if (!*data) {
+        printf("error: out of memory\n");
+        return false;
+    }
+
+    unsigned char *p = *data;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, &info, sizeof(info));
+    p += sizeof(info);
+    for (int i=0; i<height; i++, p += row)
+        memcpy(p, pixels + i * stride, row);
+    
+    return true;
+}
+
+
+// A BMP file mapped into memory.  'frame' shows its pixels (read only):
+// in place for 32-bit files, converted into a new frame for 24-bit ones.
+struct BitmapView
+{
+    HANDLE file;
+    HANDLE mapping;
+    const unsigned char *data;
+    Frame frame;
+    bool copied;                // 'frame' holds its own pixels
+};
+
+
+void bmp_unmap(BitmapView *view)
+{
+    if (view->copied)
+        frame_free(&view->frame);
+    if (view->data)
+        UnmapViewOfFile(view->data);
+    if (view->mapping)
+        CloseHandle(view->mapping);
+    if (view->file != INVALID_HANDLE_VALUE)
+        CloseHandle(view->file);
+    view->data = NULL;
+    view->mapping = NULL;
+    view->file = INVALID_HANDLE_VALUE;
+}
+
+
+// Map an uncompressed 24- or 32-bit BMP file, so that its pixels are read
+// straight from the file cache.  Returns false without a message if the
+// file cannot be mapped or has another layout; other loaders may still
+// read it.
+bool bmp_map_file(const char *filename, BitmapView *view)
+{
+    view->mapping = NULL;
+    view->data = NULL;
+    view->copied = false;
+    frame_init(&view->frame);
+
+    view->file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (view->file == INVALID_HANDLE_VALUE)
+        return false;
+    DWORD size = GetFileSize(view->file, NULL);
+    if (size == INVALID_FILE_SIZE || 
+        size < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER)) {
+        bmp_unmap(view);
+        return false;
+    }
+    view->mapping = CreateFileMapping(view->file, NULL, PAGE_READONLY, 
+                                      0, 0, NULL);
+    if (view->mapping)
+        view->data = (const unsigned char*) MapViewOfFile(
+            view->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view->data) {
+        bmp_unmap(view);
+        return false;
+    }
+
+    BITMAPFILEHEADER hdr;
+    BITMAPINFOHEADER info;
+    memcpy(&hdr, view->data, sizeof(hdr));
+    memcpy(&info, view->data + sizeof(hdr), sizeof(info));
+    int width = info.biWidth;
+    int height = info.biHeight < 0 ? -info.biHeight : info.biHeight;
+    int bits = info.biBitCount;
+    int row = ((width * bits + 31) / 32) * 4;
+
+    // 32-bit bitfields are accepted only in the usual BGRX order; the
+    // masks follow the info header and are read only if the file holds
+    // them
+    const DWORD *masks = (const DWORD*) (view->data + sizeof(hdr) + 
+                                         sizeof(info));
+    bool layout = hdr.bfType == 0x4d42 && 
+        info.biSize >= sizeof(BITMAPINFOHEADER) && info.biPlanes == 1 &&
+        width > 0 && height > 0 && width <= 0x8000 && height <= 0x8000 &&
+        ((bits == 32 && (info.biCompression == BI_RGB ||
+                         (info.biCompression == BI_BITFIELDS &&
+                          info.biSize == sizeof(BITMAPINFOHEADER) &&
+                          size >= sizeof(hdr) + sizeof(info) + 12 &&
+                          hdr.bfOffBits >= sizeof(hdr) + sizeof(info) + 12 &&
+                          masks[0] == 0xff0000 && masks[1] == 0xff00 &&
+                          masks[2] == 0xff))) ||
+         (bits == 24 && info.biCompression == BI_RGB)) &&
+        hdr.bfOffBits <= size && 
+        (long long) row * height <= (long long) (size - hdr.bfOffBits);
+    if (!layout) {
+        bmp_unmap(view);
+        return false;
+    }
+
+    // rows are stored bottom-up unless the height is negative
+    const unsigned char *top = view->data + hdr.bfOffBits;
+    int stride = row;
+    if (info.biHeight > 0) {
+        top += (height - 1) * row;
+        stride = -row;
+    }
+
+    if (bits == 32) {
+        view->frame.pixels = (unsigned char*) top;
+        view->frame.width = width;
+        view->frame.height = height;
+        view->frame.stride = stride;
+        return true;
+    }
+
+    if (!frame_create(&view->frame, 0, 0, width, height)) {
+        bmp_unmap(view);
+        return false;
+    }
+    view->copied = true;
+    for (int y=0; y<height; y++) {
+        const unsigned char *src = top + y * stride;
+        unsigned char *dst = view->frame.pixels + y * view->frame.stride;
+        for (int x=0; x<width; x++) {
+            dst[x*4] = src[x*3];
+            dst[x*4+1] = src[x*3+1];
+            dst[x*4+2] = src[x*3+2];
+            dst[x*4+3] = 0;
+        }
+    }
+    return true;
+}
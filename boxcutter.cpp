@@ -14,24 +14,49 @@
 
 // c includes
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
 
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 
 // windows includes
 #include <windows.h>
 #include <wincon.h>
 #include <commctrl.h>
+#include <shellapi.h>
 #include <winuser.h>
 #include <io.h>
 #include <conio.h>
 #include <fcntl.h>
 
-#include "bmp.cpp"
-#include "png.cpp"
+#include "libboxcutter.cpp"
+#include "pool.cpp"
+#include "window_index.cpp"
+#include "window_capture.cpp"
+#include "lz.cpp"
+#include "motion.cpp"
+#include "replay.cpp"
+#include "stream.cpp"
+#include "cpu.cpp"
+#include "yuv.cpp"
+#include "deflate.cpp"
+#include "anim.cpp"
+#include "mask.cpp"
+#include "compare.cpp"
+#include "wait.cpp"
+#include "find.cpp"
+#include "findcolor.cpp"
+#include "stats.cpp"
+#include "phash.cpp"
+#include "ssim.cpp"
+#include "batch.cpp"
+#include "scroll.cpp"
+#include "thumb.cpp"
+#include "redact.cpp"
 
 
 #define BOX_VERSION "1.6"
@@ -40,12 +65,130 @@
 const char* g_usage = "\n\
 usage: boxcutter [OPTIONS] [OUTPUT_FILENAME]\n\
 Saves a screenshot to 'OUTPUT_FILENAME' if given.  Only output formats\n\
-'*.bmp' and '*.png' are supported.  If no file name is given,\n\
-screenshot is stored on clipboard by default.\n\
+'*.bmp', '*.png', and '*.qoi' are supported.  If no file name is given,\n\
+screenshot is stored on clipboard by default.  If the file name is '-',\n\
+frames are written to stdout, each after a 40 byte header.\n\
 \n\
 OPTIONS\n\
   -c, --coords X1,Y1,X2,Y2    capture the rectange (X1,Y1)-(X2,Y2)\n\
   -f, --fullscreen            capture the full screen\n\
+  -m, --multi                 select several boxes, then press Enter to save\n\
+                              them as OUTPUT_1, OUTPUT_2, ...\n\
+  -s, --snap                  snap the box to the window under the cursor;\n\
+                              click without dragging to take that window\n\
+  -w, --window TITLE|HWND|all capture windows (even covered ones) matching\n\
+                              TITLE, the handle HWND (0x1a2b or\n\
+                              handle:6699), or all windows; minimized\n\
+                              windows are skipped unless given by handle\n\
+  -r, --resident              stay in the tray and save OUTPUT_1, OUTPUT_2,\n\
+                              ... on PrintScreen (full screen or --coords)\n\
+                              and Alt+PrintScreen (active window)\n\
+  -i, --interval MSEC         capture every MSEC milliseconds into OUTPUT_1,\n\
+                              OUTPUT_2, ... (full screen unless --coords)\n\
+  -n, --count N               stop interval capture after N frames\n\
+                              (default: until Ctrl+C)\n\
+  --replay SECONDS            with --interval, keep the last SECONDS of\n\
+                              frames compressed in memory and save them only\n\
+                              on Ctrl+PrintScreen or Ctrl+C\n\
+  --replay-mem MB             memory limit for --replay (default: 512)\n\
+  --stdout                    same as an OUTPUT_FILENAME of '-'\n\
+  --format raw|png|bmp|qoi    frame format on stdout (default: raw pixels)\n\
+  -a, --anim                  with --interval, write one animated OUTPUT\n\
+                              ('*.gif' or '*.png') instead of OUTPUT_1, ...\n\
+  --y4m                       with --interval, write OUTPUT (or '-' for\n\
+                              stdout) as YUV4MPEG2 video for video encoders\n\
+  --half                      with --y4m, halve the width and height\n\
+  --scroll NOTCHES            capture (full screen unless --coords), then\n\
+                              scroll it NOTCHES mouse wheel notches at a\n\
+                              time until it stops moving (or --count\n\
+                              times), and stitch it into one tall OUTPUT\n\
+                              ('*.png')\n\
+  --compare REF               compare the capture (full screen unless\n\
+                              --coords) with the image REF; exit status is\n\
+                              0 if it matches, 2 if it differs\n\
+  --tolerance N               with --compare, ignore channel differences up\n\
+                              to N (default: 0)\n\
+  --max-diff N                with --compare, allow up to N differing pixels\n\
+                              (default: 0)\n\
+  --diff-mask FILE            with --compare, save the differences in red\n\
+                              over a faded copy of the capture to FILE\n\
+  --ssim MIN                  with --compare, match if the structural\n\
+                              similarity (SSIM, 0 to 1) is at least MIN\n\
+                              instead of counting pixels; --diff-mask then\n\
+                              saves a heatmap of it\n\
+  --ms-ssim MIN               like --ssim, with multi-scale SSIM\n\
+  --compare-dirs BASE NEW     compare each PNG and BMP file in directory NEW\n\
+                              with the same-named file in BASE, as with\n\
+                              --compare, and print a JSON summary; exit\n\
+                              status is 2 if a pair differs or a file has\n\
+                              no partner\n\
+  --diff-dir DIR              with --compare-dirs, save the differences of\n\
+                              each failing pair to DIR\n\
+  --wait-stable K             capture (full screen unless --coords) once it\n\
+                              is unchanged for K polls in a row\n\
+  --wait-change               capture (full screen unless --coords) once it\n\
+                              differs from how it first looked\n\
+  --poll MS                   with --wait-*, poll every MS milliseconds\n\
+                              (default: 50)\n\
+  --timeout MS                with --wait-*, give up after MS milliseconds\n\
+                              and exit with status 3\n\
+  --probe X,Y[,X,Y...]        print the colors of the given pixels as\n\
+                              'X,Y RRGGBB' lines, copying only the screen\n\
+                              around them; may be repeated\n\
+  --json                      print --probe and --find-color results as\n\
+                              JSON\n\
+  --find TEMPLATE             print where the image TEMPLATE appears in the\n\
+                              capture (full screen unless --coords) as\n\
+                              'TEMPLATE X1,Y1,X2,Y2 SCORE' lines; may be\n\
+                              repeated; exit status is 2 if one is missing\n\
+  --threshold F               with --find, lowest similarity score (0 to 1)\n\
+                              to report (default: 0.9)\n\
+  --find-rect X1,Y1,X2,Y2     with --find, save this rectangle, relative to\n\
+                              the first template's best match, to OUTPUT\n\
+                              (default: the match itself)\n\
+  --stats                     print histograms, mean and variance, distinct\n\
+                              and dominant colors of the capture (full\n\
+                              screen unless --coords) as JSON, and save it\n\
+                              to OUTPUT if given\n\
+  --find-color RRGGBB[:TOL]   count the pixels of the capture (full screen\n\
+                              unless --coords) within TOL of a color, and\n\
+                              print the boxes X1,Y1,X2,Y2 of their largest\n\
+                              regions; exit status is 2 if there are none\n\
+  --max-regions N             with --find-color, print at most N regions\n\
+                              (default: 20)\n\
+  --phash                     print the pHash and dHash of the capture\n\
+                              (full screen unless --coords) in hex, and\n\
+                              save it to OUTPUT if given\n\
+  --thumb WxH[,WxH...]        also save each capture saved to a file\n\
+                              (plain or --interval) scaled down to fit\n\
+                              WxH, as OUTPUT_WxH\n\
+  --phash-index FILE          add each capture saved to a file (plain,\n\
+                              --interval, or --phash) to the index FILE\n\
+  --phash-search FILE         print the captures in the index FILE within\n\
+                              --distance of the capture's pHash as\n\
+                              'DIST PHASH NAME' lines; exit status is 2 if\n\
+                              there are none\n\
+  --distance D                with --phash-search, largest Hamming distance\n\
+                              (0 to 64, default: 10)\n\
+  --ignore X1,Y1,X2,Y2        with --compare, --wait-*, or --phash(-search),\n\
+                              leave out the screen rectangle\n\
+                              (X1,Y1)-(X2,Y2); may be repeated\n\
+  --ignore-mask FILE          with --compare, --wait-*, or --phash(-search),\n\
+                              leave out the black pixels of the image FILE\n\
+                              (the size of the capture)\n\
+  --redact X1,Y1,X2,Y2[:EFFECT]\n\
+                              cover the screen rectangle (X1,Y1)-(X2,Y2)\n\
+                              in every capture before it is used; EFFECT\n\
+                              is fill[=RRGGBB] (default: black),\n\
+                              pixelate[=N] (N x N blocks, default 16), or\n\
+                              blur[=R] (radius R, default 12); may be\n\
+                              repeated\n\
+  --redact-window SPEC[:EFFECT]\n\
+                              cover the windows matching SPEC (as with\n\
+                              --window) wherever they are at each capture\n\
+  --shm NAME                  with --interval, publish frames in the shared\n\
+                              memory ring NAME instead of saving them\n\
+  --shm-slots N               frames in the --shm ring (default: 4)\n\
   -v, --version               display version information\n\
   -h, --help                  display help message\n\
 ";
@@ -64,121 +207,19 @@ BoxCutterWindow *g_win = NULL;
 
 
 //=============================================================================
-// functions
-
-
-
-// Using swaps, ensure that x2 >= x, y2 >= y for capturing a rectangle of the
-// screen.
-void normalize_coords(int *x, int *y, int *x2, int *y2)
-{
-    if (*x > *x2) {
-        int tmp = *x;
-        *x = *x2;
-        *x2 = tmp;
-    }
-    if (*y > *y2) {
-        int tmp = *y;
-        *y = *y2;
-        *y2 = tmp;
-    }
-}
-
-
-void get_screen_rect(RECT *rect)
-{
-    //GetWindowRect(GetDesktopWindow(), rect);
-    rect->left = GetSystemMetrics(SM_XVIRTUALSCREEN);
-    rect->top = GetSystemMetrics(SM_YVIRTUALSCREEN);
-    rect->right = GetSystemMetrics(SM_CXVIRTUALSCREEN) + rect->left;
-    rect->bottom = GetSystemMetrics(SM_CYVIRTUALSCREEN) + rect->top;
-}
-
-
-// Captures a screenshot from a region of the screen
-// saves it to a file
-bool capture_screen(const char *filename, int x, int y, int x2, int y2)
-{
-    // normalize coordinates
-    normalize_coords(&x, &y, &x2, &y2);
-    int w = x2 - x;
-    int h = y2 - y;
-
-    // copy screen to bitmap
-    HDC screen_dc = GetDC(0);
-    HDC shot_dc = CreateCompatibleDC(screen_dc);
-    HBITMAP shot_bitmap =  CreateCompatibleBitmap(screen_dc, w, h);
-    HGDIOBJ old_obj = SelectObject(shot_dc, shot_bitmap);
-    
-    if (!BitBlt(shot_dc, 0, 0, w, h, screen_dc, x, y, SRCCOPY)) {
-        printf("error: BitBlt failed\n");
-        return false;
-    }
-    
-    // save bitmap to file
-    bool ret = false;
-    
-    int len = strlen(filename);
-    if (len > 4 && strcasecmp(filename + len - 4, ".png") == 0) {
-        ret = save_png_file(shot_bitmap, shot_dc, filename);
-    } else if (len > 4 && strcasecmp(filename + len - 4, ".bmp") == 0) {
-        ret = save_bitmap_file(shot_bitmap, shot_dc, filename);
-    } else {
-        printf("error: unknown output file format\n");
-        ret = false;
-    }
-    
-    DeleteDC(shot_dc);
-    DeleteDC(screen_dc);
-    SelectObject(shot_dc, old_obj);
-    
-    return ret;
-}
-
-
-// Captures a screenshot from a region of the screen
-// saves it to the clipboard
-bool capture_screen_clipboard(HWND hwnd, int x, int y, int x2, int y2)
-{
-    // normalize coordinates
-    normalize_coords(&x, &y, &x2, &y2);
-    int w = x2 - x;
-    int h = y2 - y;
-
-    // copy screen to bitmap
-    HDC screen_dc = GetDC(0);
-    HDC shot_dc = CreateCompatibleDC(screen_dc);
-    HBITMAP shot_bitmap =  CreateCompatibleBitmap(screen_dc, w, h);
-    HGDIOBJ old_obj = SelectObject(shot_dc, shot_bitmap);
-    
-    if (!BitBlt(shot_dc, 0, 0, w, h, screen_dc, x, y, SRCCOPY)) {
-        printf("error: BitBlt failed\n");
-        return false;
-    }
-    
-    // save bitmap to clipboard
-    bool ret = false;
-    if (OpenClipboard(hwnd)) {
-        if (EmptyClipboard()) {
-            if (SetClipboardData(CF_BITMAP, shot_bitmap))
-                ret = true;
-        }
-        CloseClipboard();
-    } else {
-        printf("error: could not open clipboard\n");
-    }
-
-    // clean up
-    DeleteDC(shot_dc);
-    DeleteDC(screen_dc);
-    SelectObject(shot_dc, old_obj);
-    
-    return ret;
-}
+// Window class for manual screenshot   
+//
+// The screen is captured once into a frozen frame when the window is
+// frozen.  The window then covers the desktop and paints that frame,
+// composing the selection outline in a back buffer.  Mouse movement only
+// records the new selection; a timer running at the display refresh rate
+// repaints just the strips the outline left and entered.
 
+// thickness of the selection outline in pixels
+const int g_outline_width = 2;
 
-//=============================================================================
-// Window class for manual screenshot   
+// mouse movement (pixels) still treated as a click when snapping
+const int g_click_slop = 2;
 
 class BoxCutterWindow
 {
@@ -189,8 +230,18 @@ public:
         m_drag(false),
         m_draw(false),
         m_filename(filename),
-        m_have_coords(false)
+        m_have_coords(false),
+        m_back_dc(NULL),
+        m_back_bitmap(NULL),
+        m_back_old(NULL),
+        m_shown(false),
+        m_multi(false),
+        m_snap(false),
+        m_hover(false)
     {
+        frame_init(&m_frame);
+        index_init(&m_index);
+
         // fill wndclass structure
         WNDCLASS wc;
         strcpy(m_class_name, g_class_name);
@@ -209,11 +260,10 @@ public:
         ATOM class_atom = RegisterClass(&wc);
         
         // determine screen dimensions
-        RECT rect;
-        get_screen_rect(&rect);
+        get_screen_rect(&m_screen);
         
         // create window
-        DWORD exstyle = WS_EX_TRANSPARENT;
+        DWORD exstyle = WS_EX_TOPMOST | WS_EX_TOOLWINDOW;
         DWORD style = WS_POPUP;
         
         // set this window as the receiver of messages
@@ -224,7 +274,9 @@ public:
                                   title,
                                   style,
                                   // dimensions
-                                  0, 0, rect.right, rect.bottom,
+                                  m_screen.left, m_screen.top, 
+                                  m_screen.right - m_screen.left, 
+                                  m_screen.bottom - m_screen.top,
                                   0, // no parent
                                   0, // no menu
                                   hinst, //module_instance,
@@ -233,11 +285,47 @@ public:
     
     ~BoxCutterWindow()
     {
+        if (m_back_dc) {
+            SelectObject(m_back_dc, m_back_old);
+            DeleteDC(m_back_dc);
+            DeleteObject(m_back_bitmap);
+        }
+        index_free(&m_index);
+        frame_free(&m_frame);
     }
 
     //===============================
     // functions to manipulate window
     
+    // Capture the whole screen into the frozen frame.  Must be called
+    // before the window is shown.
+    bool freeze()
+    {
+        if (!frame_capture(&m_frame, m_screen.left, m_screen.top,
+                           m_screen.right, m_screen.bottom))
+            return false;
+
+        // allocate back buffer for composing the selection
+        HDC screen_dc = GetDC(0);
+        m_back_dc = CreateCompatibleDC(screen_dc);
+        m_back_bitmap = CreateCompatibleBitmap(screen_dc, 
+                                               m_frame.width, m_frame.height);
+        m_back_old = SelectObject(m_back_dc, m_back_bitmap);
+
+        // redraw once per display refresh
+        int refresh = GetDeviceCaps(screen_dc, VREFRESH);
+        if (refresh <= 1)
+            refresh = 60;
+        ReleaseDC(0, screen_dc);
+        SetTimer(m_handle, 1, 1000 / refresh, NULL);
+
+        // index window rectangles once for snapping
+        if (m_snap)
+            index_build(&m_index, &m_screen, m_handle);
+        
+        return true;
+    }
+
     void show(bool enabled=true)
     {
         if (enabled)
@@ -259,8 +347,22 @@ public:
     }
     
     
+    // Keep selecting boxes until Enter is pressed
+    void set_multi(bool multi)
+    {
+        m_multi = multi;
+    }
+
+    // Snap the box to the window under the cursor.  Must be called before
+    // freeze().
+    void set_snap(bool snap)
+    {
+        m_snap = snap;
+    }
+
     void close()
     {
+        KillTimer(m_handle, 1);
         DestroyWindow(m_handle);
     }    
     
@@ -277,6 +379,12 @@ public:
         return m_handle;
     }
 
+    // the frozen screen frame captured by freeze()
+    Frame *get_frame()
+    {
+        return &m_frame;
+    }
+
     void get_coords(int *x1, int *y1, int *x2, int *y2) 
     {
         *x1 = m_start.x;
@@ -290,6 +398,12 @@ public:
         return m_have_coords;
     }
 
+    // boxes confirmed in multi-selection mode (screen coordinates)
+    const std::vector<RECT> &get_selections()
+    {
+        return m_selections;
+    }
+
     //=======================================
     // event callbacks
     static LRESULT CALLBACK WindowProc(HWND hwnd,
@@ -303,7 +417,6 @@ public:
         
             switch (uMsg) {
                 case WM_DESTROY: 
-                    g_win->close();
                     PostQuitMessage(0);
                     return 0;
             
@@ -318,6 +431,22 @@ public:
                 case WM_LBUTTONUP:
                     g_win->on_mouse_up();
                     return 0;
+
+                case WM_KEYDOWN:
+                    g_win->on_key_down(wParam);
+                    return 0;
+
+                case WM_TIMER:
+                    g_win->on_timer();
+                    return 0;
+
+                case WM_ERASEBKGND:
+                    // the frozen frame covers the whole window
+                    return 1;
+
+                case WM_PAINT:
+                    g_win->on_paint();
+                    return 0;
             }
         }
         
@@ -332,23 +461,46 @@ public:
         // start draging
         m_drag = true;
         GetCursorPos(&m_start);
+        m_end = m_start;
+        SetCapture(m_handle);
     }
     
     // mouse button up callback
     void on_mouse_up()
     {
-        
-        // if drawing has occurred, clean it up
+        ReleaseCapture();
+
         if (m_draw) {
-            // cleanup rectangle on desktop
+            GetCursorPos(&m_end);
+        } else if (m_drag && m_hover) {
+            // a click without dragging takes the snapped window
+            m_start.x = m_hover_rect.left;
+            m_start.y = m_hover_rect.top;
+            m_end.x = m_hover_rect.right;
+            m_end.y = m_hover_rect.bottom;
+            m_draw = true;
+        }
+
+        if (m_multi) {
+            // bring the outline up to date, then keep the box and wait
+            // for more
+            RECT sel;
+            on_timer();
+            if (m_drag && get_selection(&sel) && !IsRectEmpty(&sel)) {
+                OffsetRect(&sel, m_screen.left, m_screen.top);
+                m_selections.push_back(sel);
+            }
             m_drag = false;
             m_draw = false;
-            
-            HDC hdc = CreateDC("DISPLAY", NULL, NULL, NULL);
-            SetROP2(hdc, R2_NOTXORPEN);
-            Rectangle(hdc, m_start.x, m_start.y, m_end.x, m_end.y);
-            DeleteDC(hdc);
 
+            // the outline on screen now belongs to the kept box
+            m_shown = false;
+            return;
+        }
+
+        if (m_draw) {
+            m_drag = false;
+            m_draw = false;
             m_have_coords = true;
         }
         
@@ -359,31 +511,197 @@ public:
     // callback for mouse movement
     void on_mouse_move()
     {
-        // get current mouse coordinates
+        // if mouse is down, record new selection corner.  Drawing is
+        // deferred to the next refresh tick.
         POINT pos;
         GetCursorPos(&pos);
-        
-        // if mouse is down, process drag
+
         if (m_drag) {
-            HDC hdc = CreateDC("DISPLAY", NULL, NULL, NULL);
-            SetROP2(hdc, R2_NOTXORPEN);
-            
-            // erase old rectangle
-            if (m_draw) {
-                Rectangle(hdc, m_start.x, m_start.y, m_end.x, m_end.y);
-            }
-            
-            // draw new rectangle
-            m_draw = true;
-            Rectangle(hdc, m_start.x, m_start.y, pos.x, pos.y);
             m_end = pos;
-            
-            DeleteDC(hdc);
+
+            // small movements still count as a click on the snapped window
+            if (m_snap && !m_draw &&
+                abs(pos.x - m_start.x) <= g_click_slop &&
+                abs(pos.y - m_start.y) <= g_click_slop)
+                return;
+            m_draw = true;
+        } else if (m_snap) {
+            // O(1) grid lookup instead of WindowFromPoint() per move
+            RECT rect;
+            m_hover = index_find(&m_index, pos, &rect) &&
+                IntersectRect(&m_hover_rect, &rect, &m_screen);
+        }
+    }
+
+    // key press callback
+    void on_key_down(WPARAM key)
+    {
+        // escape cancels the screenshot
+        if (key == VK_ESCAPE) {
+            m_drag = false;
+            m_draw = false;
+            m_selections.clear();
+            m_active = false;
+        }
+
+        if (!m_multi || m_drag)
+            return;
+
+        if (key == VK_RETURN) {
+            // confirm all boxes
+            m_have_coords = !m_selections.empty();
+            m_active = false;
+        } else if (key == VK_BACK && !m_selections.empty()) {
+            // forget the last box
+            RECT sel = m_selections.back();
+            m_selections.pop_back();
+            OffsetRect(&sel, -m_screen.left, -m_screen.top);
+
+            HDC dc = GetDC(m_handle);
+            paint_outline_strips(dc, &sel, NULL);
+            ReleaseDC(m_handle, dc);
+        }
+    }
+
+    // refresh tick: repaint only what changed since the last tick
+    void on_timer()
+    {
+        RECT sel;
+        bool have_sel = get_selection(&sel);
+        if (have_sel == m_shown && 
+            (!have_sel || memcmp(&sel, &m_drawn, sizeof(RECT)) == 0))
+            return;
+
+        HDC dc = GetDC(m_handle);
+        if (m_shown)
+            paint_outline_strips(dc, &m_drawn, have_sel ? &sel : NULL);
+        if (have_sel)
+            paint_outline_strips(dc, &sel, NULL);
+        ReleaseDC(m_handle, dc);
+
+        m_shown = have_sel;
+        m_drawn = sel;
+    }
+
+    // full repaint of exposed areas
+    void on_paint()
+    {
+        PAINTSTRUCT ps;
+        HDC dc = BeginPaint(m_handle, &ps);
+        if (m_back_dc)
+            paint_rect(dc, &ps.rcPaint);
+        EndPaint(m_handle, &ps);
+    }
+
+
+protected:
+
+    // Get the current selection in window coordinates
+    bool get_selection(RECT *sel)
+    {
+        if (!m_draw) {
+            if (!m_hover)
+                return false;
+            *sel = m_hover_rect;
+            OffsetRect(sel, -m_screen.left, -m_screen.top);
+            return true;
+        }
+        int x1 = m_start.x, y1 = m_start.y, x2 = m_end.x, y2 = m_end.y;
+        normalize_coords(&x1, &y1, &x2, &y2);
+        SetRect(sel, x1 - m_screen.left, y1 - m_screen.top,
+                x2 - m_screen.left, y2 - m_screen.top);
+        return true;
+    }
+
+    // Repaint the four outline strips of 'sel', skipping any strip that
+    // is unchanged because it is also an outline strip of 'keep'
+    void paint_outline_strips(HDC dc, const RECT *sel, const RECT *keep)
+    {
+        RECT strips[4], keep_strips[4];
+        get_outline_strips(sel, strips);
+        if (keep)
+            get_outline_strips(keep, keep_strips);
+
+        for (int i=0; i<4; i++) {
+            if (keep && memcmp(&strips[i], &keep_strips[i], 
+                               sizeof(RECT)) == 0)
+                continue;
+            paint_rect(dc, &strips[i]);
+        }
+    }
+
+    // Get the top, bottom, left, and right strips covered by the outline
+    void get_outline_strips(const RECT *sel, RECT *strips)
+    {
+        const int w = g_outline_width;
+        SetRect(&strips[0], sel->left - w, sel->top - w, 
+                sel->right + w, sel->top + w);
+        SetRect(&strips[1], sel->left - w, sel->bottom - w, 
+                sel->right + w, sel->bottom + w);
+        SetRect(&strips[2], sel->left - w, sel->top - w, 
+                sel->left + w, sel->bottom + w);
+        SetRect(&strips[3], sel->right - w, sel->top - w, 
+                sel->right + w, sel->bottom + w);
+    }
+
+    // Compose one rectangle of the window in the back buffer (frozen
+    // frame plus selection outline) and copy it to the window
+    void paint_rect(HDC dc, const RECT *rect)
+    {
+        int w = rect->right - rect->left;
+        int h = rect->bottom - rect->top;
+        if (w <= 0 || h <= 0)
+            return;
+
+        BitBlt(m_back_dc, rect->left, rect->top, w, h, 
+               m_frame.dc, rect->left, rect->top, SRCCOPY);
+
+        RECT sel;
+        for (unsigned int i=0; i<m_selections.size(); i++) {
+            sel = m_selections[i];
+            OffsetRect(&sel, -m_screen.left, -m_screen.top);
+            draw_outline(&sel, rect);
         }
+        if (get_selection(&sel))
+            draw_outline(&sel, rect);
+
+        BitBlt(dc, rect->left, rect->top, w, h, 
+               m_back_dc, rect->left, rect->top, SRCCOPY);
+    }
+
+    // Draw the outline of 'sel' in the back buffer, clipped to 'clip'
+    void draw_outline(const RECT *sel, const RECT *clip)
+    {
+        // outer black ring, inner white ring
+        RECT outer = *sel, inner = *sel;
+        InflateRect(&outer, g_outline_width, g_outline_width);
+        InflateRect(&inner, g_outline_width / 2, g_outline_width / 2);
+        fill_ring(&outer, &inner, clip, 
+                  (HBRUSH) GetStockObject(BLACK_BRUSH));
+        fill_ring(&inner, sel, clip, 
+                  (HBRUSH) GetStockObject(WHITE_BRUSH));
     }
 
+    // Fill the area between 'outer' and 'inner' in the back buffer,
+    // clipped to 'clip'
+    void fill_ring(const RECT *outer, const RECT *inner, const RECT *clip,
+                   HBRUSH brush)
+    {
+        RECT sides[4], part;
+        SetRect(&sides[0], outer->left, outer->top, 
+                outer->right, inner->top);
+        SetRect(&sides[1], outer->left, inner->bottom, 
+                outer->right, outer->bottom);
+        SetRect(&sides[2], outer->left, inner->top, 
+                inner->left, inner->bottom);
+        SetRect(&sides[3], inner->right, inner->top, 
+                outer->right, inner->bottom);
+        
+        for (int i=0; i<4; i++)
+            if (IntersectRect(&part, &sides[i], clip))
+                FillRect(m_back_dc, &part, brush);
+    }
 
-private:    
     char m_class_name[101];
     HWND m_handle;
     
@@ -393,141 +711,2121 @@ private:
     const char *m_filename;
     POINT m_start, m_end;
     bool m_have_coords;
+
+    // frozen screen and back buffer
+    RECT m_screen;
+    Frame m_frame;
+    HDC m_back_dc;
+    HBITMAP m_back_bitmap;
+    HGDIOBJ m_back_old;
+
+    // selection currently on screen (window coordinates)
+    bool m_shown;
+    RECT m_drawn;
+
+    // multi-selection mode
+    bool m_multi;
+    std::vector<RECT> m_selections;
+
+    // snapping to windows
+    bool m_snap;
+    WindowIndex m_index;
+    bool m_hover;               // cursor is over an indexed window
+    RECT m_hover_rect;          // that window's rectangle (screen)
 };
 
 
 //=============================================================================
+// Saving several selections in parallel
 
-// Display usage information
-void usage()
+// A box to crop from the frozen frame and save on a worker thread
+struct SaveTask
 {
-    printf(g_usage);
-}
+    const Frame *frame;
+    RECT rect;
+    char filename[MAX_PATH];
+    bool ok;
+};
 
-// Display version information
-void version()
+
+// Worker task: crop one box and encode it
+void save_task(void *arg)
 {
-    printf(g_version, BOX_VERSION);
+    SaveTask *task = (SaveTask*) arg;
+    Frame shot;
+    
+    task->ok = false;
+    if (frame_crop(task->frame, &shot, task->rect.left, task->rect.top,
+                   task->rect.right, task->rect.bottom)) {
+        task->ok = save_frame(&shot, task->filename);
+        frame_free(&shot);
+    }
 }
 
 
-// Pump the message queue for this process.
-int main_loop(BoxCutterWindow* win)
+// Save every box of a multi-selection as 'name_1.ext', 'name_2.ext', ...
+// with the encodes spread over all cores
+bool save_selections(const Frame *frame, const std::vector<RECT> &selections,
+                     const char *filename)
 {
-    int ret;
-    MSG msg; // message structure
-    while ((ret = GetMessage(&msg, 0, 0, 0)) != 0 && win->active())
-    {
-        if (ret == -1) {
-            // error occurred
-            break;
+    int n = selections.size();
+    SaveTask *tasks = new SaveTask [n];
+    
+    ThreadPool pool;
+    png_startup();
+    if (!pool_init(&pool, 0)) {
+        delete [] tasks;
+        png_shutdown();
+        return false;
+    }
+
+    for (int i=0; i<n; i++) {
+        tasks[i].frame = frame;
+        tasks[i].rect = selections[i];
+        numbered_filename(tasks[i].filename, MAX_PATH, filename, i+1);
+        pool_add(&pool, save_task, &tasks[i]);
+    }
+    pool_free(&pool);
+    png_shutdown();
+
+    bool ret = true;
+    for (int i=0; i<n; i++) {
+        if (tasks[i].ok) {
+            printf("screenshot saved to file: %s\n", tasks[i].filename);
+        } else {
+            printf("error: cannot save screenshot '%s'\n", tasks[i].filename);
+            ret = false;
         }
-        
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
     }
+    
+    delete [] tasks;
+    return ret;
+}
 
-    return msg.wParam;
+
+//=============================================================================
+// Capturing many windows
+
+// number of threads issuing PrintWindow() calls
+const int g_print_threads = 4;
+
+// A window to render on a capture worker and then save on an encode worker
+struct WindowTask
+{
+    WindowInfo info;
+    Frame frame;
+    char filename[MAX_PATH];
+    ThreadPool *encode_pool;
+    bool ok;
+};
+
+
+// Worker task: encode a rendered window
+void window_save_task(void *arg)
+{
+    WindowTask *task = (WindowTask*) arg;
+    task->ok = save_frame(&task->frame, task->filename);
+    frame_free(&task->frame);
 }
 
-// Setup the console for output (e.g. using printf)
-bool setup_console()
+
+// Worker task: render a window and hand it to the encoders
+void window_print_task(void *arg)
 {
-    int hConHandle;
-    long lStdHandle;
-    CONSOLE_SCREEN_BUFFER_INFO coninfo;
-	FILE *fp;
+    WindowTask *task = (WindowTask*) arg;
+    task->ok = false;
+    if (frame_print_window(&task->frame, task->info.hwnd))
+        pool_add(task->encode_pool, window_save_task, task);
+}
 
-    // create a console
-    if (!AttachConsole(ATTACH_PARENT_PROCESS)) {
-        // if no parent console then give up        
-        return false;
-    }
-    
-    
-	const unsigned int MAX_CONSOLE_LINES = 500;
-	// set the screen buffer to be big enough to let us scroll text
-	GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE),	&coninfo);
-	coninfo.dwSize.Y = MAX_CONSOLE_LINES;
-	SetConsoleScreenBufferSize(GetStdHandle(STD_OUTPUT_HANDLE),	coninfo.dwSize);
 
-    
-	// redirect unbuffered STDOUT to the console
-	lStdHandle = (long)GetStdHandle(STD_OUTPUT_HANDLE);    
-	hConHandle = _open_osfhandle(lStdHandle, _O_TEXT);
-	fp = _fdopen(hConHandle, "w");    
-    if (!fp) {
-        // could not open stdout
+// Capture every window matching 'spec' without raising it.  A single
+// window is saved to 'filename', several as 'name_1.ext', 'name_2.ext', ...
+bool capture_windows(const char *spec, const char *filename)
+{
+    std::vector<WindowInfo> windows;
+    if (!find_windows(spec, false, &windows))
         return false;
+
+    int n = windows.size();
+    WindowTask *tasks = new WindowTask [n];
+
+    // a few threads render windows while the rest encode them
+    ThreadPool print_pool, encode_pool;
+    png_startup();
+    bool ret = pool_init(&print_pool, std::min(g_print_threads, n));
+    if (ret && !pool_init(&encode_pool, 0)) {
+        pool_free(&print_pool);
+        ret = false;
     }
-	*stdout = *fp;
-	setvbuf(stdout, NULL, _IONBF, 0);
-    
-    
-	// redirect unbuffered STDIN to the console
-	lStdHandle = (long)GetStdHandle(STD_INPUT_HANDLE);
-	hConHandle = _open_osfhandle(lStdHandle, _O_TEXT);
-	fp = _fdopen(hConHandle, "r");
-    if (!fp) {
-        // could not open stdin
+    if (!ret) {
+        delete [] tasks;
+        png_shutdown();
         return false;
     }
-	*stdin = *fp;
-	setvbuf(stdin, NULL, _IONBF, 0);
 
-    
-	// redirect unbuffered STDERR to the console
-	lStdHandle = (long)GetStdHandle(STD_ERROR_HANDLE);
-	hConHandle = _open_osfhandle(lStdHandle, _O_TEXT);
-	fp = _fdopen(hConHandle, "w");
-    if (!fp) {
-        // could not open stderr
-        return false;
+    for (int i=0; i<n; i++) {
+        tasks[i].info = windows[i];
+        tasks[i].encode_pool = &encode_pool;
+        if (n == 1)
+            snprintf(tasks[i].filename, MAX_PATH, "%s", filename);
+        else
+            numbered_filename(tasks[i].filename, MAX_PATH, filename, i+1);
+        pool_add(&print_pool, window_print_task, &tasks[i]);
+    }
+    pool_free(&print_pool);
+    pool_free(&encode_pool);
+    png_shutdown();
+
+    for (int i=0; i<n; i++) {
+        if (tasks[i].ok) {
+            printf("window %p '%s' saved to file: %s\n", 
+                   tasks[i].info.hwnd, tasks[i].info.title, 
+                   tasks[i].filename);
+        } else {
+            printf("error: cannot save window %p '%s'\n", 
+                   tasks[i].info.hwnd, tasks[i].info.title);
+            ret = false;
+        }
     }
-	*stderr = *fp;
-	setvbuf(stderr, NULL, _IONBF, 0);
-
-	// make cout, wcout, cin, wcin, wcerr, cerr, wclog and clog
-	// point to console as well
-	std::ios::sync_with_stdio();
 
-    return true;
+    delete [] tasks;
+    return ret;
 }
 
 
-
 //=============================================================================
-// main function
+// Resident mode: stay in the tray and grab the screen on a global hotkey
+//
+// Everything that can be done ahead of time is: GDI+ is started, the
+// screen DC is held open, full-screen frames are preallocated, and an
+// encoder thread is waiting.  On WM_HOTKEY the message loop grabs the
+// whole screen into a spare frame before anything else; cropping,
+// encoding, and writing happen on the encoder thread.
 
+const char *g_resident_class_name = "BoxCutterResident";
 
-int main(int argc, char **argv)
-{
-    HINSTANCE hInstance = (HINSTANCE)GetModuleHandle(NULL);
+// hotkey ids
+const int HOTKEY_SCREEN = 1;    // PrintScreen: full screen or --coords
+const int HOTKEY_WINDOW = 2;    // Alt+PrintScreen: foreground window
 
-    InitCommonControls();
-    setup_console();
-    
-    // default screenshot filename
-    char *filename = NULL;
+// tray icon notifications
+const UINT WM_TRAY = WM_APP + 1;
 
-    // coordinates
-    bool use_coords = false;
-    int x1, y1, x2, y2;
-    
-    // parse command line
-    int i;
+// number of full-screen frames kept ready for grabbing
+const int g_resident_frames = 2;
 
-    // parse options
-    for (i=1; i<argc; i++) {
-        if (argv[i][0] != '-')
-            // argument is not an option
-            break;
+// most full-screen frames grabbed or waiting for the encoder at once;
+// hotkeys beyond that are dropped
+const int g_resident_max_frames = 8;
 
-        else if (strcmp(argv[i], "-f") == 0 ||
-                 strcmp(argv[i], "--fullscreen") == 0) 
-        {
-            RECT rect;
-            get_screen_rect(&rect);
+
+class ResidentWindow;
+
+// A grabbed screen waiting to be cropped and saved
+struct ResidentShot
+{
+    ResidentWindow *win;
+    Frame *frame;
+    RECT rect;
+    char filename[MAX_PATH];
+};
+
+void resident_save_task(void *arg);
+
+
+class ResidentWindow
+{
+public:
+    ResidentWindow(HINSTANCE hinst, const char *filename) :
+        m_hinst(hinst),
+        m_filename(filename),
+        m_use_coords(false),
+        m_count(0),
+        m_screen_dc(NULL),
+        m_frames(0),
+        m_png(false),
+        m_encoding(false),
+        m_handle(NULL),
+        m_tray_added(false)
+    {
+        memset(&m_tray, 0, sizeof(m_tray));
+        InitializeCriticalSection(&m_lock);
+        QueryPerformanceFrequency(&m_freq);
+    }
+
+    ~ResidentWindow()
+    {
+        stop();
+        DeleteCriticalSection(&m_lock);
+    }
+
+    // Grab the rectangle (x1,y1)-(x2,y2) on PrintScreen instead of the
+    // full screen
+    void set_coords(int x1, int y1, int x2, int y2)
+    {
+        normalize_coords(&x1, &y1, &x2, &y2);
+        SetRect(&m_coords, x1, y1, x2, y2);
+        m_use_coords = true;
+    }
+
+    // Create the hidden window, tray icon, hotkeys, and warm capture
+    // context
+    bool start()
+    {
+        WNDCLASS wc;
+        memset(&wc, 0, sizeof(wc));
+        wc.hInstance = m_hinst;
+        wc.lpszClassName = g_resident_class_name;
+        wc.lpfnWndProc = WindowProc;
+        wc.hIcon = LoadIcon(0, IDI_APPLICATION);
+        RegisterClass(&wc);
+
+        m_handle = CreateWindowEx(0, g_resident_class_name, "BoxCutter", 
+                                  WS_POPUP, 0, 0, 0, 0, 0, 0, m_hinst, NULL);
+        if (!m_handle) {
+            printf("error: cannot create resident window\n");
+            return false;
+        }
+
+        if (!RegisterHotKey(m_handle, HOTKEY_SCREEN, 0, VK_SNAPSHOT) ||
+            !RegisterHotKey(m_handle, HOTKEY_WINDOW, MOD_ALT, VK_SNAPSHOT)) {
+            printf("error: cannot register PrintScreen hotkeys\n");
+            return false;
+        }
+
+        // tray icon
+        memset(&m_tray, 0, sizeof(m_tray));
+        m_tray.cbSize = sizeof(m_tray);
+        m_tray.hWnd = m_handle;
+        m_tray.uID = 1;
+        m_tray.uFlags = NIF_ICON | NIF_MESSAGE | NIF_TIP;
+        m_tray.uCallbackMessage = WM_TRAY;
+        m_tray.hIcon = wc.hIcon;
+        strcpy(m_tray.szTip, "boxcutter (right click to quit)");
+        m_tray_added = Shell_NotifyIcon(NIM_ADD, &m_tray) != 0;
+
+        // warm capture context
+        m_screen_dc = GetDC(0);
+        get_screen_rect(&m_screen);
+        for (int i=0; i<g_resident_frames; i++) {
+            Frame *frame = new Frame;
+            if (!frame_create(frame, m_screen.left, m_screen.top,
+                              m_screen.right - m_screen.left,
+                              m_screen.bottom - m_screen.top)) {
+                delete frame;
+                return false;
+            }
+            m_free.push_back(frame);
+            m_frames++;
+        }
+
+        // warm encoder on its own low priority thread
+        png_startup();
+        m_png = true;
+        if (!pool_init(&m_encoder, 1))
+            return false;
+        m_encoding = true;
+        SetThreadPriority(m_encoder.threads[0], THREAD_PRIORITY_BELOW_NORMAL);
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+        
+        g_resident = this;
+        printf("boxcutter resident: PrintScreen captures the %s, "
+               "Alt+PrintScreen the active window\n",
+               m_use_coords ? "given coords" : "full screen");
+        return true;
+    }
+
+    // Finish pending saves and release everything
+    void stop()
+    {
+        if (!m_handle)
+            return;
+
+        if (m_encoding) {
+            pool_free(&m_encoder);
+            m_encoding = false;
+        }
+        if (m_png) {
+            png_shutdown();
+            m_png = false;
+        }
+
+        if (m_tray_added) {
+            Shell_NotifyIcon(NIM_DELETE, &m_tray);
+            m_tray_added = false;
+        }
+        UnregisterHotKey(m_handle, HOTKEY_SCREEN);
+        UnregisterHotKey(m_handle, HOTKEY_WINDOW);
+        DestroyWindow(m_handle);
+        m_handle = NULL;
+
+        for (unsigned int i=0; i<m_free.size(); i++) {
+            frame_free(m_free[i]);
+            delete m_free[i];
+        }
+        m_free.clear();
+        m_frames = 0;
+        if (m_screen_dc) {
+            ReleaseDC(0, m_screen_dc);
+            m_screen_dc = NULL;
+        }
+        g_resident = NULL;
+    }
+
+    // Pump messages until quit, grabbing on hotkeys ahead of all else
+    void run()
+    {
+        MSG msg;
+        int ret;
+        while ((ret = GetMessage(&msg, 0, 0, 0)) != 0) {
+            if (ret == -1)
+                break;
+            
+            if (msg.message == WM_HOTKEY) {
+                // msg.time only has tick resolution; time from here
+                LARGE_INTEGER received;
+                QueryPerformanceCounter(&received);
+                grab((int) msg.wParam, received);
+                continue;
+            }
+
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+    }
+
+    // Grab the screen now and queue the save.  'received' is when the
+    // hotkey message was taken off the queue.
+    void grab(int hotkey, LARGE_INTEGER received)
+    {
+        LARGE_INTEGER t0, t1;
+        QueryPerformanceCounter(&t0);
+
+        Frame *frame = take_frame();
+        if (!frame)
+            return;
+        bool ok = frame_grab(frame, m_screen_dc);
+
+        QueryPerformanceCounter(&t1);
+
+        if (!ok) {
+            give_frame(frame);
+            return;
+        }
+
+        // decide what to keep, now that the pixels are safe
+        ResidentShot *shot = new ResidentShot;
+        shot->win = this;
+        shot->frame = frame;
+        if (hotkey == HOTKEY_WINDOW) {
+            GetWindowRect(GetForegroundWindow(), &shot->rect);
+        } else if (m_use_coords) {
+            shot->rect = m_coords;
+        } else {
+            shot->rect = m_screen;
+        }
+        numbered_filename(shot->filename, MAX_PATH, m_filename, ++m_count);
+        pool_add(&m_encoder, resident_save_task, shot);
+
+        printf("hotkey latency: %.2f ms from hotkey message to pixels "
+               "(grab took %.2f ms)\n",
+               1000.0 * (t1.QuadPart - received.QuadPart) / m_freq.QuadPart,
+               1000.0 * (t1.QuadPart - t0.QuadPart) / m_freq.QuadPart);
+    }
+
+    // Get a spare full-screen frame, or a new one if all are still being
+    // encoded and there are fewer than g_resident_max_frames
+    Frame *take_frame()
+    {
+        Frame *frame = NULL;
+        bool grow = false;
+        EnterCriticalSection(&m_lock);
+        if (!m_free.empty()) {
+            frame = m_free.back();
+            m_free.pop_back();
+        } else if (m_frames < g_resident_max_frames) {
+            m_frames++;
+            grow = true;
+        }
+        LeaveCriticalSection(&m_lock);
+
+        if (grow) {
+            frame = new Frame;
+            if (!frame_create(frame, m_screen.left, m_screen.top,
+                              m_screen.right - m_screen.left,
+                              m_screen.bottom - m_screen.top)) {
+                delete frame;
+                drop_frame();
+                return NULL;
+            }
+        } else if (!frame) {
+            printf("error: encoder is behind, screenshot dropped\n");
+        }
+        return frame;
+    }
+
+    // Return a frame once it has been saved.  Frames beyond the
+    // g_resident_frames spares are freed.
+    void give_frame(Frame *frame)
+    {
+        EnterCriticalSection(&m_lock);
+        bool keep = (int) m_free.size() < g_resident_frames;
+        if (keep)
+            m_free.push_back(frame);
+        LeaveCriticalSection(&m_lock);
+
+        if (!keep) {
+            frame_free(frame);
+            delete frame;
+            drop_frame();
+        }
+    }
+
+    // Count one frame fewer in use
+    void drop_frame()
+    {
+        EnterCriticalSection(&m_lock);
+        m_frames--;
+        LeaveCriticalSection(&m_lock);
+    }
+
+    static LRESULT CALLBACK WindowProc(HWND hwnd,
+                                       UINT uMsg,
+                                       WPARAM wParam,
+                                       LPARAM lParam)
+    {
+        // right click on the tray icon quits
+        if (uMsg == WM_TRAY && 
+            (lParam == WM_RBUTTONUP || lParam == WM_LBUTTONDBLCLK)) {
+            PostQuitMessage(0);
+            return 0;
+        }
+        
+        return DefWindowProc(hwnd, uMsg, wParam, lParam);
+    }
+
+    static ResidentWindow *g_resident;
+
+protected:
+    HINSTANCE m_hinst;
+    const char *m_filename;
+    bool m_use_coords;
+    RECT m_coords;
+    int m_count;
+
+    // warm capture context
+    HDC m_screen_dc;
+    RECT m_screen;
+    std::vector<Frame*> m_free;
+    int m_frames;               // frames allocated, spare or in use
+    CRITICAL_SECTION m_lock;    // protects m_free, m_frames
+    ThreadPool m_encoder;
+    bool m_png;                 // GDI+ started
+    bool m_encoding;
+    LARGE_INTEGER m_freq;
+
+    HWND m_handle;
+    NOTIFYICONDATA m_tray;
+    bool m_tray_added;
+};
+
+ResidentWindow *ResidentWindow::g_resident = NULL;
+
+
+// Encoder task: crop a grabbed screen, save it, and recycle the frame
+void resident_save_task(void *arg)
+{
+    ResidentShot *shot = (ResidentShot*) arg;
+    Frame crop;
+
+    if (frame_crop(shot->frame, &crop, shot->rect.left, shot->rect.top,
+                   shot->rect.right, shot->rect.bottom)) {
+        if (save_frame(&crop, shot->filename))
+            printf("screenshot saved to file: %s\n", shot->filename);
+        else
+            printf("error: cannot save screenshot '%s'\n", shot->filename);
+        frame_free(&crop);
+    }
+
+    shot->win->give_frame(shot->frame);
+    delete shot;
+}
+
+//=============================================================================
+// Interval mode: grab a region every few milliseconds
+//
+// The capture loop only keeps time and grabs; what happens to each frame
+// is up to a FrameSink.
+
+// Ctrl+PrintScreen asks the current sink to dump (e.g. the replay ring)
+const int HOTKEY_DUMP = 3;
+
+// other processes can ask for a dump by setting this named event
+const char *g_dump_event_name = "BoxCutterDump";
+
+// set by Ctrl+C to end interval capture
+volatile bool g_interval_stop = false;
+
+BOOL WINAPI interval_ctrl_handler(DWORD type)
+{
+    if (type == CTRL_C_EVENT || type == CTRL_BREAK_EVENT) {
+        g_interval_stop = true;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+
+// What to do with the frames grabbed in interval mode
+class FrameSink
+{
+public:
+    virtual ~FrameSink() {}
+
+    // Grab 'rect' of the screen now
+    virtual bool capture(HDC screen_dc, const RECT *rect, DWORD time) = 0;
+
+    // The dump hotkey or event was triggered
+    virtual void dump() {}
+
+    // Capturing has ended
+    virtual bool finish() = 0;
+};
+
+
+// Grab a region every 'interval' milliseconds, 'count' times (forever if
+// count <= 0) or until Ctrl+C
+bool run_interval(const RECT *rect, int interval, int count, FrameSink *sink)
+{
+    SetConsoleCtrlHandler(interval_ctrl_handler, TRUE);
+    RegisterHotKey(NULL, HOTKEY_DUMP, MOD_CONTROL, VK_SNAPSHOT);
+    HANDLE dump_event = CreateEvent(NULL, FALSE, FALSE, g_dump_event_name);
+    HDC screen_dc = GetDC(0);
+
+    bool ret = true;
+    DWORD start = GetTickCount();
+    for (int n=0; ret && !g_interval_stop && (count <= 0 || n < count); n++) {
+        // wait for the next tick, serving dump requests meanwhile
+        DWORD due = start + n * interval;
+        while (!g_interval_stop) {
+            LONG wait = (LONG) (due - GetTickCount());
+            if (wait <= 0)
+                break;
+            
+            if (MsgWaitForMultipleObjects(1, &dump_event, FALSE, wait,
+                                          QS_ALLINPUT) == WAIT_OBJECT_0)
+                sink->dump();
+
+            MSG msg;
+            while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+                if (msg.message == WM_HOTKEY)
+                    sink->dump();
+            }
+        }
+        if (g_interval_stop)
+            break;
+
+        ret = sink->capture(screen_dc, rect, GetTickCount());
+    }
+
+    ReleaseDC(0, screen_dc);
+    CloseHandle(dump_event);
+    UnregisterHotKey(NULL, HOTKEY_DUMP);
+    SetConsoleCtrlHandler(interval_ctrl_handler, FALSE);
+
+    return sink->finish() && ret;
+}
+
+
+// Add the pHash of a capture saved as 'filename' to an index, under the
+// file's full path
+bool index_capture(PhashIndex *index, unsigned long long phash,
+                   const char *filename)
+{
+    char path[MAX_PATH];
+    DWORD len = GetFullPathName(filename, MAX_PATH, path, NULL);
+    return phash_index_add(index, phash, 
+                           len > 0 && len < MAX_PATH ? path : filename);
+}
+
+
+// Add a capture saved as 'filename' to the pHash index file 'index_file'
+bool index_capture_file(const char *index_file, const Frame *frame,
+                        const char *filename)
+{
+    unsigned long long phash, dhash;
+    phash_frame(frame, NULL, &phash, &dhash);
+
+    PhashIndex index;
+    if (!phash_index_open(&index, index_file, true))
+        return false;
+    bool ret = index_capture(&index, phash, filename);
+    phash_index_close(&index);
+    return ret;
+}
+
+
+// A frame being saved by a worker
+struct FileShot
+{
+    Frame frame;
+    char filename[MAX_PATH];
+    PhashIndex *index;          // index to add the frame to, or NULL
+    const std::vector<ThumbSize> *thumbs;   // thumbnails to save, or NULL
+    volatile bool *failed;      // set if the frame, its index entry, or a
+                                // thumbnail could not be saved
+    volatile LONG *pending;     // decremented once saved, or NULL
+};
+
+void file_save_task(void *arg)
+{
+    FileShot *shot = (FileShot*) arg;
+    bool ok = save_frame(&shot->frame, shot->filename);
+    if (ok) {
+        printf("screenshot saved to file: %s\n", shot->filename);
+        if (shot->index) {
+            unsigned long long phash, dhash;
+            phash_frame(&shot->frame, NULL, &phash, &dhash);
+            ok = index_capture(shot->index, phash, shot->filename);
+        }
+        for (unsigned int i=0; shot->thumbs && i<shot->thumbs->size(); i++)
+            ok = thumb_save(&shot->frame, &(*shot->thumbs)[i], 
+                            shot->filename) && ok;
+    } else
+        printf("error: cannot save screenshot '%s'\n", shot->filename);
+    if (!ok)
+        *shot->failed = true;
+    frame_free(&shot->frame);
+    if (shot->pending)
+        InterlockedDecrement(shot->pending);
+    delete shot;
+}
+
+
+// number of grabbed frames beyond one per encoder that may wait to be saved
+const int g_file_spare_frames = 2;
+
+
+// Save every frame as 'name_1.ext', 'name_2.ext', ... on all cores, with
+// the thumbnails 'thumbs', and add each to 'index' if not NULL.  Capturing
+// stops once a frame, index entry, or thumbnail fails to save.  Grabs are
+// skipped while the encoders are behind.
+class FileSink : public FrameSink
+{
+public:
+    FileSink(const char *filename, PhashIndex *index,
+             const std::vector<ThumbSize> &thumbs) :
+        m_filename(filename),
+        m_count(0),
+        m_dropped(0),
+        m_index(index),
+        m_thumbs(thumbs),
+        m_failed(false),
+        m_pending(0)
+    {
+        png_startup();
+        m_ok = pool_init(&m_pool, 0);
+    }
+
+    virtual bool capture(HDC screen_dc, const RECT *rect, DWORD time)
+    {
+        if (!m_ok || m_failed)
+            return false;
+
+        // if the encoders are behind, skip this grab
+        if (m_pending >= m_pool.nthreads + g_file_spare_frames) {
+            m_dropped++;
+            return true;
+        }
+
+        FileShot *shot = new FileShot;
+        if (!frame_create(&shot->frame, rect->left, rect->top, 
+                          rect->right - rect->left, 
+                          rect->bottom - rect->top) ||
+            !frame_grab(&shot->frame, screen_dc)) {
+            frame_free(&shot->frame);
+            delete shot;
+            return false;
+        }
+
+        numbered_filename(shot->filename, MAX_PATH, m_filename, ++m_count);
+        shot->index = m_index;
+        shot->thumbs = &m_thumbs;
+        shot->failed = &m_failed;
+        shot->pending = &m_pending;
+        InterlockedIncrement(&m_pending);
+        pool_add(&m_pool, file_save_task, shot);
+        return true;
+    }
+
+    virtual bool finish()
+    {
+        if (m_ok)
+            pool_free(&m_pool);
+        png_shutdown();
+        if (m_dropped > 0)
+            printf("encoders were behind, %d screenshots dropped\n", 
+                   m_dropped);
+        return m_ok && !m_failed;
+    }
+
+protected:
+    const char *m_filename;
+    int m_count;
+    int m_dropped;              // grabs skipped while the encoders were behind
+    PhashIndex *m_index;
+    std::vector<ThumbSize> m_thumbs;
+    ThreadPool m_pool;
+    bool m_ok;
+    volatile bool m_failed;     // a save failed
+    volatile LONG m_pending;    // frames grabbed but not yet saved
+};
+
+
+//=============================================================================
+// Stream frames to stdout as they are grabbed
+
+// number of grabbed frames that may wait for the writer
+const int g_stream_spare_frames = 3;
+
+
+class StreamSink;
+
+struct StreamShot
+{
+    StreamSink *sink;
+    Frame *frame;
+    unsigned long long timestamp;
+    int missed;             // grabs skipped just before this one
+};
+
+void stream_write_task(void *arg);
+
+
+// Write every frame, in order, to a stream from a single writer thread
+class StreamSink : public FrameSink
+{
+public:
+    StreamSink(const char *filename, const char *format, const RECT *rect) :
+        m_format(format),
+        m_missed(0),
+        m_failed(false)
+    {
+        InitializeCriticalSection(&m_lock);
+        m_ok = stream_open(&m_stream, filename);
+        if (m_ok && !pool_init(&m_writer, 1)) {
+            stream_close(&m_stream);
+            m_ok = false;
+        }
+        for (int i=0; m_ok && i<g_stream_spare_frames; i++) {
+            Frame *frame = new Frame;
+            if (frame_create(frame, rect->left, rect->top, 
+                             rect->right - rect->left, 
+                             rect->bottom - rect->top)) {
+                m_spare.push_back(frame);
+            } else {
+                delete frame;
+                finish();
+            }
+        }
+    }
+
+    virtual ~StreamSink()
+    {
+        for (unsigned int i=0; i<m_spare.size(); i++) {
+            frame_free(m_spare[i]);
+            delete m_spare[i];
+        }
+        DeleteCriticalSection(&m_lock);
+    }
+
+    virtual bool capture(HDC screen_dc, const RECT *rect, DWORD time)
+    {
+        if (!m_ok || m_failed)
+            return false;
+
+        // if the writer is behind (slow reader), skip this grab
+        Frame *frame = take_spare();
+        if (!frame) {
+            m_missed++;
+            return true;
+        }
+
+        if (!frame_grab(frame, screen_dc)) {
+            give_spare(frame);
+            return false;
+        }
+
+        StreamShot *shot = new StreamShot;
+        shot->sink = this;
+        shot->frame = frame;
+        shot->timestamp = stream_timestamp();
+        shot->missed = m_missed;
+        m_missed = 0;
+        pool_add(&m_writer, stream_write_task, shot);
+        return true;
+    }
+
+    virtual bool finish()
+    {
+        if (m_ok) {
+            pool_free(&m_writer);
+            if (!m_failed && !finish_stream())
+                m_failed = true;
+            stream_close(&m_stream);
+            m_ok = false;
+            return !m_failed;
+        }
+        return false;
+    }
+
+    // Writer thread: write a grabbed frame to the stream
+    void write(StreamShot *shot)
+    {
+        // once the reader has gone away, drop the rest
+        if (!m_failed) {
+            if (!write_frame(shot) || !stream_flush(&m_stream))
+                m_failed = true;
+        }
+        give_spare(shot->frame);
+    }
+
+protected:
+    virtual bool write_frame(StreamShot *shot)
+    {
+        return stream_write_frame(&m_stream, shot->frame, m_format, 
+                                  shot->timestamp);
+    }
+
+    // Write anything that follows the last frame
+    virtual bool finish_stream()
+    {
+        return true;
+    }
+
+
+    Frame *take_spare()
+    {
+        Frame *frame = NULL;
+        EnterCriticalSection(&m_lock);
+        if (!m_spare.empty()) {
+            frame = m_spare.back();
+            m_spare.pop_back();
+        }
+        LeaveCriticalSection(&m_lock);
+        return frame;
+    }
+
+    void give_spare(Frame *frame)
+    {
+        EnterCriticalSection(&m_lock);
+        m_spare.push_back(frame);
+        LeaveCriticalSection(&m_lock);
+    }
+
+    const char *m_format;
+    int m_missed;               // grabs skipped since the last frame
+    bool m_ok;
+    volatile bool m_failed;     // a write failed
+    StreamWriter m_stream;
+    ThreadPool m_writer;
+    std::vector<Frame*> m_spare;
+    CRITICAL_SECTION m_lock;    // protects m_spare
+};
+
+
+void stream_write_task(void *arg)
+{
+    StreamShot *shot = (StreamShot*) arg;
+    shot->sink->write(shot);
+    delete shot;
+}
+
+
+// Round a capture rectangle down to what I420 (and halving) allows
+void y4m_trim_rect(RECT *rect, bool half)
+{
+    int align = half ? 4 : 2;
+    rect->right -= (rect->right - rect->left) % align;
+    rect->bottom -= (rect->bottom - rect->top) % align;
+}
+
+
+// Stream frames as YUV4MPEG2 (I420, BT.709) video, for video encoders
+class Y4mSink : public StreamSink
+{
+public:
+    Y4mSink(const char *filename, const RECT *rect, int interval, 
+            bool half) :
+        StreamSink(filename, "raw", rect),
+        m_half(half),
+        m_have_frame(false)
+    {
+        m_width = rect->right - rect->left;
+        m_height = rect->bottom - rect->top;
+        if (half) {
+            m_width /= 2;
+            m_height /= 2;
+        }
+        m_halved = half ? (unsigned char*) malloc(m_width * 4 * m_height)
+            : NULL;
+        m_yuv_size = m_width * m_height * 3 / 2;
+        m_yuv = (unsigned char*) malloc(m_yuv_size);
+
+        if (m_ok) {
+            char header[256];
+            int len = snprintf(header, sizeof(header),
+                               "YUV4MPEG2 W%d H%d F1000:%d Ip A1:1 C420jpeg "
+                               "XCOLORRANGE=LIMITED\n", 
+                               m_width, m_height, interval);
+            if (!stream_write(&m_stream, header, len))
+                m_failed = true;
+        }
+    }
+
+    virtual ~Y4mSink()
+    {
+        free(m_halved);
+        free(m_yuv);
+    }
+
+protected:
+    virtual bool write_frame(StreamShot *shot)
+    {
+        // keep the frame rate constant by repeating the previous frame
+        // for grabs that were skipped
+        for (int i=0; m_have_frame && i<shot->missed; i++)
+            if (!write_yuv())
+                return false;
+
+        Frame *frame = shot->frame;
+        if (m_half) {
+            yuv_half(frame->pixels, frame->width, frame->height, 
+                     frame->stride, m_halved, m_width * 4);
+            yuv_convert(m_halved, m_width, m_height, m_width * 4, m_yuv);
+        } else {
+            yuv_convert(frame->pixels, m_width, m_height, frame->stride, 
+                        m_yuv);
+        }
+        m_have_frame = true;
+        return write_yuv();
+    }
+
+    bool write_yuv()
+    {
+        return stream_write(&m_stream, "FRAME\n", 6) &&
+            stream_write(&m_stream, m_yuv, m_yuv_size);
+    }
+
+    bool m_half;
+    bool m_have_frame;
+    int m_width, m_height;      // of the video
+    unsigned char *m_halved;    // BGRX frame after halving
+    unsigned char *m_yuv;       // I420 frame
+    int m_yuv_size;
+};
+
+
+// Write all frames into one animated GIF or PNG
+class AnimSink : public StreamSink
+{
+public:
+    AnimSink(const char *filename, const RECT *rect, int interval) :
+        StreamSink(filename, "raw", rect),
+        m_interval(interval),
+        m_last_time(0)
+    {
+        m_anim.prev = NULL;
+        if (m_ok && !anim_open(&m_anim, &m_stream, anim_format(filename),
+                               rect->right - rect->left, 
+                               rect->bottom - rect->top))
+            m_failed = true;
+    }
+
+    virtual ~AnimSink()
+    {
+        // left over if a write failed and anim_close() was skipped
+        free(m_anim.prev);
+    }
+
+protected:
+    virtual bool write_frame(StreamShot *shot)
+    {
+        int elapsed = m_last_time ? 
+            (int) ((shot->timestamp - m_last_time) / 1000) : 0;
+        m_last_time = shot->timestamp;
+        Frame *frame = shot->frame;
+        return anim_add(&m_anim, frame->pixels, frame->stride, elapsed);
+    }
+
+    virtual bool finish_stream()
+    {
+        return anim_close(&m_anim, m_interval);
+    }
+
+    AnimWriter m_anim;
+    int m_interval;
+    unsigned long long m_last_time;     // timestamp of the last frame
+};
+
+
+// Write a single frame to a stream
+bool stream_single_frame(const char *filename, const char *format, 
+                         Frame *frame)
+{
+    StreamWriter stream;
+    if (!stream_open(&stream, filename))
+        return false;
+    bool ret = stream_write_frame(&stream, frame, format, 
+                                  stream_timestamp()) &&
+        stream_flush(&stream);
+    stream_close(&stream);
+    return ret;
+}
+
+
+//=============================================================================
+// Publish frames in a shared-memory ring for other processes
+
+// Grab straight into the ring's slots; readers never block the grabs
+class ShmSink : public FrameSink
+{
+public:
+    ShmSink(const char *name, int nslots, const RECT *rect)
+    {
+        m_ok = shm_create(&m_ring, name, nslots, rect->left, rect->top,
+                          rect->right, rect->bottom);
+        if (m_ok)
+            printf("publishing %dx%d frames to shared memory '%s'\n",
+                   (int) (rect->right - rect->left), 
+                   (int) (rect->bottom - rect->top), name);
+    }
+
+    virtual bool capture(HDC screen_dc, const RECT *rect, DWORD time)
+    {
+        if (!m_ok)
+            return false;
+        return shm_publish(&m_ring, screen_dc, stream_timestamp());
+    }
+
+    virtual bool finish()
+    {
+        if (m_ok)
+            shm_free(&m_ring);
+        return m_ok;
+    }
+
+protected:
+    bool m_ok;
+    ShmRing m_ring;
+};
+
+
+//=============================================================================
+// Instant replay: keep the last few seconds compressed in memory and save
+// them only when asked (Ctrl+PrintScreen, the dump event, or Ctrl+C)
+
+// how often to store a key frame (milliseconds)
+const int g_replay_key_interval = 2000;
+
+// number of grabbed frames that may wait for the compressor
+const int g_replay_spare_frames = 3;
+
+// number of decoded frames that may wait for the encoders when dumping
+const int g_replay_dump_batch = 16;
+
+
+class ReplaySink;
+
+struct ReplayShot
+{
+    ReplaySink *sink;
+    Frame *frame;
+    bool key;
+    DWORD time;
+};
+
+void replay_compress_task(void *arg);
+
+
+class ReplaySink : public FrameSink
+{
+public:
+    ReplaySink(const char *filename, const RECT *rect, int interval,
+               int seconds, int megabytes) :
+        m_filename(filename),
+        m_count(0),
+        m_frames(0),
+        m_failed(false)
+    {
+        m_width = rect->right - rect->left;
+        m_height = rect->bottom - rect->top;
+        m_key_every = std::max(1, g_replay_key_interval / std::max(1, interval));
+        InitializeCriticalSection(&m_lock);
+        replay_codec_init(&m_codec, m_width, m_height);
+        replay_ring_init(&m_ring, seconds * 1000, 
+                         (size_t) megabytes * 1024 * 1024);
+
+        m_ok = pool_init(&m_compressor, 1);
+        for (int i=0; m_ok && i<g_replay_spare_frames; i++) {
+            Frame *frame = new Frame;
+            m_ok = frame_create(frame, rect->left, rect->top, 
+                                m_width, m_height);
+            if (m_ok)
+                m_spare.push_back(frame);
+            else
+                delete frame;
+        }
+    }
+
+    virtual ~ReplaySink()
+    {
+        for (unsigned int i=0; i<m_spare.size(); i++) {
+            frame_free(m_spare[i]);
+            delete m_spare[i];
+        }
+        replay_ring_free(&m_ring);
+        replay_codec_free(&m_codec);
+        DeleteCriticalSection(&m_lock);
+    }
+
+    virtual bool capture(HDC screen_dc, const RECT *rect, DWORD time)
+    {
+        if (!m_ok)
+            return false;
+
+        // if the compressor is behind, skip this grab
+        Frame *frame = take_spare();
+        if (!frame)
+            return true;
+        
+        if (!frame_grab(frame, screen_dc)) {
+            give_spare(frame);
+            return false;
+        }
+
+        ReplayShot *shot = new ReplayShot;
+        shot->sink = this;
+        shot->frame = frame;
+        shot->key = (m_frames++ % m_key_every) == 0;
+        shot->time = time;
+        pool_add(&m_compressor, replay_compress_task, shot);
+        return true;
+    }
+
+    // Save everything in the ring and empty it, so that the next dump
+    // only saves newer frames
+    virtual void dump()
+    {
+        if (!m_ok)
+            return;
+        pool_wait(&m_compressor);
+
+        EnterCriticalSection(&m_ring.lock);
+        printf("replay: saving %d frames (%d KB compressed)\n", 
+               (int) m_ring.frames.size(), (int) (m_ring.bytes / 1024));
+
+        ReplayCodec decoder;
+        replay_codec_init(&decoder, m_width, m_height);
+        ThreadPool encoders;
+        png_startup();
+        if (pool_init(&encoders, 0)) {
+            for (unsigned int i=0; i<m_ring.frames.size(); i++) {
+                FileShot *shot = new FileShot;
+                if (!frame_create(&shot->frame, 0, 0, m_width, m_height) ||
+                    !replay_decode(&decoder, &m_ring.frames[i], 
+                                   &shot->frame)) {
+                    frame_free(&shot->frame);
+                    delete shot;
+                    break;
+                }
+                numbered_filename(shot->filename, MAX_PATH, m_filename, 
+                                  ++m_count);
+                shot->index = NULL;
+                shot->thumbs = NULL;
+                shot->failed = &m_failed;
+                shot->pending = NULL;
+                pool_add(&encoders, file_save_task, shot);
+
+                // bound the memory held by decoded frames
+                if ((i+1) % g_replay_dump_batch == 0)
+                    pool_wait(&encoders);
+            }
+            pool_free(&encoders);
+        }
+        png_shutdown();
+        replay_codec_free(&decoder);
+
+        // start over with a key frame; m_count keeps the file numbers going
+        replay_ring_clear(&m_ring);
+        m_frames = 0;
+        LeaveCriticalSection(&m_ring.lock);
+    }
+
+    virtual bool finish()
+    {
+        if (m_ok) {
+            dump();
+            pool_free(&m_compressor);
+        }
+        return m_ok && !m_failed;
+    }
+
+    // Compressor thread: add a grabbed frame to the ring
+    void compress(ReplayShot *shot)
+    {
+        ReplayFrame out;
+        replay_encode(&m_codec, shot->frame, shot->key, &out);
+        out.time = shot->time;
+        give_spare(shot->frame);
+        replay_ring_push(&m_ring, &out);
+    }
+
+protected:
+    Frame *take_spare()
+    {
+        Frame *frame = NULL;
+        EnterCriticalSection(&m_lock);
+        if (!m_spare.empty()) {
+            frame = m_spare.back();
+            m_spare.pop_back();
+        }
+        LeaveCriticalSection(&m_lock);
+        return frame;
+    }
+
+    void give_spare(Frame *frame)
+    {
+        EnterCriticalSection(&m_lock);
+        m_spare.push_back(frame);
+        LeaveCriticalSection(&m_lock);
+    }
+
+    const char *m_filename;
+    int m_count;                // frames saved so far
+    int m_width, m_height;
+    int m_frames;               // frames grabbed since the last dump
+    int m_key_every;
+    bool m_ok;
+    volatile bool m_failed;     // a dumped frame could not be saved
+
+    ReplayCodec m_codec;
+    ReplayRing m_ring;
+    ThreadPool m_compressor;
+    std::vector<Frame*> m_spare;
+    CRITICAL_SECTION m_lock;    // protects m_spare
+};
+
+
+void replay_compress_task(void *arg)
+{
+    ReplayShot *shot = (ReplayShot*) arg;
+    shot->sink->compress(shot);
+    delete shot;
+}
+
+//=============================================================================
+// Compare the screen with a reference image
+
+// exit status when the screen does not match
+const int g_exit_differ = 2;
+
+// exit status when a wait gives up
+const int g_exit_timeout = 3;
+
+
+// Compare a capture with the image 'ref_file', leaving out the pixels
+// 'ignore' (may be NULL) masks.  Returns the exit status: 0 if at most
+// 'max_count' pixels differ by more than 'tol', g_exit_differ if more do,
+// 1 on errors.  If 'ssim_scales' is 1 (SSIM) or more (MS-SSIM), the
+// images match if their similarity is at least 'ssim_min' instead, and
+// the diff mask is a heatmap of the SSIM.
+int compare_screen(const char *ref_file, const Frame *shot, int tol,
+                   long long max_count, const Frame *ignore,
+                   const char *mask_file, int ssim_scales, double ssim_min)
+{
+    Frame ref;
+    if (!load_image_file(ref_file, &ref))
+        return 1;
+
+    if (ref.width != shot->width || ref.height != shot->height) {
+        printf("compare: reference is %dx%d but the capture is %dx%d\n",
+               ref.width, ref.height, shot->width, shot->height);
+        frame_free(&ref);
+        return g_exit_differ;
+    }
+
+    Frame mask;
+    bool use_mask = mask_file && frame_create(&mask, shot->x, shot->y,
+                                              shot->width, shot->height);
+    int ret = 0;
+    if (ssim_scales > 0) {
+        double score;
+        if (ssim_frames(&ref, shot, ignore, ssim_scales,
+                        use_mask ? &mask : NULL, &score, true)) {
+            printf("compare: %s %.5f (at least %.5f needed)\n", 
+                   ssim_scales > 1 ? "MS-SSIM" : "SSIM", score, ssim_min);
+            ret = score < ssim_min ? g_exit_differ : 0;
+        } else {
+            ret = 1;
+        }
+    } else {
+        CompareResult result;
+        compare_frames(&ref, shot, tol, max_count, ignore,
+                       use_mask ? &mask : NULL, &result);
+
+        if (result.finished)
+            printf("compare: %lld of %lld pixels differ (largest difference "
+                   "%d)\n", result.differ, ignore ? mask_count(ignore) :
+                   (long long) shot->width * shot->height, result.max_diff);
+        else
+            printf("compare: more than %lld pixels differ\n", max_count);
+        if (use_mask)
+            compare_mask_image(&mask, shot, ignore);
+        ret = result.differ > max_count ? g_exit_differ : 0;
+    }
+
+    if (use_mask && ret != 1) {
+        if (save_frame(&mask, mask_file))
+            printf("diff mask saved to file: %s\n", mask_file);
+        else
+            printf("error: cannot save diff mask '%s'\n", mask_file);
+    }
+    if (use_mask)
+        frame_free(&mask);
+
+    frame_free(&ref);
+    return ret;
+}
+
+
+// Save a frame to 'filename', or stream it to stdout if it is '-'
+bool output_frame(Frame *frame, const char *filename, const char *format)
+{
+    if (strcmp(filename, "-") == 0)
+        return stream_single_frame(filename, format, frame);
+
+    if (!save_frame(frame, filename))
+        return false;
+    printf("screenshot saved to file: %s\n", filename);
+    return true;
+}
+
+
+// Capture (x,y)-(x2,y2), after waiting for it to settle or change if
+// 'wait_mode' is given (>= 0), then compare it with 'ref_file' and/or
+// save it to 'filename' (either may be NULL).  Returns the exit status.
+int capture_checked(int x, int y, int x2, int y2, int wait_mode,
+                    int stable_count, int poll, int timeout,
+                    const std::vector<RECT> &ignore_rects,
+                    const char *ignore_image, const char *ref_file, int tol,
+                    long long max_count, const char *mask_file,
+                    int ssim_scales, double ssim_min,
+                    const char *filename, const char *format)
+{
+    Frame ignore;
+    bool use_ignore = !ignore_rects.empty() || ignore_image;
+    if (use_ignore && !mask_create(&ignore, x, y, x2, y2, ignore_rects,
+                                   ignore_image))
+        return 1;
+
+    Frame shot;
+    int ret = 0;
+    if (wait_mode >= 0) {
+        int status = wait_screen(wait_mode, stable_count, x, y, x2, y2,
+                                 poll, timeout, use_ignore ? &ignore : NULL,
+                                 NULL, &shot);
+        if (status == WAIT_ERROR) {
+            ret = 1;
+        } else if (status == WAIT_EXPIRED) {
+            printf("wait: gave up after %d ms\n", timeout);
+            ret = g_exit_timeout;
+        }
+    } else if (!frame_capture(&shot, x, y, x2, y2)) {
+        ret = 1;
+    }
+
+    if (ret != 1) {
+        if (filename && !output_frame(&shot, filename, format))
+            ret = 1;
+
+        if (ret == 0 && ref_file)
+            ret = compare_screen(ref_file, &shot, tol, max_count,
+                                 use_ignore ? &ignore : NULL, mask_file,
+                                 ssim_scales, ssim_min);
+        frame_free(&shot);
+    }
+
+    if (use_ignore)
+        frame_free(&ignore);
+    return ret;
+}
+
+
+//=============================================================================
+// Compare directories
+
+// Print a JSON string, escaping quotes and backslashes
+void print_json_string(const char *str)
+{
+    putchar('"');
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            putchar('\\');
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+
+void print_json_names(const char *key, const std::vector<std::string> &names)
+{
+    printf(" \"%s\": [", key);
+    for (unsigned int i=0; i<names.size(); i++) {
+        printf(i > 0 ? ", " : "");
+        print_json_string(names[i].c_str());
+    }
+    printf("],\n");
+}
+
+
+// Compare the PNG and BMP files of two directories pair by pair and
+// print a JSON summary.  Returns the exit status: g_exit_differ if a
+// pair failed or a file has no partner.
+int compare_directories(const BatchSettings *settings)
+{
+    const char *status_names[] = {"pass", "differ", "size", "error"};
+    BatchSummary summary;
+    if (!batch_compare(settings, &summary))
+        return 1;
+
+    printf("{\"base\": ");
+    print_json_string(settings->base_dir);
+    printf(", \"new\": ");
+    print_json_string(settings->new_dir);
+    printf(",\n \"pairs\": %d, \"passed\": %d, \"failed\": %d, "
+           "\"size_mismatch\": %d, \"errors\": %d, \"seconds\": %.3f,\n",
+           (int) summary.pairs.size(), summary.counts[BATCH_PASS],
+           summary.counts[BATCH_FAIL], summary.counts[BATCH_SIZE],
+           summary.counts[BATCH_ERROR], summary.seconds);
+    print_json_names("only_in_base", summary.only_base);
+    print_json_names("only_in_new", summary.only_new);
+
+    printf(" \"failures\": [");
+    int n = 0;
+    for (unsigned int i=0; i<summary.pairs.size(); i++) {
+        const BatchPair &pair = summary.pairs[i];
+        if (pair.status == BATCH_PASS)
+            continue;
+        printf(n++ > 0 ? ",\n   {\"name\": " : "\n   {\"name\": ");
+        print_json_string(pair.name.c_str());
+        printf(", \"status\": \"%s\"", status_names[pair.status]);
+        if (pair.status == BATCH_FAIL) {
+            if (settings->ssim_scales > 0)
+                printf(", \"%s\": %.5f",
+                       settings->ssim_scales > 1 ? "ms_ssim" : "ssim",
+                       pair.score);
+            else
+                printf(", \"differ\": %lld, \"max_diff\": %d",
+                       pair.differ, pair.max_diff);
+        }
+        if (pair.diff_saved) {
+            std::string path = std::string(settings->diff_dir) + "\\" +
+                pair.name;
+            printf(", \"diff\": ");
+            print_json_string(path.c_str());
+        }
+        printf("}");
+    }
+    printf("]}\n");
+
+    if (summary.counts[BATCH_ERROR] > 0)
+        return 1;
+    if (summary.counts[BATCH_FAIL] > 0 || summary.counts[BATCH_SIZE] > 0 ||
+        !summary.only_base.empty() || !summary.only_new.empty())
+        return g_exit_differ;
+    return 0;
+}
+
+
+//=============================================================================
+// Probe the colors of a few pixels
+
+// Print the colors of the points in 'xy' as 'X,Y RRGGBB' lines, or as a
+// JSON array if 'json' is set
+bool probe_screen(const std::vector<int> &xy, bool json)
+{
+    int n = xy.size() / 2;
+    ProbeSet probe;
+    std::vector<unsigned int> colors(n);
+    bool ret = probe_create(&probe, &xy[0], n) && 
+        probe_read(&probe, &colors[0]);
+    probe_free(&probe);
+    if (!ret)
+        return false;
+
+    if (json)
+        printf("[");
+    for (int i=0; i<n; i++) {
+        if (json)
+            printf("%s{\"x\": %d, \"y\": %d, \"color\": \"#%06x\"}", 
+                   i > 0 ? ",\n " : "", xy[2*i], xy[2*i+1], colors[i]);
+        else
+            printf("%d,%d %06x\n", xy[2*i], xy[2*i+1], colors[i]);
+    }
+    if (json)
+        printf("]\n");
+    return true;
+}
+
+
+//=============================================================================
+// Image statistics
+
+void print_stats_json(const ImageStats *stats, const Frame *frame)
+{
+    const char *names[3] = {"b", "g", "r"};
+
+    printf("{\"x\": %d, \"y\": %d, \"width\": %d, \"height\": %d,\n",
+           frame->x, frame->y, frame->width, frame->height);
+    printf(" \"pixels\": %lld,\n", stats->pixels);
+    printf(" \"mean\": {\"r\": %.3f, \"g\": %.3f, \"b\": %.3f},\n",
+           stats->mean[2], stats->mean[1], stats->mean[0]);
+    printf(" \"variance\": {\"r\": %.3f, \"g\": %.3f, \"b\": %.3f},\n",
+           stats->variance[2], stats->variance[1], stats->variance[0]);
+    printf(" \"distinct_colors\": %lld,\n", stats->distinct);
+
+    printf(" \"dominant\": [");
+    for (unsigned int i=0; i<stats->dominant.size(); i++) {
+        const StatsColor &c = stats->dominant[i];
+        printf("%s{\"color\": \"#%06x\", \"pixels\": %lld, "
+               "\"share\": %.4f}", i > 0 ? ",\n   " : "\n   ", c.color,
+               c.pixels, (double) c.pixels / stats->pixels);
+    }
+    printf("],\n");
+
+    printf(" \"histogram\": {");
+    for (int c=2; c>=0; c--) {
+        printf("%s\"%s\": [", c < 2 ? ",\n   " : "\n   ", names[c]);
+        for (int v=0; v<256; v++)
+            printf(v > 0 ? ", %lld" : "%lld", stats->hist[c][v]);
+        printf("]");
+    }
+    printf("}}\n");
+}
+
+
+// Capture (x,y)-(x2,y2) and print its statistics as JSON.  If 'filename'
+// is given, the capture is saved while the statistics are computed.
+bool stats_screen(int x, int y, int x2, int y2, const char *filename,
+                  const char *format)
+{
+    Frame shot;
+    if (!frame_capture(&shot, x, y, x2, y2))
+        return false;
+
+    StatsJob job;
+    ImageStats stats;
+    bool ret = stats_begin(&job, &shot);
+    if (filename && !output_frame(&shot, filename, format))
+        ret = false;
+    ret = stats_end(&job, &stats) && ret;
+    if (ret)
+        print_stats_json(&stats, &shot);
+
+    frame_free(&shot);
+    return ret;
+}
+
+
+//=============================================================================
+// Perceptual hashes of the screen
+
+// Capture (x,y)-(x2,y2) and, if 'print' is true, print its pHash and
+// dHash, leaving out the 'ignore_rects' and the black pixels of
+// 'ignore_image' (may be NULL).  If 'filename' is given, the capture is
+// saved there and added to 'index' (may be NULL).  If 'search' is
+// given, print the captures of that index within Hamming distance
+// 'distance' of the pHash as 'DIST PHASH NAME' lines, closest first.
+// Returns the exit status: g_exit_differ if the search found nothing.
+int phash_screen(bool print, int x, int y, int x2, int y2,
+                 const std::vector<RECT> &ignore_rects,
+                 const char *ignore_image, const char *filename, 
+                 const char *format, PhashIndex *index, const char *search,
+                 int distance)
+{
+    Frame ignore;
+    bool use_ignore = !ignore_rects.empty() || ignore_image;
+    if (use_ignore && !mask_create(&ignore, x, y, x2, y2, ignore_rects,
+                                   ignore_image))
+        return 1;
+
+    Frame shot;
+    if (!frame_capture(&shot, x, y, x2, y2)) {
+        if (use_ignore)
+            frame_free(&ignore);
+        return 1;
+    }
+
+    unsigned long long phash, dhash;
+    phash_frame(&shot, use_ignore ? &ignore : NULL, &phash, &dhash);
+    if (use_ignore)
+        frame_free(&ignore);
+    if (print)
+        printf("phash %016llx dhash %016llx\n", phash, dhash);
+
+    bool ok = true;
+    if (filename) {
+        ok = output_frame(&shot, filename, format);
+        if (ok && index)
+            ok = index_capture(index, phash, filename);
+    }
+    frame_free(&shot);
+    if (!ok)
+        return 1;
+    if (!search)
+        return 0;
+
+    PhashIndex found;
+    if (!phash_index_open(&found, search, false))
+        return 1;
+    std::vector<PhashHit> hits;
+    ok = phash_index_search(&found, phash, distance, &hits);
+    phash_index_close(&found);
+    if (!ok)
+        return 1;
+
+    for (unsigned int i=0; i<hits.size(); i++)
+        printf("%d %016llx %s\n", hits[i].distance, hits[i].hash, 
+               hits[i].name.c_str());
+    return hits.empty() ? g_exit_differ : 0;
+}
+
+
+//=============================================================================
+// Find a color on the screen
+
+// Capture (x,y)-(x2,y2) and print how many pixels are within 'tol' of
+// 'color' (0xRRGGBB) and the bounding boxes of the 'max_regions' largest
+// connected regions of them, as text or JSON.  Returns the exit status:
+// g_exit_differ if no pixel matches.
+int find_color_on_screen(unsigned int color, int tol, int max_regions,
+                         bool json, int x, int y, int x2, int y2)
+{
+    Frame shot;
+    if (!frame_capture(&shot, x, y, x2, y2))
+        return 1;
+
+    long long count;
+    std::vector<ColorRegion> regions;
+    bool ok = color_find(&shot, color, tol, &count, &regions);
+    frame_free(&shot);
+    if (!ok)
+        return 1;
+
+    int n = std::min((int) regions.size(), max_regions);
+    if (json) {
+        printf("{\"color\": \"#%06x\", \"tolerance\": %d, "
+               "\"pixels\": %lld, \"regions\": %d, \"largest\": [",
+               color, tol, count, (int) regions.size());
+        for (int i=0; i<n; i++) {
+            const ColorRegion &r = regions[i];
+            printf("%s{\"x1\": %d, \"y1\": %d, \"x2\": %d, \"y2\": %d, "
+                   "\"pixels\": %lld}", i > 0 ? ",\n  " : "\n  ",
+                   r.x1, r.y1, r.x2, r.y2, r.pixels);
+        }
+        printf("]}\n");
+    } else {
+        printf("%lld pixels match #%06x in %d regions\n", count, color,
+               (int) regions.size());
+        for (int i=0; i<n; i++) {
+            const ColorRegion &r = regions[i];
+            printf("%d,%d,%d,%d %lld\n", r.x1, r.y1, r.x2, r.y2, r.pixels);
+        }
+    }
+    return count > 0 ? 0 : g_exit_differ;
+}
+
+
+//=============================================================================
+// Find images on the screen
+
+// Capture (x,y)-(x2,y2) and print where each template appears in it, as
+// 'TEMPLATE X1,Y1,X2,Y2 SCORE' lines, best first.  If 'filename' is
+// given, save the rectangle 'rel' (relative to the top-left corner of
+// the first template's best match; the match itself if NULL).  Returns
+// the exit status: g_exit_differ if a template was not found.
+int find_on_screen(const std::vector<const char*> &files, double threshold,
+                   int x, int y, int x2, int y2, const int *rel,
+                   const char *filename, const char *format)
+{
+    std::vector<FindTemplate> templates(files.size());
+    int loaded = 0;
+    bool ok = true;
+    for (unsigned int i=0; i<files.size() && ok; i++) {
+        ok = find_load_template(&templates[i], files[i]);
+        loaded++;
+    }
+
+    Frame shot;
+    ok = ok && frame_capture(&shot, x, y, x2, y2);
+    if (!ok) {
+        for (int i=0; i<loaded; i++)
+            find_free_template(&templates[i]);
+        return 1;
+    }
+
+    int ret = 0;
+    if (!find_templates(&shot, &templates[0], templates.size(), threshold))
+        ret = 1;
+
+    for (unsigned int i=0; ret != 1 && i<templates.size(); i++) {
+        FindTemplate *t = &templates[i];
+        if (t->matches.empty()) {
+            printf("%s not found\n", t->filename);
+            ret = g_exit_differ;
+        }
+        for (unsigned int j=0; j<t->matches.size(); j++) {
+            const FindMatch &m = t->matches[j];
+            printf("%s %d,%d,%d,%d %.3f\n", t->filename, m.x, m.y,
+                   m.x + t->width, m.y + t->height, m.score);
+        }
+    }
+
+    // save relative to the first template
+    if (ret != 1 && filename && !templates[0].matches.empty()) {
+        const FindMatch &m = templates[0].matches[0];
+        int r[4] = {0, 0, templates[0].width, templates[0].height};
+        if (rel)
+            memcpy(r, rel, sizeof(r));
+
+        Frame crop;
+        if (!frame_crop(&shot, &crop, m.x + r[0], m.y + r[1], 
+                        m.x + r[2], m.y + r[3])) {
+            ret = 1;
+        } else {
+            if (!output_frame(&crop, filename, format))
+                ret = 1;
+            frame_free(&crop);
+        }
+    }
+
+    frame_free(&shot);
+    for (unsigned int i=0; i<templates.size(); i++)
+        find_free_template(&templates[i]);
+    return ret;
+}
+
+
+//=============================================================================
+// Scroll and stitch a long page
+
+// scroll steps when no --count is given
+const int g_scroll_max_steps = 1000;
+
+// how long a scroll may take to settle when no --timeout is given (ms)
+const int g_scroll_settle = 2000;
+
+
+// Capture (x,y)-(x2,y2), then scroll it down 'notches' wheel notches at a
+// time (at most 'max_steps' times) and stitch the frames into the PNG
+// 'filename' until the page stops moving.  After each scroll the region
+// is polled every 'poll' milliseconds, first for up to 'timeout' until it
+// starts to move (smooth scrolling may not have begun when the wheel
+// message returns), then for up to 'timeout' again until it settles.
+bool scroll_screen(int x, int y, int x2, int y2, int notches, int max_steps,
+                   int poll, int timeout, const char *filename)
+{
+    Frame frames[2];
+    if (!frame_capture(&frames[0], x, y, x2, y2))
+        return false;
+    ScrollStitch stitch;
+    if (!scroll_begin(&stitch, filename, &frames[0])) {
+        frame_free(&frames[0]);
+        return false;
+    }
+
+    POINT cursor;
+    GetCursorPos(&cursor);
+    int cur = 0, steps = 0, status = SCROLL_MOVED;
+    while (status == SCROLL_MOVED && steps < max_steps) {
+        if (!scroll_wheel((x + x2) / 2, (y + y2) / 2, notches)) {
+            status = SCROLL_ERROR;
+            break;
+        }
+
+        // a page that never starts to move has reached its end: its last
+        // poll is the next frame
+        int wait = wait_screen(WAIT_CHANGE, 0, x, y, x2, y2, poll, timeout,
+                               NULL, &frames[cur], &frames[1 - cur]);
+        if (wait == WAIT_DONE) {
+            frame_free(&frames[1 - cur]);
+            wait = wait_screen(WAIT_STABLE, 2, x, y, x2, y2, poll, timeout,
+                               NULL, NULL, &frames[1 - cur]);
+        }
+        if (wait == WAIT_ERROR) {
+            status = SCROLL_ERROR;
+            break;
+        }
+        status = scroll_next(&stitch, &frames[cur], &frames[1 - cur]);
+
+        // unless it moved, the last frame taken stays the latest
+        int done = status == SCROLL_MOVED ? cur : 1 - cur;
+        frame_free(&frames[done]);
+        if (status == SCROLL_MOVED) {
+            cur = 1 - cur;
+            steps++;
+        }
+    }
+    SetCursorPos(cursor.x, cursor.y);
+
+    if (status == SCROLL_LOST)
+        printf("scroll: lost track of the page after %d steps; scroll "
+               "fewer notches at a time\n", steps);
+    int height = scroll_end(&stitch, &frames[cur]);
+    frame_free(&frames[cur]);
+    if (height < 0 || status == SCROLL_ERROR)
+        return false;
+    printf("scroll: %d steps, %dx%d saved to '%s'\n", steps, x2 - x, height,
+           filename);
+    return true;
+}
+
+
+//=============================================================================
+
+// Display usage information
+void usage()
+{
+    printf(g_usage);
+}
+
+// Display version information
+void version()
+{
+    printf(g_version, BOX_VERSION);
+}
+
+
+// Pump the message queue for this process.
+int main_loop(BoxCutterWindow* win)
+{
+    int ret;
+    MSG msg; // message structure
+    while ((ret = GetMessage(&msg, 0, 0, 0)) != 0 && win->active())
+    {
+        if (ret == -1) {
+            // error occurred
+            break;
+        }
+        
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+
+    return msg.wParam;
+}
+
+// Setup the console for output (e.g. using printf)
+//
+// If 'stream_stdout' is true, stdout carries binary frames: it is left
+// untouched and messages are sent to stderr instead.
+bool setup_console(bool stream_stdout)
+{
+    int hConHandle;
+    long lStdHandle;
+    CONSOLE_SCREEN_BUFFER_INFO coninfo;
+	FILE *fp;
+
+    // create a console
+    if (!AttachConsole(ATTACH_PARENT_PROCESS)) {
+        // if no parent console then give up        
+        if (stream_stdout)
+            *stdout = *stderr;
+        return false;
+    }
+    
+    
+	const unsigned int MAX_CONSOLE_LINES = 500;
+	// set the screen buffer to be big enough to let us scroll text
+	GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE),	&coninfo);
+	coninfo.dwSize.Y = MAX_CONSOLE_LINES;
+	SetConsoleScreenBufferSize(GetStdHandle(STD_OUTPUT_HANDLE),	coninfo.dwSize);
+
+    
+	// redirect unbuffered STDOUT to the console, unless it is a stream 
+	if (!stream_stdout) {
+        lStdHandle = (long)GetStdHandle(STD_OUTPUT_HANDLE);    
+        hConHandle = _open_osfhandle(lStdHandle, _O_TEXT);
+        fp = _fdopen(hConHandle, "w");    
+        if (!fp) {
+            // could not open stdout
+            return false;
+        }
+        *stdout = *fp;
+        setvbuf(stdout, NULL, _IONBF, 0);
+    }
+    
+    
+	// redirect unbuffered STDIN to the console
+	lStdHandle = (long)GetStdHandle(STD_INPUT_HANDLE);
+	hConHandle = _open_osfhandle(lStdHandle, _O_TEXT);
+	fp = _fdopen(hConHandle, "r");
+    if (!fp) {
+        // could not open stdin
+        return false;
+    }
+	*stdin = *fp;
+	setvbuf(stdin, NULL, _IONBF, 0);
+
+    
+	// redirect unbuffered STDERR to the console
+	lStdHandle = (long)GetStdHandle(STD_ERROR_HANDLE);
+	hConHandle = _open_osfhandle(lStdHandle, _O_TEXT);
+	fp = _fdopen(hConHandle, "w");
+    if (!fp) {
+        // could not open stderr
+        return false;
+    }
+	*stderr = *fp;
+	setvbuf(stderr, NULL, _IONBF, 0);
+    if (stream_stdout)
+        *stdout = *stderr;
+
+	// make cout, wcout, cin, wcin, wcerr, cerr, wclog and clog
+	// point to console as well
+	std::ios::sync_with_stdio();
+
+    return true;
+}
+
+
+
+//=============================================================================
+// main function
+
+
+int main(int argc, char **argv)
+{
+    HINSTANCE hInstance = (HINSTANCE)GetModuleHandle(NULL);
+
+    InitCommonControls();
+
+    // stdout must stay binary if frames are streamed to it
+    bool stream_stdout = false;
+    for (int j=1; j<argc; j++)
+        if (strcmp(argv[j], "-") == 0 || strcmp(argv[j], "--stdout") == 0)
+            stream_stdout = true;
+    setup_console(stream_stdout);
+    
+    // default screenshot filename
+    char *filename = NULL;
+
+    // coordinates
+    bool use_coords = false;
+    int x1, y1, x2, y2;
+
+    // select several boxes
+    bool multi = false;
+
+    // snap boxes to windows
+    bool snap = false;
+
+    // windows to capture by title or handle
+    const char *window_spec = NULL;
+
+    // wait in the tray for hotkeys
+    bool resident = false;
+
+    // interval capture
+    int interval = 0;
+    int count = 0;
+    int replay_seconds = 0;
+    int replay_megabytes = 512;
+
+    // frame format on stdout
+    const char *stream_format = "raw";
+
+    // animated output
+    bool anim = false;
+
+    // video output
+    bool y4m = false;
+    bool half = false;
+
+    // scrolling capture
+    int scroll_notches = 0;
+
+    // comparison with a reference image
+    const char *compare_ref = NULL;
+    int tolerance = 0;
+    long long max_diff = 0;
+    const char *mask_file = NULL;
+    int ssim_scales = 0;
+    double ssim_min = 0.0;
+
+    // comparison of two directories
+    const char *compare_base = NULL;
+    const char *compare_new = NULL;
+    const char *diff_dir = NULL;
+
+    // waiting for the screen to settle or change
+    int wait_mode = -1;
+    int stable_count = 0;
+    int poll = 50;
+    int timeout = 0;
+
+    // regions to leave out of comparisons
+    std::vector<RECT> ignore_rects;
+    const char *ignore_image = NULL;
+
+    // pixels to probe
+    std::vector<int> probe_xy;
+    bool json = false;
+
+    // image statistics
+    bool stats = false;
+
+    // color to find on the screen
+    bool find_color = false;
+    unsigned int color = 0;
+    int color_tol = 0;
+    int max_regions = 20;
+
+    // thumbnails saved with each capture
+    std::vector<ThumbSize> thumbs;
+
+    // perceptual hashes and their index
+    bool phash = false;
+    const char *phash_index = NULL;
+    const char *phash_search = NULL;
+    int distance = 10;
+
+    // images to find on the screen
+    std::vector<const char*> find_files;
+    double threshold = 0.9;
+    int find_rect[4];
+    bool use_find_rect = false;
+
+    // shared-memory ring
+    const char *shm_name = NULL;
+    int shm_slots = 4;
+    
+    // parse command line
+    int i;
+
+    // parse options
+    for (i=1; i<argc; i++) {
+        if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)
+            // argument is not an option
+            break;
+
+        else if (strcmp(argv[i], "-f") == 0 ||
+                 strcmp(argv[i], "--fullscreen") == 0) 
+        {
+            RECT rect;
+            get_screen_rect(&rect);
             x1 = rect.left;
             y1 = rect.top;
             x2 = rect.right;
@@ -535,22 +2833,484 @@ int main(int argc, char **argv)
             use_coords = true;
         }
         
-        else if (strcmp(argv[i], "-c") == 0 ||
-                 strcmp(argv[i], "--coords") == 0) 
+        else if (strcmp(argv[i], "-c") == 0 ||
+                 strcmp(argv[i], "--coords") == 0) 
+        {
+            if (i+1 >= argc) {
+                printf("error: expected argument for -c,--coord\n");
+                usage();
+                return 1;
+            }
+            
+            if (sscanf(argv[++i], "%d,%d,%d,%d", &x1, &y1, &x2, &y2) != 4) {
+                printf("error: expected 4 comma separated integers\n");
+                usage();
+                return 1;
+            }
+            
+            use_coords = true;
+        }
+        
+        else if (strcmp(argv[i], "-m") == 0 ||
+                 strcmp(argv[i], "--multi") == 0) 
+        {
+            multi = true;
+        }
+        
+        else if (strcmp(argv[i], "-s") == 0 ||
+                 strcmp(argv[i], "--snap") == 0) 
+        {
+            snap = true;
+        }
+        
+        else if (strcmp(argv[i], "-w") == 0 ||
+                 strcmp(argv[i], "--window") == 0) 
+        {
+            if (i+1 >= argc) {
+                printf("error: expected argument for -w,--window\n");
+                usage();
+                return 1;
+            }
+            window_spec = argv[++i];
+        }
+        
+        else if (strcmp(argv[i], "-r") == 0 ||
+                 strcmp(argv[i], "--resident") == 0) 
+        {
+            resident = true;
+        }
+        
+        else if (strcmp(argv[i], "-i") == 0 ||
+                 strcmp(argv[i], "--interval") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d", &interval) != 1 ||
+                interval <= 0) {
+                printf("error: expected milliseconds for -i,--interval\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "-n") == 0 ||
+                 strcmp(argv[i], "--count") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d", &count) != 1) {
+                printf("error: expected integer for -n,--count\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--replay") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d", &replay_seconds) != 1 ||
+                replay_seconds <= 0) {
+                printf("error: expected seconds for --replay\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--replay-mem") == 0) 
+        {
+            if (i+1 >= argc || 
+                sscanf(argv[++i], "%d", &replay_megabytes) != 1 ||
+                replay_megabytes <= 0) {
+                printf("error: expected megabytes for --replay-mem\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--stdout") == 0) 
+        {
+            filename = (char*) "-";
+        }
+        
+        else if (strcmp(argv[i], "--format") == 0) 
+        {
+            if (i+1 >= argc) {
+                printf("error: expected argument for --format\n");
+                usage();
+                return 1;
+            }
+            stream_format = argv[++i];
+            if (strcmp(stream_format, "raw") != 0 &&
+                strcmp(stream_format, "png") != 0 &&
+                strcmp(stream_format, "bmp") != 0 &&
+                strcmp(stream_format, "qoi") != 0) {
+                printf("error: unknown format '%s'\n", stream_format);
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "-a") == 0 ||
+                 strcmp(argv[i], "--anim") == 0) 
+        {
+            anim = true;
+        }
+        
+        else if (strcmp(argv[i], "--y4m") == 0) 
+        {
+            y4m = true;
+        }
+        
+        else if (strcmp(argv[i], "--half") == 0) 
+        {
+            half = true;
+        }
+        
+        else if (strcmp(argv[i], "--scroll") == 0) 
+        {
+            if (i+1 >= argc || 
+                sscanf(argv[++i], "%d", &scroll_notches) != 1 ||
+                scroll_notches <= 0) {
+                printf("error: expected notches for --scroll\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--compare") == 0) 
+        {
+            if (i+1 >= argc) {
+                printf("error: expected image for --compare\n");
+                usage();
+                return 1;
+            }
+            compare_ref = argv[++i];
+        }
+        
+        else if (strcmp(argv[i], "--tolerance") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d", &tolerance) != 1 ||
+                tolerance < 0 || tolerance > 255) {
+                printf("error: expected 0-255 for --tolerance\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--max-diff") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%lld", &max_diff) != 1 ||
+                max_diff < 0) {
+                printf("error: expected pixel count for --max-diff\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--ssim") == 0 ||
+                 strcmp(argv[i], "--ms-ssim") == 0) 
+        {
+            const char *option = argv[i];
+            ssim_scales = strcmp(option, "--ssim") == 0 ? 1 : 
+                g_ssim_max_scales;
+            if (i+1 >= argc || sscanf(argv[++i], "%lf", &ssim_min) != 1 ||
+                ssim_min < 0.0 || ssim_min > 1.0) {
+                printf("error: expected 0 to 1 for %s\n", option);
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--compare-dirs") == 0) 
+        {
+            if (i+2 >= argc) {
+                printf("error: expected BASE and NEW directories for "
+                       "--compare-dirs\n");
+                usage();
+                return 1;
+            }
+            compare_base = argv[++i];
+            compare_new = argv[++i];
+        }
+        
+        else if (strcmp(argv[i], "--diff-dir") == 0) 
         {
             if (i+1 >= argc) {
-                printf("error: expected argument for -c,--coord\n");
+                printf("error: expected directory for --diff-dir\n");
                 usage();
                 return 1;
             }
-            
-            if (sscanf(argv[++i], "%d,%d,%d,%d", &x1, &y1, &x2, &y2) != 4) {
-                printf("error: expected 4 comma separated integers\n");
+            diff_dir = argv[++i];
+        }
+        
+        else if (strcmp(argv[i], "--diff-mask") == 0) 
+        {
+            if (i+1 >= argc) {
+                printf("error: expected filename for --diff-mask\n");
+                usage();
+                return 1;
+            }
+            mask_file = argv[++i];
+        }
+        
+        else if (strcmp(argv[i], "--probe") == 0) 
+        {
+            const char *p = i+1 < argc ? argv[++i] : "";
+            int count = 0;
+            while (*p) {
+                char *end;
+                probe_xy.push_back(strtol(p, &end, 10));
+                count++;
+                if (end == p || (*end && *end != ','))
+                    break;
+                p = *end ? end + 1 : end;
+            }
+            if (count == 0 || *p || count % 2 != 0 || p[-1] == ',') {
+                printf("error: expected X,Y[,X,Y...] for --probe\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--json") == 0) 
+        {
+            json = true;
+        }
+        
+        else if (strcmp(argv[i], "--stats") == 0) 
+        {
+            stats = true;
+        }
+        
+        else if (strcmp(argv[i], "--find-color") == 0) 
+        {
+            char extra;
+            const char *p = i+1 < argc ? color_parse(argv[++i], &color) :
+                NULL;
+            if (!p || (*p && (*p != ':' || 
+                              sscanf(p + 1, "%d%c", &color_tol, &extra) != 1))
+                || color_tol < 0 || color_tol > 255) {
+                printf("error: expected RRGGBB[:TOL] for --find-color\n");
+                usage();
+                return 1;
+            }
+            find_color = true;
+        }
+        
+        else if (strcmp(argv[i], "--max-regions") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d", &max_regions) != 1 ||
+                max_regions < 0) {
+                printf("error: expected count for --max-regions\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--phash") == 0) 
+        {
+            phash = true;
+        }
+        
+        else if (strcmp(argv[i], "--thumb") == 0) 
+        {
+            const char *p = i+1 < argc ? argv[++i] : "";
+            int count = 0;
+            while (*p) {
+                ThumbSize box;
+                int n = 0;
+                if (sscanf(p, "%dx%d%n", &box.width, &box.height, &n) != 2 ||
+                    box.width <= 0 || box.height <= 0 || 
+                    (p[n] && p[n] != ','))
+                    break;
+                thumbs.push_back(box);
+                count++;
+                p += p[n] ? n + 1 : n;
+            }
+            if (count == 0 || *p || p[-1] == ',') {
+                printf("error: expected WxH[,WxH...] for --thumb\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--phash-index") == 0) 
+        {
+            if (i+1 >= argc) {
+                printf("error: expected index file for --phash-index\n");
+                usage();
+                return 1;
+            }
+            phash_index = argv[++i];
+        }
+        
+        else if (strcmp(argv[i], "--phash-search") == 0) 
+        {
+            if (i+1 >= argc) {
+                printf("error: expected index file for --phash-search\n");
+                usage();
+                return 1;
+            }
+            phash_search = argv[++i];
+        }
+        
+        else if (strcmp(argv[i], "--distance") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d", &distance) != 1 ||
+                distance < 0 || distance > 64) {
+                printf("error: expected 0 to 64 for --distance\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--find") == 0) 
+        {
+            if (i+1 >= argc) {
+                printf("error: expected image for --find\n");
+                usage();
+                return 1;
+            }
+            find_files.push_back(argv[++i]);
+        }
+        
+        else if (strcmp(argv[i], "--threshold") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%lf", &threshold) != 1 ||
+                threshold < 0.0 || threshold > 1.0) {
+                printf("error: expected 0 to 1 for --threshold\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--find-rect") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d,%d,%d,%d", 
+                                      &find_rect[0], &find_rect[1], 
+                                      &find_rect[2], &find_rect[3]) != 4) {
+                printf("error: expected X1,Y1,X2,Y2 for --find-rect\n");
+                usage();
+                return 1;
+            }
+            normalize_coords(&find_rect[0], &find_rect[1], 
+                             &find_rect[2], &find_rect[3]);
+            use_find_rect = true;
+        }
+        
+        else if (strcmp(argv[i], "--wait-stable") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d", &stable_count) != 1 ||
+                stable_count < 1) {
+                printf("error: expected poll count for --wait-stable\n");
+                usage();
+                return 1;
+            }
+            wait_mode = WAIT_STABLE;
+        }
+        
+        else if (strcmp(argv[i], "--wait-change") == 0) 
+        {
+            wait_mode = WAIT_CHANGE;
+        }
+        
+        else if (strcmp(argv[i], "--poll") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d", &poll) != 1 ||
+                poll < 1) {
+                printf("error: expected milliseconds for --poll\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--timeout") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d", &timeout) != 1) {
+                printf("error: expected milliseconds for --timeout\n");
+                usage();
+                return 1;
+            }
+        }
+        
+        else if (strcmp(argv[i], "--ignore") == 0) 
+        {
+            RECT rect;
+            int ix1, iy1, ix2, iy2;
+            if (i+1 >= argc || sscanf(argv[++i], "%d,%d,%d,%d", 
+                                      &ix1, &iy1, &ix2, &iy2) != 4) {
+                printf("error: expected X1,Y1,X2,Y2 for --ignore\n");
+                usage();
+                return 1;
+            }
+            normalize_coords(&ix1, &iy1, &ix2, &iy2);
+            SetRect(&rect, ix1, iy1, ix2, iy2);
+            ignore_rects.push_back(rect);
+        }
+        
+        else if (strcmp(argv[i], "--redact") == 0) 
+        {
+            Redaction redaction;
+            const char *arg = i+1 < argc ? argv[++i] : "";
+            std::string rect(arg, redact_parse_spec(arg, &redaction));
+            int rx1, ry1, rx2, ry2;
+            char extra;
+            if (sscanf(rect.c_str(), "%d,%d,%d,%d%c", 
+                       &rx1, &ry1, &rx2, &ry2, &extra) != 4) {
+                printf("error: expected X1,Y1,X2,Y2[:EFFECT] for "
+                       "--redact\n");
+                usage();
+                return 1;
+            }
+            normalize_coords(&rx1, &ry1, &rx2, &ry2);
+            SetRect(&redaction.rect, rx1, ry1, rx2, ry2);
+            redaction.hwnd = NULL;
+            g_redactions.push_back(redaction);
+        }
+        
+        else if (strcmp(argv[i], "--redact-window") == 0) 
+        {
+            Redaction redaction;
+            const char *arg = i+1 < argc ? argv[++i] : "";
+            std::string spec(arg, redact_parse_spec(arg, &redaction));
+            if (spec.empty()) {
+                printf("error: expected SPEC[:EFFECT] for "
+                       "--redact-window\n");
+                usage();
+                return 1;
+            }
+            std::vector<WindowInfo> windows;
+            // minimized windows too, as they may be restored later
+            if (!find_windows(spec.c_str(), true, &windows))
+                return 1;
+            for (unsigned int j=0; j<windows.size(); j++) {
+                redaction.hwnd = windows[j].hwnd;
+                g_redactions.push_back(redaction);
+            }
+        }
+        
+        else if (strcmp(argv[i], "--ignore-mask") == 0) 
+        {
+            if (i+1 >= argc) {
+                printf("error: expected image for --ignore-mask\n");
+                usage();
+                return 1;
+            }
+            ignore_image = argv[++i];
+        }
+        
+        else if (strcmp(argv[i], "--shm") == 0) 
+        {
+            if (i+1 >= argc) {
+                printf("error: expected name for --shm\n");
+                usage();
+                return 1;
+            }
+            shm_name = argv[++i];
+        }
+        
+        else if (strcmp(argv[i], "--shm-slots") == 0) 
+        {
+            if (i+1 >= argc || sscanf(argv[++i], "%d", &shm_slots) != 1) {
+                printf("error: expected integer for --shm-slots\n");
                 usage();
                 return 1;
             }
-            
-            use_coords = true;
         }
         
         else if (strcmp(argv[i], "-v") == 0 ||
@@ -580,16 +3340,303 @@ int main(int argc, char **argv)
     if (i < argc)
         filename = argv[i];
 
+    // only plain and interval captures can be streamed
+    bool stream = filename && strcmp(filename, "-") == 0;
+    if (stream && (multi || window_spec || resident || replay_seconds > 0)) {
+        printf("error: output '-' cannot be used with --multi, --window, "
+               "--resident, or --replay\n");
+        usage();
+        return 1;
+    }
+
+    // only captures saved to files can be indexed
+    if (phash_index && 
+        (!filename || stream || multi || window_spec || resident || 
+         replay_seconds > 0 || shm_name || y4m || anim || 
+         (!phash && !phash_search && 
+          (stats || find_color || !find_files.empty() || compare_ref || 
+           wait_mode >= 0)))) {
+        printf("error: --phash-index needs an output filename and a plain, "
+               "--interval, or --phash capture\n");
+        usage();
+        return 1;
+    }
+
+    // only comparisons, waits and hashes of the screen can leave pixels
+    // out; anything else would silently ignore the mask
+    if ((!ignore_rects.empty() || ignore_image) && 
+        (compare_base || scroll_notches > 0 || !probe_xy.empty() || 
+         (!compare_ref && wait_mode < 0 && !phash && !phash_search))) {
+        printf("error: --ignore and --ignore-mask need --compare, --wait-*, "
+               "--phash, or --phash-search\n");
+        usage();
+        return 1;
+    }
+
+
+    // compare two directories of images, no capture needed
+    if (compare_base) {
+        BatchSettings settings;
+        settings.base_dir = compare_base;
+        settings.new_dir = compare_new;
+        settings.diff_dir = diff_dir;
+        settings.tol = tolerance;
+        settings.max_count = max_diff;
+        settings.ssim_scales = ssim_scales;
+        settings.ssim_min = ssim_min;
+        return compare_directories(&settings);
+    }
+
+    // only plain and interval captures saved to files get thumbnails
+    if (!thumbs.empty() && 
+        (!filename || stream || multi || window_spec || resident || 
+         replay_seconds > 0 || shm_name || y4m || anim || 
+         scroll_notches > 0 || compare_base || !probe_xy.empty() || phash || 
+         phash_search || stats || find_color || !find_files.empty() || 
+         compare_ref || wait_mode >= 0)) {
+        printf("error: --thumb needs an output filename and a plain or "
+               "--interval capture\n");
+        usage();
+        return 1;
+    }
+
+    // cover the redactions in every frame as it is grabbed; probes read
+    // the screen without frames, so they cannot be redacted
+    if (!g_redactions.empty()) {
+        if (!probe_xy.empty()) {
+            printf("error: --probe cannot be used with --redact\n");
+            usage();
+            return 1;
+        }
+        g_frame_prefilter = redact_before_grab;
+        g_frame_filter = redact_frame;
+    }
+
+    // scroll a long page and stitch it, no selection needed
+    if (scroll_notches > 0) {
+        int len = filename ? strlen(filename) : 0;
+        if (len < 5 || strcasecmp(filename + len - 4, ".png") != 0) {
+            printf("error: --scroll needs an output filename '*.png'\n");
+            usage();
+            return 1;
+        }
+        if (use_coords) {
+            normalize_coords(&x1, &y1, &x2, &y2);
+        } else {
+            RECT rect;
+            get_screen_rect(&rect);
+            x1 = rect.left;
+            y1 = rect.top;
+            x2 = rect.right;
+            y2 = rect.bottom;
+        }
+        return scroll_screen(x1, y1, x2, y2, scroll_notches,
+                             count > 0 ? count : g_scroll_max_steps, poll,
+                             timeout > 0 ? timeout : g_scroll_settle,
+                             filename) ? 0 : 1;
+    }
+
+    // read a few pixels, no selection needed
+    if (!probe_xy.empty())
+        return probe_screen(probe_xy, json) ? 0 : 1;
+
+    // compare with a reference image, wait for the screen, find images
+    // on it, or hash it, no selection needed
+    if (phash || phash_search || stats || find_color || 
+        !find_files.empty() || compare_ref || wait_mode >= 0) {
+        if (!find_files.empty() && (compare_ref || wait_mode >= 0)) {
+            printf("error: --find cannot be used with --compare or "
+                   "--wait-*\n");
+            usage();
+            return 1;
+        }
+        if (wait_mode >= 0 && !compare_ref && !filename) {
+            printf("error: --wait-stable and --wait-change need an output "
+                   "filename\n");
+            usage();
+            return 1;
+        }
+        if (use_coords) {
+            normalize_coords(&x1, &y1, &x2, &y2);
+        } else {
+            RECT rect;
+            get_screen_rect(&rect);
+            x1 = rect.left;
+            y1 = rect.top;
+            x2 = rect.right;
+            y2 = rect.bottom;
+        }
+        if (phash || phash_search) {
+            PhashIndex index;
+            if (phash_index && !phash_index_open(&index, phash_index, true))
+                return 1;
+            int ret = phash_screen(phash, x1, y1, x2, y2, ignore_rects,
+                                   ignore_image, filename, stream_format, 
+                                   phash_index ? &index : NULL,
+                                   phash_search, distance);
+            if (phash_index)
+                phash_index_close(&index);
+            return ret;
+        }
+        if (stats)
+            return stats_screen(x1, y1, x2, y2, filename, 
+                                stream_format) ? 0 : 1;
+        if (find_color)
+            return find_color_on_screen(color, color_tol, max_regions, json,
+                                        x1, y1, x2, y2);
+        if (!find_files.empty())
+            return find_on_screen(find_files, threshold, x1, y1, x2, y2,
+                                  use_find_rect ? find_rect : NULL,
+                                  filename, stream_format);
+        return capture_checked(x1, y1, x2, y2, wait_mode, stable_count, 
+                               poll, timeout, ignore_rects, ignore_image,
+                               compare_ref, tolerance, max_diff, mask_file,
+                               ssim_scales, ssim_min, filename, 
+                               stream_format);
+    }
+
+    // wait for hotkeys
+    if (resident) {
+        if (!filename) {
+            printf("error: --resident needs an output filename\n");
+            usage();
+            return 1;
+        }
+        ResidentWindow res(hInstance, filename);
+        if (use_coords)
+            res.set_coords(x1, y1, x2, y2);
+        if (!res.start())
+            return 1;
+        res.run();
+        res.stop();
+        return 0;
+    }
+
+    // an interval capture goes to a single sink
+    int sinks = (shm_name ? 1 : 0) + (y4m ? 1 : 0) + (anim ? 1 : 0) + 
+        (replay_seconds > 0 ? 1 : 0);
+    if (sinks > 1) {
+        printf("error: only one of --shm, --y4m, --anim, and --replay can "
+               "be used\n");
+        usage();
+        return 1;
+    }
+    if ((shm_name || y4m || anim) && interval <= 0) {
+        printf("error: --shm, --y4m, and --anim need --interval\n");
+        usage();
+        return 1;
+    }
+    if (anim && (!filename || anim_format(filename) < 0)) {
+        printf("error: --anim needs an output filename '*.gif' or "
+               "'*.png'\n");
+        usage();
+        return 1;
+    }
+
+    // capture repeatedly
+    if (interval > 0) {
+        if (!filename && !shm_name) {
+            printf("error: --interval needs an output filename\n");
+            usage();
+            return 1;
+        }
+
+        RECT rect;
+        if (use_coords) {
+            normalize_coords(&x1, &y1, &x2, &y2);
+            SetRect(&rect, x1, y1, x2, y2);
+        } else {
+            get_screen_rect(&rect);
+        }
+
+        PhashIndex index;
+        if (phash_index && !phash_index_open(&index, phash_index, true))
+            return 1;
+
+        FrameSink *sink;
+        if (shm_name) {
+            sink = new ShmSink(shm_name, shm_slots, &rect);
+        } else if (y4m) {
+            y4m_trim_rect(&rect, half);
+            sink = new Y4mSink(filename, &rect, interval, half);
+        } else if (anim) {
+            sink = new AnimSink(filename, &rect, interval);
+        } else if (stream) {
+            sink = new StreamSink(filename, stream_format, &rect);
+        } else if (replay_seconds > 0) {
+            sink = new ReplaySink(filename, &rect, interval, 
+                                  replay_seconds, replay_megabytes);
+        } else {
+            sink = new FileSink(filename, phash_index ? &index : NULL,
+                                thumbs);
+        }
+        
+        bool ret = run_interval(&rect, interval, count, sink);
+        delete sink;
+        if (phash_index)
+            phash_index_close(&index);
+        return ret ? 0 : 1;
+    }
 
+    // capture windows directly, no selection needed
+    if (window_spec) {
+        if (!filename) {
+            printf("error: --window needs an output filename\n");
+            usage();
+            return 1;
+        }
+        return capture_windows(window_spec, filename) ? 0 : 1;
+    }
 
     // create screenshot window
     BoxCutterWindow win(hInstance, "BoxCutter", filename);
+    win.set_snap(snap);
     
+    if (multi) {
+        if (use_coords || !filename) {
+            printf("error: --multi needs an output filename and no coords\n");
+            usage();
+            return 1;
+        }
 
-    if (use_coords) {
+        // select all boxes over one frozen frame
+        if (!win.freeze()) {
+            printf("error: cannot capture screen\n");
+            return 1;
+        }
+        win.set_multi(true);
         win.show();
+        win.maximize();
+        win.activate();
+        
+        main_loop(&win);
+        win.show(false);
+        if (!win.have_coords()) {
+            printf("error: no boxes selected\n");
+            return 1;
+        }
+
+        bool ret = save_selections(win.get_frame(), win.get_selections(), 
+                                   filename);
+        win.close();
+        return ret ? 0 : 1;
+    }
+
+    // capture the screenshot
+    Frame shot;
+    if (use_coords) {
+        normalize_coords(&x1, &y1, &x2, &y2);
+        if (!frame_capture(&shot, x1, y1, x2, y2)) {
+            MessageBox(win.get_handle(), "Cannot capture screenshot", 
+                       "Error", MB_OK);
+            return 1;
+        }
     } else {
-        // manually acquire coordinates
+        // manually acquire coordinates over a frozen copy of the screen
+        if (!win.freeze()) {
+            printf("error: cannot capture screen\n");
+            return 1;
+        }
         win.show();
         win.maximize();
         win.activate();
@@ -601,6 +3648,14 @@ int main(int argc, char **argv)
             printf("error: cannot retrieve screenshot coordinates\n");
             return 1;
         }
+
+        // crop the selection out of the frozen frame
+        normalize_coords(&x1, &y1, &x2, &y2);
+        win.show(false);
+        if (!frame_crop(win.get_frame(), &shot, x1, y1, x2, y2)) {
+            printf("error: empty screenshot selection\n");
+            return 1;
+        }
     }
 
     // display screenshot coords
@@ -608,9 +3663,19 @@ int main(int argc, char **argv)
 
 
     // save bitmap
-    if (filename) {
-        // save to file
-        if (!capture_screen(filename, x1, y1, x2, y2))
+    if (stream) {
+        // write to stdout
+        bool ret = stream_single_frame(filename, stream_format, &shot);
+        frame_free(&shot);
+        win.close();
+        return ret ? 0 : 1;
+    } else if (filename) {
+        // save to file, making the thumbnails meanwhile
+        ThumbJob thumb_job;
+        bool thumbs_ok = thumb_begin(&thumb_job, &shot, thumbs, filename);
+        bool saved = save_frame(&shot, filename);
+        thumbs_ok = thumb_end(&thumb_job) && thumbs_ok;
+        if (!saved)
         {
             MessageBox(win.get_handle(), "Cannot save screenshot", 
                        "Error", MB_OK);
@@ -618,9 +3683,20 @@ int main(int argc, char **argv)
         }
 
         printf("screenshot saved to file: %s\n", filename);
+        if (!thumbs_ok) {
+            frame_free(&shot);
+            win.close();
+            return 1;
+        }
+        if (phash_index && !index_capture_file(phash_index, &shot, filename))
+        {
+            frame_free(&shot);
+            win.close();
+            return 1;
+        }
     } else {
         // save to clipboard
-        if (!capture_screen_clipboard(win.get_handle(), x1, y1, x2, y2))
+        if (!save_frame_clipboard(win.get_handle(), &shot))
         {
             MessageBox(win.get_handle(), "Cannot save screenshot to clipboard", 
                        "Error", MB_OK);
@@ -630,8 +3706,8 @@ int main(int argc, char **argv)
         printf("screenshot saved to clipboard.\n");
     }
 
+    frame_free(&shot);
     win.close();
     
     return 0;
 }
-
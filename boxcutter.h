@@ -0,0 +1,130 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  libboxcutter: capture the screen from your own process.
+
+  Images are 32-bit BGRX pixels, top row first.  Functions returning int
+  return nonzero on success.
+
+=============================================================================*/
+
+#ifndef BOXCUTTER_H
+#define BOXCUTTER_H
+
+#if defined(BOXCUTTER_BUILD_DLL)
+#  define BC_API __declspec(dllexport)
+#elif defined(BOXCUTTER_USE_DLL)
+#  define BC_API __declspec(dllimport)
+#else
+#  define BC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* A captured image */
+typedef struct bc_image
+{
+    unsigned char *pixels;  /* BGRX pixels, top row first */
+    int width;
+    int height;
+    int stride;             /* bytes per row */
+    int x, y;               /* screen coordinates of pixel (0,0) */
+    void *priv;             /* owned by the library, NULL for caller buffers */
+} bc_image;
+
+
+/* Ensure x2 >= x and y2 >= y */
+BC_API void bc_normalize_coords(int *x, int *y, int *x2, int *y2);
+
+/* Get the rectangle covering all monitors */
+BC_API void bc_get_screen_rect(int *x, int *y, int *x2, int *y2);
+
+/* Capture the screen rectangle (x,y)-(x2,y2) into a library-owned image.
+   Release it with bc_image_free(). */
+BC_API int bc_capture(int x, int y, int x2, int y2, bc_image *image);
+
+/* Capture the screen rectangle (x,y)-(x2,y2) into a caller-owned buffer
+   of 'stride' bytes per row.  'image' (may be NULL) describes the result
+   and needs no bc_image_free(). */
+BC_API int bc_capture_into(int x, int y, int x2, int y2,
+                           void *buffer, int stride, bc_image *image);
+
+/* Release an image from bc_capture() */
+BC_API void bc_image_free(bc_image *image);
+
+/* Save an image as '*.png', '*.bmp', or '*.qoi' */
+BC_API int bc_save(const bc_image *image, const char *filename);
+
+/* Encode an image as "png", "bmp", or "qoi" into memory.  Release '*data' with
+   bc_free(). */
+BC_API int bc_encode(const bc_image *image, const char *format,
+                     void **data, int *size);
+
+/* Release memory returned by the library */
+BC_API void bc_free(void *data);
+
+/* Capture the screen rectangle (x,y)-(x2,y2) straight to a file */
+BC_API int bc_capture_file(const char *filename, int x, int y, int x2, int y2);
+
+/* Capture the screen rectangle (x,y)-(x2,y2) to an uncompressed bitmap
+   file, whatever the extension of 'filename'.  GDI+ is not used. */
+BC_API int bc_capture_file_bmp(const char *filename, 
+                               int x, int y, int x2, int y2);
+
+
+
+/* Shared-memory frame rings, as published by 'boxcutter --shm NAME'.
+   Frames are read in place: bc_shm_latest() points an image at the
+   newest frame, and bc_shm_check() afterwards tells whether the
+   publisher overwrote it while it was being read. */
+typedef struct bc_shm bc_shm;
+
+typedef struct bc_shm_ticket
+{
+    int slot;
+    long seq;
+} bc_shm_ticket;
+
+/* Map the ring 'name' for reading.  Returns NULL on failure. */
+BC_API bc_shm *bc_shm_open(const char *name);
+
+/* Point 'image' (read-only, needs no bc_image_free()) at the latest frame.
+   'timestamp' (may be NULL) is in microseconds since 1970. */
+BC_API int bc_shm_latest(bc_shm *shm, bc_image *image,
+                         unsigned long long *timestamp,
+                         bc_shm_ticket *ticket);
+
+/* Nonzero if the frame from bc_shm_latest() is still intact */
+BC_API int bc_shm_check(bc_shm *shm, const bc_shm_ticket *ticket);
+
+BC_API void bc_shm_close(bc_shm *shm);
+
+
+
+/* Pixel probes: read the colors of a fixed set of screen points.  The
+   points are grouped into small rectangles that are copied into a
+   bitmap kept with the probe, so each read costs a few BitBlt calls and
+   no full capture.  Probes read the screen directly: they bypass the
+   frame filter, so redactions do not apply to the colors they return. */
+typedef struct bc_probe bc_probe;
+
+/* Prepare to read the 'n' points (xy[2*i], xy[2*i+1]).  Returns NULL on
+   failure. */
+BC_API bc_probe *bc_probe_create(const int *xy, int n);
+
+/* Read the points' current colors as 0xRRGGBB into 'colors' */
+BC_API int bc_probe_read(bc_probe *probe, unsigned int *colors);
+
+BC_API void bc_probe_free(bc_probe *probe);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOXCUTTER_H */
@@ -0,0 +1,227 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Capturing: screen geometry, grabbing regions into frames, and saving
+  frames to files, memory, or the clipboard.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// windows includes
+#include <windows.h>
+
+
+// Using swaps, ensure that x2 >= x, y2 >= y for capturing a rectangle of the
+// screen.
+void normalize_coords(int *x, int *y, int *x2, int *y2)
+{
+    if (*x > *x2) {
+        int tmp = *x;
+        *x = *x2;
+        *x2 = tmp;
+    }
+    if (*y > *y2) {
+        int tmp = *y;
+        *y = *y2;
+        *y2 = tmp;
+    }
+}
+
+
+void get_screen_rect(RECT *rect)
+{
+    //GetWindowRect(GetDesktopWindow(), rect);
+    rect->left = GetSystemMetrics(SM_XVIRTUALSCREEN);
+    rect->top = GetSystemMetrics(SM_YVIRTUALSCREEN);
+    rect->right = GetSystemMetrics(SM_CXVIRTUALSCREEN) + rect->left;
+    rect->bottom = GetSystemMetrics(SM_CYVIRTUALSCREEN) + rect->top;
+}
+
+
+// Make the filename 'name_NUM.ext' from 'name.ext'
+void numbered_filename(char *out, int size, const char *filename, int num)
+{
+    const char *ext = strrchr(filename, '.');
+    const char *slash = strrchr(filename, '\\');
+    if (!slash)
+        slash = strrchr(filename, '/');
+    if (!ext || (slash && ext < slash))
+        ext = filename + strlen(filename);
+
+    snprintf(out, size, "%.*s_%d%s", (int) (ext - filename), filename, 
+             num, ext);
+}
+
+
+// Saves a captured bitmap to a file, choosing the format from the
+// file extension
+bool save_image_file(HBITMAP bitmap, HDC dc, const char *filename)
+{
+    int len = strlen(filename);
+    if (len > 4 && strcasecmp(filename + len - 4, ".png") == 0) {
+        return save_png_file(bitmap, dc, filename);
+    } else if (len > 4 && strcasecmp(filename + len - 4, ".bmp") == 0) {
+        return save_bitmap_file(bitmap, dc, filename);
+    } else {
+        printf("error: unknown output file format\n");
+        return false;
+    }
+}
+
+
+// Write a block of memory to a new file
+bool write_file(const char *filename, const unsigned char *data, int size)
+{
+    HANDLE hf = CreateFile(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hf == INVALID_HANDLE_VALUE) {
+        printf("error: cannot create file '%s'\n", filename);
+        return false;
+    }
+
+    DWORD written;
+    bool ret = WriteFile(hf, data, size, &written, NULL) && 
+        written == (DWORD) size;
+    if (!ret)
+        printf("error: cannot write file '%s'\n", filename);
+    CloseHandle(hf);
+    return ret;
+}
+
+
+// Saves a frame to a file
+bool save_frame(Frame *frame, const char *filename)
+{
+    // formats encoded straight from the pixels
+    int len = strlen(filename);
+    if (len > 4 && strcasecmp(filename + len - 4, ".qoi") == 0) {
+        unsigned char *data;
+        int size;
+        if (!encode_qoi_memory(frame->pixels, frame->width, frame->height,
+                               frame->stride, &data, &size))
+            return false;
+        bool ret = write_file(filename, data, size);
+        free(data);
+        return ret;
+    }
+
+    return save_image_file(frame->bitmap, frame->dc, filename);
+}
+
+
+// Encode a frame into memory as 'png', 'bmp', or 'qoi'.  '*data' is
+// allocated with malloc().
+bool encode_frame(Frame *frame, const char *format, 
+                  unsigned char **data, int *size)
+{
+    if (strcasecmp(format, "png") == 0) {
+        return encode_png_memory(frame->bitmap, data, size);
+    } else if (strcasecmp(format, "bmp") == 0) {
+        return encode_bitmap_memory(frame->pixels, frame->width, 
+                                    frame->height, frame->stride, 
+                                    data, size);
+    } else if (strcasecmp(format, "qoi") == 0) {
+        return encode_qoi_memory(frame->pixels, frame->width, 
+                                 frame->height, frame->stride, 
+                                 data, size);
+    } else {
+        printf("error: unknown output format '%s'\n", format);
+        return false;
+    }
+}
+
+
+// Saves a frame to the clipboard
+bool save_frame_clipboard(HWND hwnd, Frame *frame)
+{
+    // the clipboard takes ownership of a device-dependent copy
+    HDC screen_dc = GetDC(0);
+    HDC copy_dc = CreateCompatibleDC(screen_dc);
+    HBITMAP copy_bitmap = CreateCompatibleBitmap(screen_dc, 
+                                                 frame->width, frame->height);
+    HGDIOBJ old_obj = SelectObject(copy_dc, copy_bitmap);
+    BitBlt(copy_dc, 0, 0, frame->width, frame->height, 
+           frame->dc, 0, 0, SRCCOPY);
+    SelectObject(copy_dc, old_obj);
+    DeleteDC(copy_dc);
+    ReleaseDC(0, screen_dc);
+
+    // save bitmap to clipboard
+    bool ret = false;
+    if (OpenClipboard(hwnd)) {
+        if (EmptyClipboard()) {
+            if (SetClipboardData(CF_BITMAP, copy_bitmap))
+                ret = true;
+        }
+        CloseClipboard();
+    } else {
+        printf("error: could not open clipboard\n");
+    }
+
+    if (!ret)
+        DeleteObject(copy_bitmap);
+    return ret;
+}
+
+
+// Captures a screenshot from a region of the screen
+// saves it to a file
+bool capture_screen(const char *filename, int x, int y, int x2, int y2)
+{
+    // normalize coordinates
+    normalize_coords(&x, &y, &x2, &y2);
+
+    // copy screen to bitmap
+    Frame frame;
+    if (!frame_capture(&frame, x, y, x2, y2))
+        return false;
+    
+    // save bitmap to file
+    bool ret = save_frame(&frame, filename);
+    frame_free(&frame);
+    
+    return ret;
+}
+
+
+// Captures a screenshot from a region of the screen
+// saves it to a bitmap file, whatever the file extension
+bool capture_screen_bmp(const char *filename, int x, int y, int x2, int y2)
+{
+    normalize_coords(&x, &y, &x2, &y2);
+
+    Frame frame;
+    if (!frame_capture(&frame, x, y, x2, y2))
+        return false;
+
+    bool ret = save_bitmap_file(frame.bitmap, frame.dc, filename);
+    frame_free(&frame);
+
+    return ret;
+}
+
+
+// Captures a screenshot from a region of the screen
+// saves it to the clipboard
+bool capture_screen_clipboard(HWND hwnd, int x, int y, int x2, int y2)
+{
+    // normalize coordinates
+    normalize_coords(&x, &y, &x2, &y2);
+
+    // copy screen to bitmap
+    Frame frame;
+    if (!frame_capture(&frame, x, y, x2, y2))
+        return false;
+    
+    // save bitmap to clipboard
+    bool ret = save_frame_clipboard(hwnd, &frame);
+    frame_free(&frame);
+    
+    return ret;
+}
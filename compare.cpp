@@ -0,0 +1,212 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Frame comparison for visual regression tests: count the pixels where
+  any color channel differs by more than a tolerance, straight from the
+  captured pixels.  Rows are compared with AVX2 or SSE2, chosen at run
+  time, and the comparison stops as soon as too many pixels differ.
+  An ignore mask (mask.cpp) is blended into the differences inside the
+  kernels.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+
+struct CompareResult
+{
+    long long differ;       // pixels differing by more than the tolerance
+    int max_diff;           // largest channel difference seen
+    bool finished;          // false if the comparison stopped early
+};
+
+
+// Compare pixels [start, width) of two rows.  Returns the number of
+// pixels where a color channel differs by more than 'tol' and raises
+// '*max_diff' to the largest difference.  Pixels whose 'keep' word (may
+// be NULL) is zero are ignored.  If 'mask' is given, sets it to all ones
+// for differing pixels and zero for the rest.
+typedef int (*CompareRowFunc)(const unsigned char *a, const unsigned char *b,
+                              int start, int width, int tol,
+                              const unsigned int *keep, unsigned int *mask,
+                              int *max_diff);
+
+
+int compare_row_c(const unsigned char *a, const unsigned char *b,
+                  int start, int width, int tol, const unsigned int *keep,
+                  unsigned int *mask, int *max_diff)
+{
+    int count = 0;
+    int top = *max_diff;
+    for (int x=start; x<width; x++) {
+        unsigned int k = keep ? keep[x] : g_mask_keep;
+        int d = 0;
+        for (int c=0; c<3; c++) {
+            int e = abs(a[x*4+c] - b[x*4+c]) & (k >> (c*8));
+            if (e > d)
+                d = e;
+        }
+        if (d > top)
+            top = d;
+        count += d > tol;
+        if (mask)
+            mask[x] = d > tol ? 0xffffffff : 0;
+    }
+    *max_diff = top;
+    return count;
+}
+
+
+TARGET_SSE2
+int compare_row_sse2(const unsigned char *a, const unsigned char *b,
+                     int start, int width, int tol, const unsigned int *keep,
+                     unsigned int *mask, int *max_diff)
+{
+    // the fourth byte of each pixel is not part of the color
+    __m128i color = _mm_set1_epi32(g_mask_keep);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi32(-1);
+    const __m128i tolerance = _mm_set1_epi8((char) tol);
+    __m128i top = zero;
+    int count = 0;
+
+    int x = start;
+    for (; x + 4 <= width; x += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + x*4));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + x*4));
+        if (keep)
+            color = _mm_loadu_si128((const __m128i*) (keep + x));
+        __m128i diff = _mm_and_si128(
+            _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)),
+            color);
+        top = _mm_max_epu8(top, diff);
+
+        // pixels with no channel over the tolerance
+        __m128i same = _mm_cmpeq_epi32(_mm_subs_epu8(diff, tolerance), zero);
+        count += 4 - __builtin_popcount(
+            _mm_movemask_ps(_mm_castsi128_ps(same)));
+        if (mask)
+            _mm_storeu_si128((__m128i*) (mask + x), _mm_xor_si128(same, ones));
+    }
+
+    unsigned char bytes[16];
+    _mm_storeu_si128((__m128i*) bytes, top);
+    for (int i=0; i<16; i++)
+        if (bytes[i] > *max_diff)
+            *max_diff = bytes[i];
+
+    return count + compare_row_c(a, b, x, width, tol, keep, mask, max_diff);
+}
+
+
+TARGET_AVX2
+int compare_row_avx2(const unsigned char *a, const unsigned char *b,
+                     int start, int width, int tol, const unsigned int *keep,
+                     unsigned int *mask, int *max_diff)
+{
+    __m256i color = _mm256_set1_epi32(g_mask_keep);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i tolerance = _mm256_set1_epi8((char) tol);
+    __m256i top = zero;
+    int count = 0;
+
+    int x = start;
+    for (; x + 8 <= width; x += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + x*4));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + x*4));
+        if (keep)
+            color = _mm256_loadu_si256((const __m256i*) (keep + x));
+        __m256i diff = _mm256_and_si256(
+            _mm256_or_si256(_mm256_subs_epu8(va, vb),
+                            _mm256_subs_epu8(vb, va)),
+            color);
+        top = _mm256_max_epu8(top, diff);
+
+        __m256i same = _mm256_cmpeq_epi32(
+            _mm256_subs_epu8(diff, tolerance), zero);
+        count += 8 - __builtin_popcount(
+            _mm256_movemask_ps(_mm256_castsi256_ps(same)));
+        if (mask)
+            _mm256_storeu_si256((__m256i*) (mask + x),
+                                _mm256_xor_si256(same, ones));
+    }
+
+    unsigned char bytes[32];
+    _mm256_storeu_si256((__m256i*) bytes, top);
+    for (int i=0; i<32; i++)
+        if (bytes[i] > *max_diff)
+            *max_diff = bytes[i];
+
+    return count + compare_row_sse2(a, b, x, width, tol, keep, mask,
+                                    max_diff);
+}
+
+
+// Pick the fastest row comparison for this CPU
+CompareRowFunc compare_row_func()
+{
+    int features = cpu_features();
+    if (features & CPU_AVX2)
+        return compare_row_avx2;
+    if (features & CPU_SSE2)
+        return compare_row_sse2;
+    return compare_row_c;
+}
+
+
+// Compare two frames of the same size, skipping the pixels 'ignore' (may
+// be NULL) leaves out.  Stops once more than 'max_count' pixels differ,
+// unless a 'mask' frame (of the same size) is given to receive all ones
+// for every differing pixel.
+void compare_frames(const Frame *a, const Frame *b, int tol,
+                    long long max_count, const Frame *ignore, Frame *mask,
+                    CompareResult *result)
+{
+    static CompareRowFunc compare_row = compare_row_func();
+
+    result->differ = 0;
+    result->max_diff = 0;
+    result->finished = true;
+
+    for (int y=0; y<a->height; y++) {
+        unsigned int *out = mask ?
+            (unsigned int*) (mask->pixels + y * mask->stride) : NULL;
+        result->differ += compare_row(a->pixels + y * a->stride,
+                                      b->pixels + y * b->stride, 0, a->width,
+                                      tol, mask_row(ignore, y), out,
+                                      &result->max_diff);
+        if (!mask && result->differ > max_count) {
+            result->finished = y == a->height - 1;
+            break;
+        }
+    }
+}
+
+
+// Turn a mask from compare_frames() into a picture: differing pixels in
+// red over a faded gray copy of 'frame', ignored pixels darkened
+void compare_mask_image(Frame *mask, const Frame *frame, const Frame *ignore)
+{
+    for (int y=0; y<mask->height; y++) {
+        unsigned int *m = (unsigned int*) (mask->pixels + y * mask->stride);
+        const unsigned char *p = frame->pixels + y * frame->stride;
+        const unsigned int *keep = mask_row(ignore, y);
+        for (int x=0; x<mask->width; x++) {
+            if (m[x]) {
+                m[x] = 0x00ff0000;
+            } else {
+                unsigned int gray = (p[x*4] + p[x*4+1] * 2 + p[x*4+2]) / 8;
+                if (!keep || keep[x])
+                    gray += 128;
+                m[x] = (gray << 16) | (gray << 8) | gray;
+            }
+        }
+    }
+}
@@ -0,0 +1,51 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  CPU feature detection, for picking SIMD kernels at run time.
+
+=============================================================================*/
+
+// c includes
+#include <cpuid.h>
+
+
+// compile one function for an instruction set the rest of the program
+// does not assume
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+
+// CPU features worth dispatching on
+#define CPU_SSE2 1
+#define CPU_AVX2 2
+
+int cpu_features()
+{
+    static int features = -1;
+    if (features >= 0)
+        return features;
+
+    int found = 0;
+    unsigned int a, b, c, d;
+    if (__get_cpuid(1, &a, &b, &c, &d)) {
+        if (d & bit_SSE2)
+            found |= CPU_SSE2;
+
+        // AVX also needs the OS to save the ymm registers
+        bool avx = (c & bit_OSXSAVE) && (c & bit_AVX);
+        if (avx) {
+            unsigned int lo, hi;
+            __asm__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+            avx = (lo & 6) == 6;
+        }
+        if (avx && __get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(7, 0, a, b, c, d);
+            if (b & bit_AVX2)
+                found |= CPU_AVX2;
+        }
+    }
+    features = found;
+    return features;
+}
@@ -0,0 +1,370 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  A small zlib/deflate compressor for the formats boxcutter writes itself
+  (animated and stitched PNG).  LZ77 matching through hash chains, coded
+  with the fixed Huffman tables: filtered screen pixels are mostly long
+  matches, so dynamic tables would gain little.
+
+=============================================================================*/
+
+// c includes
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+
+// matches may reach this far back
+const int g_deflate_window = 32768;
+
+const int g_deflate_hash_bits = 15;
+
+// hash chain entries to try per position
+const int g_deflate_max_chain = 32;
+
+const int g_deflate_min_match = 3;
+const int g_deflate_max_match = 258;
+
+
+const unsigned short g_deflate_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const unsigned char g_deflate_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const unsigned short g_deflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+    16385, 24577};
+const unsigned char g_deflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+
+// Lookup tables, built on first use
+struct DeflateTables
+{
+    unsigned short code[288];       // fixed literal/length codes, reversed
+    unsigned char code_len[288];
+    unsigned char len_sym[259];     // match length -> index into len_base
+    unsigned char dist_lo[256];     // distance-1 < 256 -> dist code
+    unsigned char dist_hi[256];     // (distance-1) >> 7 -> dist code
+    unsigned char dist_code[30];    // dist codes, reversed (5 bits)
+};
+
+
+unsigned int deflate_reverse(unsigned int code, int len)
+{
+    unsigned int r = 0;
+    for (int i=0; i<len; i++, code >>= 1)
+        r = (r << 1) | (code & 1);
+    return r;
+}
+
+
+const DeflateTables *deflate_tables()
+{
+    static DeflateTables t;
+    static bool ready = false;
+    if (ready)
+        return &t;
+
+    for (int sym=0; sym<288; sym++) {
+        int code, len;
+        if (sym < 144) {
+            code = 0x30 + sym; len = 8;
+        } else if (sym < 256) {
+            code = 0x190 + sym - 144; len = 9;
+        } else if (sym < 280) {
+            code = sym - 256; len = 7;
+        } else {
+            code = 0xc0 + sym - 280; len = 8;
+        }
+        t.code[sym] = deflate_reverse(code, len);
+        t.code_len[sym] = len;
+    }
+
+    for (int i=0; i<29; i++) {
+        int end = (i < 28) ? g_deflate_len_base[i+1] : 259;
+        for (int len=g_deflate_len_base[i]; len<end; len++)
+            t.len_sym[len] = i;
+    }
+
+    for (int i=0; i<30; i++) {
+        int end = (i < 29) ? g_deflate_dist_base[i+1] : 32769;
+        for (int d=g_deflate_dist_base[i]; d<end; d++) {
+            if (d - 1 < 256)
+                t.dist_lo[d-1] = i;
+            else
+                t.dist_hi[(d-1) >> 7] = i;
+        }
+        t.dist_code[i] = deflate_reverse(i, 5);
+    }
+
+    ready = true;
+    return &t;
+}
+
+
+// Bits are packed starting from the least significant bit
+struct BitWriter
+{
+    std::vector<unsigned char> *out;
+    unsigned int bits;
+    int nbits;
+};
+
+
+inline void bits_put(BitWriter *w, unsigned int value, int n)
+{
+    w->bits |= value << w->nbits;
+    w->nbits += n;
+    while (w->nbits >= 8) {
+        w->out->push_back(w->bits & 0xff);
+        w->bits >>= 8;
+        w->nbits -= 8;
+    }
+}
+
+
+inline void deflate_put_match(BitWriter *w, const DeflateTables *t,
+                              int len, int dist)
+{
+    int i = t->len_sym[len];
+    bits_put(w, t->code[257 + i], t->code_len[257 + i]);
+    if (g_deflate_len_extra[i])
+        bits_put(w, len - g_deflate_len_base[i], g_deflate_len_extra[i]);
+
+    int d = (dist - 1 < 256) ? t->dist_lo[dist - 1] :
+        t->dist_hi[(dist - 1) >> 7];
+    bits_put(w, t->dist_code[d], 5);
+    if (g_deflate_dist_extra[d])
+        bits_put(w, dist - g_deflate_dist_base[d], g_deflate_dist_extra[d]);
+}
+
+
+unsigned int adler32_update(unsigned int adler, const unsigned char *data,
+                           int size)
+{
+    unsigned int a = adler & 0xffff, b = adler >> 16;
+    while (size > 0) {
+        // largest run before the sums must be reduced
+        int n = size < 5552 ? size : 5552;
+        size -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+
+unsigned int adler32(const unsigned char *data, int size)
+{
+    return adler32_update(1, data, size);
+}
+
+
+// Code bytes [start, size) of 'src' as one block with the fixed tables.
+// Bytes before 'start' are history that matches may point into.
+void deflate_block(BitWriter *w, const unsigned char *src, int start,
+                   int size, bool last)
+{
+    const DeflateTables *t = deflate_tables();
+    const int hash_size = 1 << g_deflate_hash_bits;
+    int *head = (int*) malloc(hash_size * sizeof(int));
+    int *prev = (int*) malloc(g_deflate_window * sizeof(int));
+    for (int i=0; i<hash_size; i++)
+        head[i] = -1;
+
+    bits_put(w, last ? 1 : 0, 1);
+    bits_put(w, 1, 2);
+
+    int pos = start > g_deflate_window ? start - g_deflate_window : 0;
+    while (pos < size) {
+        int best_len = 0, best_dist = 0;
+        int max_len = size - pos;
+        if (max_len > g_deflate_max_match)
+            max_len = g_deflate_max_match;
+
+        unsigned int h = 0;
+        bool coding = pos >= start;
+        if (coding && max_len >= g_deflate_min_match) {
+            unsigned int key = src[pos] | (src[pos+1] << 8) |
+                (src[pos+2] << 16);
+            h = (key * 2654435761u) >> (32 - g_deflate_hash_bits);
+
+            // walk the chain for the longest match
+            int cand = head[h];
+            for (int chain=0; cand >= 0 && chain<g_deflate_max_chain;
+                 chain++) {
+                int dist = pos - cand;
+                if (dist > g_deflate_window)
+                    break;
+                if (src[cand + best_len] == src[pos + best_len]) {
+                    int len = 0;
+                    while (len < max_len && src[cand + len] == src[pos + len])
+                        len++;
+                    if (len > best_len) {
+                        best_len = len;
+                        best_dist = dist;
+                        if (len == max_len)
+                            break;
+                    }
+                }
+                int next = prev[cand & (g_deflate_window - 1)];
+                if (next >= cand)
+                    break;
+                cand = next;
+            }
+        }
+
+        // history is only indexed
+        int advance = 1;
+        if (coding && best_len >= g_deflate_min_match) {
+            deflate_put_match(w, t, best_len, best_dist);
+            advance = best_len;
+        } else if (coding) {
+            bits_put(w, t->code[src[pos]], t->code_len[src[pos]]);
+        }
+
+        // index every position covered
+        for (int end=pos+advance; pos<end; pos++) {
+            if (pos + g_deflate_min_match > size)
+                continue;
+            unsigned int key = src[pos] | (src[pos+1] << 8) |
+                (src[pos+2] << 16);
+            h = (key * 2654435761u) >> (32 - g_deflate_hash_bits);
+            prev[pos & (g_deflate_window - 1)] = head[h];
+            head[h] = pos;
+        }
+    }
+
+    bits_put(w, t->code[256], t->code_len[256]);
+    free(head);
+    free(prev);
+}
+
+
+void deflate_put_adler(std::vector<unsigned char> *out, unsigned int adler)
+{
+    out->push_back(adler >> 24);
+    out->push_back((adler >> 16) & 0xff);
+    out->push_back((adler >> 8) & 0xff);
+    out->push_back(adler & 0xff);
+}
+
+
+// Append 'size' bytes of 'src' to 'out' as a zlib stream
+void deflate_compress(const unsigned char *src, int size,
+                      std::vector<unsigned char> *out)
+{
+    // zlib header: deflate, 32K window
+    out->push_back(0x78);
+    out->push_back(0x01);
+
+    BitWriter w;
+    w.out = out;
+    w.bits = 0;
+    w.nbits = 0;
+
+    // one final block, then pad to a byte
+    deflate_block(&w, src, 0, size, true);
+    if (w.nbits > 0)
+        bits_put(&w, 0, 8 - w.nbits);
+
+    deflate_put_adler(out, adler32(src, size));
+}
+
+
+//=============================================================================
+// Streaming: a zlib stream made of one block per piece of data, for output
+// too large to hold at once.  Matches may reach back into the previous
+// piece.
+
+struct DeflateStream
+{
+    BitWriter w;
+    std::vector<unsigned char> buf;     // history, then the new piece
+    unsigned int adler;
+};
+
+
+// Start a zlib stream; its bytes are appended to 'out' as they are made
+// and the caller may take them out between calls
+void deflate_begin(DeflateStream *stream, std::vector<unsigned char> *out)
+{
+    out->push_back(0x78);
+    out->push_back(0x01);
+    stream->w.out = out;
+    stream->w.bits = 0;
+    stream->w.nbits = 0;
+    stream->buf.clear();
+    stream->adler = 1;
+}
+
+
+// Compress the next piece of the data
+void deflate_add(DeflateStream *stream, const unsigned char *src, int size)
+{
+    if (size <= 0)
+        return;
+
+    // keep one window of history
+    int keep = stream->buf.size();
+    if (keep > g_deflate_window) {
+        stream->buf.erase(stream->buf.begin(),
+                          stream->buf.end() - g_deflate_window);
+        keep = g_deflate_window;
+    }
+    stream->buf.insert(stream->buf.end(), src, src + size);
+    deflate_block(&stream->w, &stream->buf[0], keep, stream->buf.size(),
+                  false);
+    stream->adler = adler32_update(stream->adler, src, size);
+}
+
+
+// End the stream with an empty final block and the checksum
+void deflate_end(DeflateStream *stream)
+{
+    BitWriter *w = &stream->w;
+    const DeflateTables *t = deflate_tables();
+    bits_put(w, 1, 1);
+    bits_put(w, 1, 2);
+    bits_put(w, t->code[256], t->code_len[256]);
+    if (w->nbits > 0)
+        bits_put(w, 0, 8 - w->nbits);
+    deflate_put_adler(w->out, stream->adler);
+    stream->buf.clear();
+}
+
+
+//=============================================================================
+// CRC-32, as used by PNG
+
+unsigned int crc32_update(unsigned int crc, const unsigned char *data,
+                          int size)
+{
+    static unsigned int table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (unsigned int n=0; n<256; n++) {
+            unsigned int c = n;
+            for (int k=0; k<8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        ready = true;
+    }
+
+    crc = ~crc;
+    for (int i=0; i<size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
@@ -0,0 +1,699 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Finding images on the screen: locate one or more templates in a
+  captured frame.
+
+  Screen and templates are reduced to gray pyramids, each level half the
+  size of the one below.  The coarsest level is searched exhaustively by
+  sum of absolute differences (SAD), in row bands spread over all cores,
+  keeping a few of the best well-separated spots.  Each spot is refined
+  level by level in a small window, and finally scored at full size by
+  normalized cross-correlation (NCC), so that the score is a similarity
+  from 0 to 1 that a threshold can be set on.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include <vector>
+#include <algorithm>
+
+
+// most pyramid levels, including full size
+const int g_find_max_levels = 6;
+
+// a template is searched at the coarsest level where its shorter side is
+// still at least this long
+const int g_find_min_side = 8;
+
+// spots kept from the coarse search, per template
+const int g_find_candidates = 8;
+
+// refinement window radius at each finer level
+const int g_find_refine = 2;
+
+// row bands per worker thread in the coarse search
+const int g_find_bands = 4;
+
+
+// An 8-bit gray image whose rows have at least 32 bytes of zeroed slack,
+// so that kernels may read whole vectors past the last pixel
+struct GrayImage
+{
+    unsigned char *pixels;
+    int width;
+    int height;
+    int stride;
+};
+
+
+// A spot where a template matches, in screen coordinates
+struct FindMatch
+{
+    int x, y;
+    double score;       // 0 to 1
+};
+
+
+struct FindTemplate
+{
+    const char *filename;
+    int width;
+    int height;
+    int levels;                                 // pyramid levels built
+    GrayImage gray[g_find_max_levels];
+    unsigned char *mask[g_find_max_levels];     // 0xff per template column
+    double sum, sum_sq;                         // of full-size pixels
+    std::vector<FindMatch> matches;             // best first
+};
+
+
+bool gray_alloc(GrayImage *img, int width, int height)
+{
+    img->width = width;
+    img->height = height;
+    img->stride = (width + 32 + 31) & ~31;
+    img->pixels = (unsigned char*) calloc(img->stride,
+                                          height > 0 ? height : 1);
+    if (!img->pixels) {
+        printf("error: out of memory\n");
+        return false;
+    }
+    return true;
+}
+
+
+void gray_free(GrayImage *img)
+{
+    free(img->pixels);
+    img->pixels = NULL;
+}
+
+
+// Convert one row of BGRX pixels to gray, weighting blue, green, and red
+// by 15, 75, and 38 out of 128
+typedef void (*GrayRowFunc)(const unsigned char *src, unsigned char *dst,
+                            int start, int width);
+
+
+void gray_row_c(const unsigned char *src, unsigned char *dst,
+                int start, int width)
+{
+    for (int x=start; x<width; x++) {
+        const unsigned char *p = src + x*4;
+        dst[x] = (p[0] * 15 + p[1] * 75 + p[2] * 38 + 64) >> 7;
+    }
+}
+
+
+TARGET_AVX2
+void gray_row_avx2(const unsigned char *src, unsigned char *dst,
+                   int start, int width)
+{
+    const __m256i weights = _mm256_set1_epi32(0x00264b0f);
+    const __m256i round = _mm256_set1_epi16(64);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    int x = start;
+    for (; x + 8 <= width; x += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (src + x*4));
+
+        // b*15 + g*75 and r*38 per pixel, then their sums
+        __m256i m = _mm256_maddubs_epi16(v, weights);
+        __m256i g = _mm256_srli_epi16(
+            _mm256_add_epi16(_mm256_hadd_epi16(m, m), round), 7);
+
+        // pixels 0-3 sit at the start of the low lane, 4-7 of the high
+        g = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(g, g), order);
+        _mm_storel_epi64((__m128i*) (dst + x), _mm256_castsi256_si128(g));
+    }
+    gray_row_c(src, dst, x, width);
+}
+
+
+GrayRowFunc gray_row_func()
+{
+    return (cpu_features() & CPU_AVX2) ? gray_row_avx2 : gray_row_c;
+}
+
+
+// Convert rows [y0, y1) of a frame to gray
+void gray_rows(const Frame *frame, GrayImage *gray, int y0, int y1)
+{
+    static GrayRowFunc gray_row = gray_row_func();
+
+    for (int y=y0; y<y1; y++)
+        gray_row(frame->pixels + y * frame->stride,
+                 gray->pixels + y * gray->stride, 0, frame->width);
+}
+
+
+// Average 2x2 blocks of 'src' into rows [y0, y1) of 'dst'
+void gray_half_rows(const GrayImage *src, GrayImage *dst, int y0, int y1)
+{
+    for (int y=y0; y<y1; y++) {
+        const unsigned char *a = src->pixels + 2*y * src->stride;
+        const unsigned char *b = a + src->stride;
+        unsigned char *out = dst->pixels + y * dst->stride;
+        for (int x=0; x<dst->width; x++)
+            out[x] = (a[2*x] + a[2*x+1] + b[2*x] + b[2*x+1] + 2) >> 2;
+    }
+}
+
+
+//=============================================================================
+// SAD and NCC kernels
+
+// Sum of absolute differences between a width x height template and the
+// image at 'img'.  'mask' zeroes image bytes past the template's width;
+// the template's own slack is zero.  May stop early once the sum reaches
+// 'limit'.
+typedef unsigned int (*FindSadFunc)(const unsigned char *img, int istride,
+                                    const unsigned char *tpl, int tstride,
+                                    const unsigned char *mask,
+                                    int width, int height,
+                                    unsigned int limit);
+
+
+unsigned int find_sad_c(const unsigned char *img, int istride,
+                        const unsigned char *tpl, int tstride,
+                        const unsigned char *mask, int width, int height,
+                        unsigned int limit)
+{
+    unsigned int sum = 0;
+    for (int y=0; y<height && sum<limit; y++) {
+        for (int x=0; x<width; x++)
+            sum += abs(img[x] - tpl[x]);
+        img += istride;
+        tpl += tstride;
+    }
+    return sum;
+}
+
+
+TARGET_SSE2
+unsigned int find_sad_sse2(const unsigned char *img, int istride,
+                           const unsigned char *tpl, int tstride,
+                           const unsigned char *mask, int width, int height,
+                           unsigned int limit)
+{
+    unsigned int sum = 0;
+    for (int y=0; y<height && sum<limit; y++) {
+        __m128i acc = _mm_setzero_si128();
+        for (int x=0; x<width; x+=16) {
+            __m128i v = _mm_and_si128(
+                _mm_loadu_si128((const __m128i*) (img + x)),
+                _mm_loadu_si128((const __m128i*) (mask + x)));
+            __m128i t = _mm_loadu_si128((const __m128i*) (tpl + x));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(v, t));
+        }
+        sum += _mm_cvtsi128_si32(acc) +
+            _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+        img += istride;
+        tpl += tstride;
+    }
+    return sum;
+}
+
+
+TARGET_AVX2
+unsigned int find_sad_avx2(const unsigned char *img, int istride,
+                           const unsigned char *tpl, int tstride,
+                           const unsigned char *mask, int width, int height,
+                           unsigned int limit)
+{
+    unsigned int sum = 0;
+    for (int y=0; y<height && sum<limit; y++) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int x=0; x<width; x+=32) {
+            __m256i v = _mm256_and_si256(
+                _mm256_loadu_si256((const __m256i*) (img + x)),
+                _mm256_loadu_si256((const __m256i*) (mask + x)));
+            __m256i t = _mm256_loadu_si256((const __m256i*) (tpl + x));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, t));
+        }
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc),
+                                     _mm256_extracti128_si256(acc, 1));
+        sum += _mm_cvtsi128_si32(half) +
+            _mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+        img += istride;
+        tpl += tstride;
+    }
+    return sum;
+}
+
+
+FindSadFunc find_sad_func()
+{
+    int features = cpu_features();
+    if (features & CPU_AVX2)
+        return find_sad_avx2;
+    if (features & CPU_SSE2)
+        return find_sad_sse2;
+    return find_sad_c;
+}
+
+
+// Add the image sum, image sum of squares, and image-template products
+// over one template row to sums[0..2]
+typedef void (*FindNccRowFunc)(const unsigned char *img,
+                               const unsigned char *tpl,
+                               const unsigned char *mask, int width,
+                               unsigned long long *sums);
+
+
+void find_ncc_row_c(const unsigned char *img, const unsigned char *tpl,
+                    const unsigned char *mask, int width,
+                    unsigned long long *sums)
+{
+    unsigned int si = 0, sii = 0, sit = 0;
+    for (int x=0; x<width; x++) {
+        si += img[x];
+        sii += img[x] * img[x];
+        sit += img[x] * tpl[x];
+    }
+    sums[0] += si;
+    sums[1] += sii;
+    sums[2] += sit;
+}
+
+
+TARGET_SSE2
+void find_ncc_row_sse2(const unsigned char *img, const unsigned char *tpl,
+                       const unsigned char *mask, int width,
+                       unsigned long long *sums)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i si = zero, sii = zero, sit = zero;
+
+    // 32-bit lanes hold a row of products for rows up to 16K pixels
+    for (int x=0; x<width; x+=16) {
+        __m128i v = _mm_and_si128(
+            _mm_loadu_si128((const __m128i*) (img + x)),
+            _mm_loadu_si128((const __m128i*) (mask + x)));
+        __m128i t = _mm_loadu_si128((const __m128i*) (tpl + x));
+        si = _mm_add_epi64(si, _mm_sad_epu8(v, zero));
+
+        __m128i vlo = _mm_unpacklo_epi8(v, zero);
+        __m128i vhi = _mm_unpackhi_epi8(v, zero);
+        __m128i tlo = _mm_unpacklo_epi8(t, zero);
+        __m128i thi = _mm_unpackhi_epi8(t, zero);
+        sii = _mm_add_epi32(sii, _mm_add_epi32(_mm_madd_epi16(vlo, vlo),
+                                               _mm_madd_epi16(vhi, vhi)));
+        sit = _mm_add_epi32(sit, _mm_add_epi32(_mm_madd_epi16(vlo, tlo),
+                                               _mm_madd_epi16(vhi, thi)));
+    }
+
+    unsigned int lanes[4];
+    sums[0] += _mm_cvtsi128_si32(si) +
+        _mm_cvtsi128_si32(_mm_unpackhi_epi64(si, si));
+    _mm_storeu_si128((__m128i*) lanes, sii);
+    sums[1] += (unsigned long long) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128((__m128i*) lanes, sit);
+    sums[2] += (unsigned long long) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+
+FindNccRowFunc find_ncc_row_func()
+{
+    if (cpu_features() & CPU_SSE2)
+        return find_ncc_row_sse2;
+    return find_ncc_row_c;
+}
+
+
+// Similarity from 0 to 1 of a template with the full-size screen at
+// (x,y): the correlation of the two if the template has any contrast,
+// otherwise how close the pixels are
+double find_score(const GrayImage *screen, const FindTemplate *t, int x, int y)
+{
+    static FindNccRowFunc ncc_row = find_ncc_row_func();
+
+    const GrayImage *tpl = &t->gray[0];
+    const unsigned char *img = screen->pixels + y * screen->stride + x;
+    double n = (double) t->width * t->height;
+    double var_t = t->sum_sq - t->sum * t->sum / n;
+
+    if (var_t < 1.0) {
+        static FindSadFunc find_sad = find_sad_func();
+        unsigned int sad = find_sad(img, screen->stride, tpl->pixels,
+                                    tpl->stride, t->mask[0], t->width,
+                                    t->height, UINT_MAX);
+        return 1.0 - sad / (255.0 * n);
+    }
+
+    unsigned long long sums[3] = {0, 0, 0};
+    for (int j=0; j<t->height; j++)
+        ncc_row(img + j * screen->stride, tpl->pixels + j * tpl->stride,
+                t->mask[0], t->width, sums);
+
+    double var_i = sums[1] - (double) sums[0] * sums[0] / n;
+    if (var_i < 1.0)
+        return 0.0;
+    double ncc = (sums[2] - (double) sums[0] * t->sum / n) /
+        sqrt(var_i * var_t);
+    return ncc > 0.0 ? ncc : 0.0;
+}
+
+
+//=============================================================================
+// Search
+
+struct FindCandidate
+{
+    int x, y;
+    unsigned int sad;
+};
+
+
+// Keep the best g_find_candidates spots, at most one per (rx, ry)
+// neighbourhood
+void find_keep(std::vector<FindCandidate> *best, int x, int y,
+               unsigned int sad, int rx, int ry)
+{
+    FindCandidate c = {x, y, sad};
+    int worst = 0;
+    for (unsigned int i=0; i<best->size(); i++) {
+        FindCandidate &b = (*best)[i];
+        if (abs(b.x - x) < rx && abs(b.y - y) < ry) {
+            if (sad < b.sad)
+                b = c;
+            return;
+        }
+        if (b.sad > (*best)[worst].sad)
+            worst = i;
+    }
+    if ((int) best->size() < g_find_candidates)
+        best->push_back(c);
+    else if (sad < (*best)[worst].sad)
+        (*best)[worst] = c;
+}
+
+
+unsigned int find_limit(const std::vector<FindCandidate> &best)
+{
+    if ((int) best.size() < g_find_candidates)
+        return UINT_MAX;
+    unsigned int limit = 0;
+    for (unsigned int i=0; i<best.size(); i++)
+        if (best[i].sad > limit)
+            limit = best[i].sad;
+    return limit;
+}
+
+
+// Coarse search of one template over a band of positions
+struct FindTask
+{
+    const GrayImage *screen;        // at level 'level'
+    const FindTemplate *tpl;
+    int level;                      // coarsest level searched
+    int y0, y1;                     // rows of positions to try
+    std::vector<FindCandidate> best;
+};
+
+
+void find_task(void *arg)
+{
+    static FindSadFunc find_sad = find_sad_func();
+
+    FindTask *task = (FindTask*) arg;
+    const FindTemplate *t = task->tpl;
+    int level = task->level;
+    const GrayImage *screen = task->screen;
+    const GrayImage *tpl = &t->gray[level];
+    int rx = (tpl->width + 1) / 2, ry = (tpl->height + 1) / 2;
+    int end_x = screen->width - tpl->width;
+
+    unsigned int limit = UINT_MAX;
+    for (int y=task->y0; y<task->y1; y++) {
+        const unsigned char *row = screen->pixels + y * screen->stride;
+        for (int x=0; x<=end_x; x++) {
+            unsigned int sad = find_sad(row + x, screen->stride, tpl->pixels,
+                                        tpl->stride, t->mask[level],
+                                        tpl->width, tpl->height, limit);
+            if (sad < limit) {
+                find_keep(&task->best, x, y, sad, rx, ry);
+                limit = find_limit(task->best);
+            }
+        }
+    }
+}
+
+
+// Band tasks for building the screen pyramid
+struct GrayTask
+{
+    const Frame *frame;         // source of level 0, or NULL
+    const GrayImage *src;       // source of finer levels
+    GrayImage *dst;
+    int y0, y1;
+};
+
+
+void gray_task(void *arg)
+{
+    GrayTask *task = (GrayTask*) arg;
+    if (task->frame)
+        gray_rows(task->frame, task->dst, task->y0, task->y1);
+    else
+        gray_half_rows(task->src, task->dst, task->y0, task->y1);
+}
+
+
+// Run gray_task() over rows [0, height) split into bands, and wait
+void find_bands(ThreadPool *pool, GrayTask *proto, int height,
+                std::vector<GrayTask> *tasks)
+{
+    int nbands = pool->nthreads * g_find_bands;
+    tasks->clear();
+    for (int i=0; i<nbands; i++) {
+        GrayTask task = *proto;
+        task.y0 = i * height / nbands;
+        task.y1 = (i + 1) * height / nbands;
+        if (task.y1 > task.y0)
+            tasks->push_back(task);
+    }
+    for (unsigned int i=0; i<tasks->size(); i++)
+        pool_add(pool, gray_task, &(*tasks)[i]);
+    pool_wait(pool);
+}
+
+
+// Load a template and build its pyramid
+bool find_load_template(FindTemplate *t, const char *filename)
+{
+    Frame frame;
+    t->filename = filename;
+    t->levels = 0;
+    if (!load_image_file(filename, &frame))
+        return false;
+    t->width = frame.width;
+    t->height = frame.height;
+
+    int side = std::min(t->width, t->height);
+    int levels = 1;
+    while (levels < g_find_max_levels && (side >> levels) >= g_find_min_side)
+        levels++;
+
+    bool ret = true;
+    for (int l=0; l<levels && ret; l++) {
+        int w = t->width >> l, h = t->height >> l;
+        ret = gray_alloc(&t->gray[l], w, h);
+        if (!ret)
+            break;
+        t->levels++;
+
+        if (l == 0)
+            gray_rows(&frame, &t->gray[0], 0, h);
+        else
+            gray_half_rows(&t->gray[l-1], &t->gray[l], 0, h);
+
+        t->mask[l] = (unsigned char*) calloc(t->gray[l].stride, 1);
+        if (!t->mask[l]) {
+            printf("error: out of memory\n");
+            ret = false;
+            break;
+        }
+        memset(t->mask[l], 0xff, w);
+    }
+    frame_free(&frame);
+
+    t->sum = t->sum_sq = 0.0;
+    for (int y=0; ret && y<t->height; y++) {
+        const unsigned char *row = t->gray[0].pixels + y * t->gray[0].stride;
+        for (int x=0; x<t->width; x++) {
+            t->sum += row[x];
+            t->sum_sq += row[x] * row[x];
+        }
+    }
+    return ret;
+}
+
+
+void find_free_template(FindTemplate *t)
+{
+    for (int l=0; l<t->levels; l++) {
+        gray_free(&t->gray[l]);
+        free(t->mask[l]);
+    }
+    t->levels = 0;
+    t->matches.clear();
+}
+
+
+bool find_match_better(const FindMatch &a, const FindMatch &b)
+{
+    return a.score > b.score;
+}
+
+
+// Find 'n' templates in a captured frame in one pass.  Every template's
+// 'matches' receives the spots scoring at least 'threshold', best first.
+bool find_templates(const Frame *frame, FindTemplate *templates, int n,
+                    double threshold)
+{
+    // coarsest level to search each template at, where it still fits on
+    // the screen; the screen needs as many levels as the deepest one
+    std::vector<int> tops(n);
+    int levels = 1;
+    for (int i=0; i<n; i++) {
+        FindTemplate *t = &templates[i];
+        int top = t->levels - 1;
+        while (top > 0 && ((frame->width >> top) < t->gray[top].width ||
+                           (frame->height >> top) < t->gray[top].height))
+            top--;
+        tops[i] = top;
+        t->matches.clear();
+        levels = std::max(levels, top + 1);
+    }
+
+    ThreadPool pool;
+    if (!pool_init(&pool, 0))
+        return false;
+
+    GrayImage screen[g_find_max_levels];
+    int nscreen = 0;
+    bool ret = true;
+    std::vector<GrayTask> gray_tasks;
+    for (int l=0; l<levels && ret; l++) {
+        ret = gray_alloc(&screen[l], frame->width >> l, frame->height >> l);
+        if (!ret)
+            break;
+        nscreen++;
+
+        GrayTask proto;
+        proto.frame = l == 0 ? frame : NULL;
+        proto.src = l == 0 ? NULL : &screen[l-1];
+        proto.dst = &screen[l];
+        find_bands(&pool, &proto, screen[l].height, &gray_tasks);
+    }
+
+    // coarse search: every template over bands of rows, all at once
+    std::vector<FindTask> tasks;
+    int nbands = pool.nthreads * g_find_bands;
+    for (int i=0; ret && i<n; i++) {
+        FindTemplate *t = &templates[i];
+        const GrayImage *s = &screen[tops[i]];
+        int rows = s->height - t->gray[tops[i]].height + 1;
+        if (s->width < t->gray[tops[i]].width || rows <= 0)
+            continue;
+        for (int b=0; b<nbands; b++) {
+            FindTask task;
+            task.screen = s;
+            task.tpl = t;
+            task.level = tops[i];
+            task.y0 = b * rows / nbands;
+            task.y1 = (b + 1) * rows / nbands;
+            if (task.y1 > task.y0)
+                tasks.push_back(task);
+        }
+    }
+    for (unsigned int i=0; i<tasks.size(); i++)
+        pool_add(&pool, find_task, &tasks[i]);
+    pool_free(&pool);
+
+    // refine each spot down the pyramid, then score it at full size
+    static FindSadFunc find_sad = find_sad_func();
+    for (int i=0; ret && i<n; i++) {
+        FindTemplate *t = &templates[i];
+        std::vector<FindCandidate> best;
+        int top = tops[i];
+        for (unsigned int k=0; k<tasks.size(); k++)
+            if (tasks[k].tpl == t)
+                for (unsigned int j=0; j<tasks[k].best.size(); j++) {
+                    const FindCandidate &c = tasks[k].best[j];
+                    find_keep(&best, c.x, c.y, c.sad,
+                              (t->gray[top].width + 1) / 2,
+                              (t->gray[top].height + 1) / 2);
+                }
+
+        for (unsigned int k=0; k<best.size(); k++) {
+            int x = best[k].x, y = best[k].y;
+            for (int l=top-1; l>=0; l--) {
+                const GrayImage *s = &screen[l];
+                const GrayImage *tpl = &t->gray[l];
+                int cx = 2 * x, cy = 2 * y;
+                unsigned int least = UINT_MAX;
+                for (int j=cy-g_find_refine; j<=cy+g_find_refine; j++) {
+                    if (j < 0 || j > s->height - tpl->height)
+                        continue;
+                    for (int k2=cx-g_find_refine; k2<=cx+g_find_refine; k2++) {
+                        if (k2 < 0 || k2 > s->width - tpl->width)
+                            continue;
+                        unsigned int sad = find_sad(
+                            s->pixels + j * s->stride + k2, s->stride,
+                            tpl->pixels, tpl->stride, t->mask[l],
+                            tpl->width, tpl->height, least);
+                        if (sad < least) {
+                            least = sad;
+                            x = k2;
+                            y = j;
+                        }
+                    }
+                }
+            }
+
+            FindMatch m;
+            m.x = x;
+            m.y = y;
+            m.score = find_score(&screen[0], t, x, y);
+            if (m.score < threshold)
+                continue;
+
+            // spots may have converged on the same place
+            bool dup = false;
+            for (unsigned int j=0; j<t->matches.size(); j++) {
+                FindMatch &o = t->matches[j];
+                if (abs(o.x - m.x) < (t->width + 1) / 2 &&
+                    abs(o.y - m.y) < (t->height + 1) / 2) {
+                    if (m.score > o.score)
+                        o = m;
+                    dup = true;
+                    break;
+                }
+            }
+            if (!dup)
+                t->matches.push_back(m);
+        }
+
+        std::sort(t->matches.begin(), t->matches.end(), find_match_better);
+        for (unsigned int j=0; j<t->matches.size(); j++) {
+            t->matches[j].x += frame->x;
+            t->matches[j].y += frame->y;
+        }
+    }
+
+    for (int l=0; l<nscreen; l++)
+        gray_free(&screen[l]);
+    return ret;
+}
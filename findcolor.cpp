@@ -0,0 +1,356 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Color search: count the pixels of a frame within a tolerance of a color
+  and find the bounding boxes of their connected regions.
+
+  Rows are matched with AVX2 or SSE2 compares into one bit per pixel.
+  Each row band (one task per band on the thread pool) turns its bits
+  into runs and joins touching runs (8-connected) with union-find; the
+  bands are then stitched together at their seams.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include <vector>
+#include <algorithm>
+
+
+// row bands per worker thread
+const int g_color_bands = 4;
+
+const char *g_color_hex_digits = "0123456789abcdefABCDEF";
+
+
+// A horizontal run of matching pixels, [x0, x1) of row y
+struct ColorRun
+{
+    int y, x0, x1;
+};
+
+
+// Bounding box (x1,y1)-(x2,y2) of a connected region, in screen
+// coordinates
+struct ColorRegion
+{
+    int x1, y1, x2, y2;
+    long long pixels;
+};
+
+
+// Set bit x of 'bits' for each pixel x in [start, width) of 'row' whose
+// channels are all within 'tol' of 'color' (0xRRGGBB).  Returns the
+// number of matching pixels.  'start' is a multiple of 4.
+typedef int (*ColorRowFunc)(const unsigned char *row, int start, int width,
+                            unsigned int color, int tol, unsigned int *bits);
+
+
+int color_row_c(const unsigned char *row, int start, int width,
+                unsigned int color, int tol, unsigned int *bits)
+{
+    int count = 0;
+    for (int x=start; x<width; x++) {
+        const unsigned char *p = row + x*4;
+        if (abs(p[0] - (int) (color & 0xff)) <= tol &&
+            abs(p[1] - (int) ((color >> 8) & 0xff)) <= tol &&
+            abs(p[2] - (int) ((color >> 16) & 0xff)) <= tol) {
+            bits[x >> 5] |= 1u << (x & 31);
+            count++;
+        }
+    }
+    return count;
+}
+
+
+TARGET_SSE2
+int color_row_sse2(const unsigned char *row, int start, int width,
+                   unsigned int color, int tol, unsigned int *bits)
+{
+    const __m128i target = _mm_set1_epi32(color);
+    const __m128i channels = _mm_set1_epi32(0x00ffffff);
+    const __m128i tolerance = _mm_set1_epi8((char) tol);
+    const __m128i zero = _mm_setzero_si128();
+    int count = 0;
+
+    int x = start;
+    for (; x + 4 <= width; x += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*) (row + x*4));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(p, target),
+                                    _mm_subs_epu8(target, p));
+        __m128i over = _mm_and_si128(_mm_subs_epu8(diff, tolerance),
+                                     channels);
+        unsigned int m = _mm_movemask_ps(
+            _mm_castsi128_ps(_mm_cmpeq_epi32(over, zero)));
+        bits[x >> 5] |= m << (x & 31);
+        count += __builtin_popcount(m);
+    }
+    return count + color_row_c(row, x, width, color, tol, bits);
+}
+
+
+TARGET_AVX2
+int color_row_avx2(const unsigned char *row, int start, int width,
+                   unsigned int color, int tol, unsigned int *bits)
+{
+    const __m256i target = _mm256_set1_epi32(color);
+    const __m256i channels = _mm256_set1_epi32(0x00ffffff);
+    const __m256i tolerance = _mm256_set1_epi8((char) tol);
+    const __m256i zero = _mm256_setzero_si256();
+    int count = 0;
+
+    int x = start;
+    for (; x + 8 <= width; x += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i*) (row + x*4));
+        __m256i diff = _mm256_or_si256(_mm256_subs_epu8(p, target),
+                                       _mm256_subs_epu8(target, p));
+        __m256i over = _mm256_and_si256(_mm256_subs_epu8(diff, tolerance),
+                                        channels);
+        unsigned int m = _mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(over, zero)));
+        bits[x >> 5] |= m << (x & 31);
+        count += __builtin_popcount(m);
+    }
+    return count + color_row_sse2(row, x, width, color, tol, bits);
+}
+
+
+ColorRowFunc color_row_func()
+{
+    int features = cpu_features();
+    if (features & CPU_AVX2)
+        return color_row_avx2;
+    if (features & CPU_SSE2)
+        return color_row_sse2;
+    return color_row_c;
+}
+
+
+// Parse a color written as exactly six hex digits, RRGGBB, at the start
+// of 'text'.  Returns a pointer past the digits, or NULL if there are
+// more or fewer than six.
+const char *color_parse(const char *text, unsigned int *color)
+{
+    if (strspn(text, g_color_hex_digits) != 6)
+        return NULL;
+    *color = 0;
+    for (int i=0; i<6; i++) {
+        char c = text[i];
+        int digit = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+        *color = (*color << 4) | digit;
+    }
+    return text + 6;
+}
+
+
+//=============================================================================
+// Labeling
+
+int color_root(std::vector<int> &parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+
+void color_union(std::vector<int> &parent, int a, int b)
+{
+    a = color_root(parent, a);
+    b = color_root(parent, b);
+    if (a < b)
+        parent[b] = a;
+    else if (b < a)
+        parent[a] = b;
+}
+
+
+// Join the runs [a0, a1) of one row with the touching runs [b0, b1) of
+// the row below
+void color_join_rows(const std::vector<ColorRun> &runs,
+                     std::vector<int> &parent, int a0, int a1, int b0, int b1)
+{
+    int i = a0, j = b0;
+    while (i < a1 && j < b1) {
+        // diagonal neighbours touch too
+        if (runs[i].x0 <= runs[j].x1 && runs[j].x0 <= runs[i].x1)
+            color_union(parent, i, j);
+        if (runs[i].x1 < runs[j].x1)
+            i++;
+        else
+            j++;
+    }
+}
+
+
+// Match and label one band of rows
+struct ColorTask
+{
+    const Frame *frame;
+    unsigned int color;
+    int tol;
+    int y0, y1;
+
+    long long count;
+    std::vector<ColorRun> runs;     // row by row, left to right
+    std::vector<int> parent;        // union-find over 'runs'
+    int first_end;                  // runs of row y0 are [0, first_end)
+    int last_start;                 // runs of row y1-1 start here
+};
+
+
+void color_task(void *arg)
+{
+    static ColorRowFunc color_row = color_row_func();
+
+    ColorTask *task = (ColorTask*) arg;
+    const Frame *frame = task->frame;
+    int nwords = (frame->width + 31) / 32;
+    std::vector<unsigned int> bits(nwords + 1);
+    int prev_start = 0, prev_end = 0;
+
+    task->count = 0;
+    task->first_end = 0;
+    task->last_start = 0;
+    for (int y=task->y0; y<task->y1; y++) {
+        std::fill(bits.begin(), bits.end(), 0);
+        task->count += color_row(frame->pixels + y * frame->stride, 0,
+                                 frame->width, task->color, task->tol,
+                                 &bits[0]);
+
+        // bits to runs
+        int start = task->runs.size();
+        int x = 0;
+        while (x < frame->width) {
+            unsigned int word = bits[x >> 5] & (~0u << (x & 31));
+            if (!word) {
+                x = ((x >> 5) + 1) << 5;
+                continue;
+            }
+            ColorRun run;
+            run.y = y;
+            run.x0 = ((x >> 5) << 5) + __builtin_ctz(word);
+
+            // find the end: the next clear bit
+            x = run.x0;
+            while (true) {
+                unsigned int gaps = ~bits[x >> 5] & (~0u << (x & 31));
+                if (gaps) {
+                    x = ((x >> 5) << 5) + __builtin_ctz(gaps);
+                    break;
+                }
+                x = ((x >> 5) + 1) << 5;
+            }
+            run.x1 = std::min(x, frame->width);
+            task->runs.push_back(run);
+            task->parent.push_back(task->parent.size());
+        }
+        int end = task->runs.size();
+
+        color_join_rows(task->runs, task->parent, prev_start, prev_end,
+                        start, end);
+        if (y == task->y0)
+            task->first_end = end;
+        prev_start = start;
+        prev_end = end;
+    }
+    task->last_start = prev_start;
+}
+
+
+bool color_region_larger(const ColorRegion &a, const ColorRegion &b)
+{
+    return a.pixels > b.pixels;
+}
+
+
+// Find the pixels of 'frame' within 'tol' of 'color' (0xRRGGBB): their
+// number in '*count' and their connected regions in 'regions', largest
+// first
+bool color_find(const Frame *frame, unsigned int color, int tol,
+                long long *count, std::vector<ColorRegion> *regions)
+{
+    ThreadPool pool;
+    if (!pool_init(&pool, 0))
+        return false;
+
+    int nbands = pool.nthreads * g_color_bands;
+    std::vector<ColorTask> tasks;
+    for (int i=0; i<nbands; i++) {
+        ColorTask task;
+        task.frame = frame;
+        task.color = color;
+        task.tol = tol;
+        task.y0 = i * frame->height / nbands;
+        task.y1 = (i + 1) * frame->height / nbands;
+        if (task.y1 > task.y0)
+            tasks.push_back(task);
+    }
+    for (unsigned int i=0; i<tasks.size(); i++)
+        pool_add(&pool, color_task, &tasks[i]);
+    pool_free(&pool);
+
+    // one union-find over the runs of all bands
+    std::vector<ColorRun> runs;
+    std::vector<int> parent;
+    std::vector<int> offsets;
+    *count = 0;
+    for (unsigned int i=0; i<tasks.size(); i++) {
+        int offset = runs.size();
+        offsets.push_back(offset);
+        *count += tasks[i].count;
+        runs.insert(runs.end(), tasks[i].runs.begin(), tasks[i].runs.end());
+        for (unsigned int j=0; j<tasks[i].parent.size(); j++)
+            parent.push_back(tasks[i].parent[j] + offset);
+    }
+
+    // stitch each band's last row to the next band's first row
+    for (unsigned int i=0; i+1<tasks.size(); i++) {
+        const ColorTask &a = tasks[i], &b = tasks[i+1];
+        color_join_rows(runs, parent,
+                        offsets[i] + a.last_start,
+                        offsets[i] + a.runs.size(),
+                        offsets[i+1], offsets[i+1] + b.first_end);
+    }
+
+    // one region per root
+    regions->clear();
+    std::vector<int> region_of(runs.size(), -1);
+    for (unsigned int i=0; i<runs.size(); i++) {
+        int root = color_root(parent, i);
+        const ColorRun &run = runs[i];
+        if (region_of[root] < 0) {
+            ColorRegion r;
+            r.x1 = run.x0;
+            r.x2 = run.x1;
+            r.y1 = run.y;
+            r.y2 = run.y + 1;
+            r.pixels = 0;
+            region_of[root] = regions->size();
+            regions->push_back(r);
+        }
+        ColorRegion &r = (*regions)[region_of[root]];
+        r.x1 = std::min(r.x1, run.x0);
+        r.x2 = std::max(r.x2, run.x1);
+        r.y2 = std::max(r.y2, run.y + 1);
+        r.pixels += run.x1 - run.x0;
+    }
+
+    for (unsigned int i=0; i<regions->size(); i++) {
+        ColorRegion &r = (*regions)[i];
+        r.x1 += frame->x;
+        r.x2 += frame->x;
+        r.y1 += frame->y;
+        r.y2 += frame->y;
+    }
+    std::sort(regions->begin(), regions->end(), color_region_larger);
+    return true;
+}
@@ -0,0 +1,177 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Frames: captured screen pixels held in a 32-bit top-down DIB section, so
+  that both GDI and plain pointer arithmetic can get at them.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// windows includes
+#include <windows.h>
+
+
+// A captured region of the screen
+struct Frame
+{
+    HDC dc;                 // memory DC with 'bitmap' selected into it
+    HBITMAP bitmap;         // DIB section owning 'pixels'
+    HGDIOBJ old_obj;        // object 'bitmap' replaced in 'dc'
+    unsigned char *pixels;  // BGRX pixels, top row first
+    int width;
+    int height;
+    int stride;             // bytes per row
+    int x, y;               // screen coordinates of pixel (0,0)
+};
+
+
+// 64-bit FNV-1a, for hashing pixels (motion search, waits)
+const unsigned long long g_fnv_prime = 0x100000001b3ull;
+const unsigned long long g_fnv_basis = 0xcbf29ce484222325ull;
+
+
+// Called on every frame just before its pixels are copied from the
+// screen, or NULL.  What it returns (allocated with malloc, or NULL) is
+// handed to g_frame_filter and then freed, so that state seen before the
+// copy stays with that one grab, whatever thread makes it.
+void *(*g_frame_prefilter)(const Frame *frame) = NULL;
+
+// Called on every frame just after its pixels are copied from the screen,
+// before anything else reads them (boxcutter sets it for --redact), or
+// NULL
+void (*g_frame_filter)(Frame *frame, void *before) = NULL;
+
+
+// Initialize an empty frame
+void frame_init(Frame *frame)
+{
+    memset(frame, 0, sizeof(Frame));
+}
+
+
+// Release all resources held by a frame
+void frame_free(Frame *frame)
+{
+    if (frame->dc) {
+        SelectObject(frame->dc, frame->old_obj);
+        DeleteDC(frame->dc);
+    }
+    if (frame->bitmap)
+        DeleteObject(frame->bitmap);
+    frame_init(frame);
+}
+
+
+// Allocate a w x h frame whose pixel (0,0) maps to screen point (x,y).
+// If 'section' is given, the pixels live in that file mapping at 'offset'
+// (a multiple of 4) instead of in private memory.
+bool frame_create_section(Frame *frame, int x, int y, int w, int h,
+                          HANDLE section, DWORD offset)
+{
+    frame_init(frame);
+    if (w <= 0 || h <= 0) {
+        printf("error: empty capture rectangle\n");
+        return false;
+    }
+
+    BITMAPINFO bmi;
+    memset(&bmi, 0, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = w;
+    bmi.bmiHeader.biHeight = -h; // negative height means top-down rows
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    HDC screen_dc = GetDC(0);
+    void *bits = NULL;
+    frame->bitmap = CreateDIBSection(screen_dc, &bmi, DIB_RGB_COLORS,
+                                     &bits, section, offset);
+    frame->dc = CreateCompatibleDC(screen_dc);
+    ReleaseDC(0, screen_dc);
+
+    if (!frame->bitmap || !frame->dc) {
+        printf("error: cannot allocate %dx%d frame\n", w, h);
+        frame_free(frame);
+        return false;
+    }
+
+    frame->old_obj = SelectObject(frame->dc, frame->bitmap);
+    frame->pixels = (unsigned char*) bits;
+    frame->width = w;
+    frame->height = h;
+    frame->stride = w * 4;
+    frame->x = x;
+    frame->y = y;
+    return true;
+}
+
+
+// Allocate a w x h frame whose pixel (0,0) maps to screen point (x,y)
+bool frame_create(Frame *frame, int x, int y, int w, int h)
+{
+    return frame_create_section(frame, x, y, w, h, NULL, 0);
+}
+
+
+// Copy the screen contents under an allocated frame into it
+bool frame_grab(Frame *frame, HDC screen_dc)
+{
+    void *before = g_frame_prefilter ? g_frame_prefilter(frame) : NULL;
+    if (!BitBlt(frame->dc, 0, 0, frame->width, frame->height,
+                screen_dc, frame->x, frame->y, SRCCOPY)) {
+        printf("error: BitBlt failed\n");
+        free(before);
+        return false;
+    }
+
+    // make sure GDI is done with the bits before anyone reads them
+    GdiFlush();
+    if (g_frame_filter)
+        g_frame_filter(frame, before);
+    free(before);
+    return true;
+}
+
+
+// Capture the screen rectangle (x,y)-(x2,y2) into a new frame
+bool frame_capture(Frame *frame, int x, int y, int x2, int y2)
+{
+    if (!frame_create(frame, x, y, x2 - x, y2 - y))
+        return false;
+
+    HDC screen_dc = GetDC(0);
+    bool ret = frame_grab(frame, screen_dc);
+    ReleaseDC(0, screen_dc);
+
+    if (!ret)
+        frame_free(frame);
+    return ret;
+}
+
+
+// Copy the screen rectangle (x,y)-(x2,y2) out of an existing frame into
+// a new frame.  The rectangle is clipped to the source frame.
+bool frame_crop(const Frame *src, Frame *dst, int x, int y, int x2, int y2)
+{
+    if (x < src->x) x = src->x;
+    if (y < src->y) y = src->y;
+    if (x2 > src->x + src->width) x2 = src->x + src->width;
+    if (y2 > src->y + src->height) y2 = src->y + src->height;
+
+    if (!frame_create(dst, x, y, x2 - x, y2 - y))
+        return false;
+
+    const unsigned char *row = src->pixels +
+        (y - src->y) * src->stride + (x - src->x) * 4;
+    for (int i=0; i<dst->height; i++)
+        memcpy(dst->pixels + i * dst->stride, row + i * src->stride,
+               dst->width * 4);
+    return true;
+}
@@ -0,0 +1,302 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  libboxcutter: the capture and encoding core shared by the boxcutter
+  executables, with a C interface (boxcutter.h) for other programs.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// windows includes
+#include <windows.h>
+
+#include "boxcutter.h"
+#include "frame.cpp"
+#include "bmp.cpp"
+#include "png.cpp"
+#include "qoi.cpp"
+#include "capture.cpp"
+#include "shm.cpp"
+#include "probe.cpp"
+
+
+//=============================================================================
+// C interface
+
+// Wrap the pixels of a frame in a caller-visible image
+void bc_image_from_frame(Frame *frame, bc_image *image)
+{
+    image->pixels = frame->pixels;
+    image->width = frame->width;
+    image->height = frame->height;
+    image->stride = frame->stride;
+    image->x = frame->x;
+    image->y = frame->y;
+    image->priv = frame;
+}
+
+
+// Get a frame holding an image's pixels.  Caller buffers are copied into
+// a temporary frame, which sets '*temp'.
+Frame *bc_image_frame(const bc_image *image, bool *temp)
+{
+    *temp = false;
+    if (image->priv)
+        return (Frame*) image->priv;
+
+    Frame *frame = new Frame;
+    if (!frame_create(frame, image->x, image->y, 
+                      image->width, image->height)) {
+        delete frame;
+        return NULL;
+    }
+    for (int i=0; i<image->height; i++)
+        memcpy(frame->pixels + i * frame->stride, 
+               image->pixels + i * image->stride, image->width * 4);
+    *temp = true;
+    return frame;
+}
+
+
+extern "C" {
+
+BC_API void bc_normalize_coords(int *x, int *y, int *x2, int *y2)
+{
+    normalize_coords(x, y, x2, y2);
+}
+
+
+BC_API void bc_get_screen_rect(int *x, int *y, int *x2, int *y2)
+{
+    RECT rect;
+    get_screen_rect(&rect);
+    *x = rect.left;
+    *y = rect.top;
+    *x2 = rect.right;
+    *y2 = rect.bottom;
+}
+
+
+BC_API int bc_capture(int x, int y, int x2, int y2, bc_image *image)
+{
+    normalize_coords(&x, &y, &x2, &y2);
+    Frame *frame = new Frame;
+    if (!frame_capture(frame, x, y, x2, y2)) {
+        delete frame;
+        return 0;
+    }
+    bc_image_from_frame(frame, image);
+    return 1;
+}
+
+
+BC_API int bc_capture_into(int x, int y, int x2, int y2,
+                           void *buffer, int stride, bc_image *image)
+{
+    normalize_coords(&x, &y, &x2, &y2);
+    int w = x2 - x;
+    int h = y2 - y;
+    if (w <= 0 || h <= 0 || stride < w * 4)
+        return 0;
+
+    // copy the screen to a device bitmap, then let the driver convert it
+    // straight into the caller's rows
+    HDC screen_dc = GetDC(0);
+    HDC shot_dc = CreateCompatibleDC(screen_dc);
+    HBITMAP shot_bitmap = CreateCompatibleBitmap(screen_dc, w, h);
+    HGDIOBJ old_obj = SelectObject(shot_dc, shot_bitmap);
+    bool ret = BitBlt(shot_dc, 0, 0, w, h, screen_dc, x, y, SRCCOPY) != 0;
+    SelectObject(shot_dc, old_obj);
+
+    if (ret) {
+        BITMAPINFO bmi;
+        memset(&bmi, 0, sizeof(bmi));
+        bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bmi.bmiHeader.biWidth = w;
+        bmi.bmiHeader.biHeight = -h;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        unsigned char *out = (unsigned char*) buffer;
+        if (stride == w * 4) {
+            ret = GetDIBits(shot_dc, shot_bitmap, 0, h, out, &bmi, 
+                            DIB_RGB_COLORS) == h;
+        } else {
+            // padded rows: one row at a time, bottom-up lines
+            bmi.bmiHeader.biHeight = h;
+            for (int i=0; ret && i<h; i++)
+                ret = GetDIBits(shot_dc, shot_bitmap, h - 1 - i, 1, 
+                                out + i * stride, &bmi, DIB_RGB_COLORS) == 1;
+        }
+    }
+
+    DeleteObject(shot_bitmap);
+    DeleteDC(shot_dc);
+    ReleaseDC(0, screen_dc);
+
+    if (ret && image) {
+        image->pixels = (unsigned char*) buffer;
+        image->width = w;
+        image->height = h;
+        image->stride = stride;
+        image->x = x;
+        image->y = y;
+        image->priv = NULL;
+    }
+    return ret;
+}
+
+
+BC_API void bc_image_free(bc_image *image)
+{
+    Frame *frame = (Frame*) image->priv;
+    if (frame) {
+        frame_free(frame);
+        delete frame;
+    }
+    memset(image, 0, sizeof(bc_image));
+}
+
+
+BC_API int bc_save(const bc_image *image, const char *filename)
+{
+    bool temp;
+    Frame *frame = bc_image_frame(image, &temp);
+    if (!frame)
+        return 0;
+    
+    bool ret = save_frame(frame, filename);
+    if (temp) {
+        frame_free(frame);
+        delete frame;
+    }
+    return ret;
+}
+
+
+BC_API int bc_encode(const bc_image *image, const char *format,
+                     void **data, int *size)
+{
+    // BMP needs no GDI objects
+    if (strcasecmp(format, "bmp") == 0)
+        return encode_bitmap_memory(image->pixels, image->width, 
+                                    image->height, image->stride,
+                                    (unsigned char**) data, size);
+    
+    bool temp;
+    Frame *frame = bc_image_frame(image, &temp);
+    if (!frame)
+        return 0;
+
+    bool ret = encode_frame(frame, format, (unsigned char**) data, size);
+    if (temp) {
+        frame_free(frame);
+        delete frame;
+    }
+    return ret;
+}
+
+
+BC_API void bc_free(void *data)
+{
+    free(data);
+}
+
+
+BC_API int bc_capture_file(const char *filename, int x, int y, int x2, int y2)
+{
+    return capture_screen(filename, x, y, x2, y2);
+}
+
+
+BC_API int bc_capture_file_bmp(const char *filename, 
+                               int x, int y, int x2, int y2)
+{
+    return capture_screen_bmp(filename, x, y, x2, y2);
+}
+
+
+
+BC_API bc_shm *bc_shm_open(const char *name)
+{
+    ShmReader *reader = new ShmReader;
+    if (!shm_open_reader(reader, name)) {
+        delete reader;
+        return NULL;
+    }
+    return (bc_shm*) reader;
+}
+
+
+BC_API int bc_shm_latest(bc_shm *shm, bc_image *image,
+                         unsigned long long *timestamp, 
+                         bc_shm_ticket *ticket)
+{
+    ShmReader *reader = (ShmReader*) shm;
+    LONG seq;
+    const unsigned char *pixels = shm_latest(reader, &ticket->slot, &seq,
+                                             timestamp);
+    if (!pixels)
+        return 0;
+    ticket->seq = seq;
+
+    ShmHeader *header = reader->header;
+    image->pixels = (unsigned char*) pixels;
+    image->width = header->width;
+    image->height = header->height;
+    image->stride = header->stride;
+    image->x = header->x;
+    image->y = header->y;
+    image->priv = NULL;
+    return 1;
+}
+
+
+BC_API int bc_shm_check(bc_shm *shm, const bc_shm_ticket *ticket)
+{
+    return shm_check((ShmReader*) shm, ticket->slot, ticket->seq);
+}
+
+
+BC_API void bc_shm_close(bc_shm *shm)
+{
+    ShmReader *reader = (ShmReader*) shm;
+    shm_close_reader(reader);
+    delete reader;
+}
+
+
+
+BC_API bc_probe *bc_probe_create(const int *xy, int n)
+{
+    ProbeSet *probe = new ProbeSet;
+    if (!probe_create(probe, xy, n)) {
+        probe_free(probe);
+        delete probe;
+        return NULL;
+    }
+    return (bc_probe*) probe;
+}
+
+
+BC_API int bc_probe_read(bc_probe *probe, unsigned int *colors)
+{
+    return probe_read((ProbeSet*) probe, colors);
+}
+
+
+BC_API void bc_probe_free(bc_probe *probe)
+{
+    ProbeSet *set = (ProbeSet*) probe;
+    probe_free(set);
+    delete set;
+}
+
+} // extern "C"
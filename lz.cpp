@@ -0,0 +1,193 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  A small, fast LZ77 compressor producing the LZ4 block format: greedy
+  matching through a single hash table, no entropy coding.  Screen
+  contents are full of repeated runs, so this is enough to shrink them
+  several times over at memory-copy speeds.
+
+=============================================================================*/
+
+// c includes
+#include <string.h>
+
+
+// size of the match-finding hash table (log2)
+const int g_lz_hash_bits = 14;
+
+// the format keeps the last bytes of a block as literals
+const int g_lz_min_match = 4;
+const int g_lz_last_literals = 5;
+const int g_lz_match_limit = 12;
+
+
+// Largest possible compressed size of 'size' bytes
+int lz_bound(int size)
+{
+    return size + size / 255 + 16;
+}
+
+
+inline unsigned int lz_read32(const unsigned char *p)
+{
+    unsigned int v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+
+inline unsigned char *lz_write_length(unsigned char *op, int len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char) len;
+    return op;
+}
+
+
+// Compress 'size' bytes of 'src' into 'dst', which must hold
+// lz_bound(size) bytes.  Returns the compressed size.
+int lz_compress(const unsigned char *src, int size, unsigned char *dst)
+{
+    static const int hash_size = 1 << g_lz_hash_bits;
+    int table[hash_size];
+    memset(table, 0xff, sizeof(table));
+
+    const unsigned char *ip = src;
+    const unsigned char *anchor = src;
+    const unsigned char *end = src + size;
+    const unsigned char *match_limit = end - g_lz_match_limit;
+    const unsigned char *copy_limit = end - g_lz_last_literals;
+    unsigned char *op = dst;
+
+    if (size > g_lz_match_limit) {
+        while (ip < match_limit) {
+            unsigned int seq = lz_read32(ip);
+            unsigned int h = (seq * 2654435761u) >> (32 - g_lz_hash_bits);
+            int ref = table[h];
+            int pos = ip - src;
+            table[h] = pos;
+
+            if (ref < 0 || pos - ref > 0xffff ||
+                lz_read32(src + ref) != seq) {
+                // skip faster through data that does not compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            // extend the match backwards and forwards
+            const unsigned char *match = src + ref;
+            while (ip > anchor && match > src && ip[-1] == match[-1]) {
+                ip--;
+                match--;
+            }
+            const unsigned char *p = ip + g_lz_min_match;
+            const unsigned char *q = match + g_lz_min_match;
+            while (p < copy_limit && *p == *q) {
+                p++;
+                q++;
+            }
+
+            // token: literal length and match length nibbles
+            int lit_len = ip - anchor;
+            int match_len = p - ip - g_lz_min_match;
+            unsigned char *token = op++;
+            *token = (unsigned char) (((lit_len < 15 ? lit_len : 15) << 4) |
+                                      (match_len < 15 ? match_len : 15));
+            if (lit_len >= 15)
+                op = lz_write_length(op, lit_len - 15);
+            memcpy(op, anchor, lit_len);
+            op += lit_len;
+
+            // offset and remaining match length
+            int offset = ip - match;
+            *op++ = (unsigned char) (offset & 0xff);
+            *op++ = (unsigned char) (offset >> 8);
+            if (match_len >= 15)
+                op = lz_write_length(op, match_len - 15);
+
+            ip = anchor = p;
+        }
+    }
+
+    // trailing literals
+    int lit_len = end - anchor;
+    *op++ = (unsigned char) ((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15)
+        op = lz_write_length(op, lit_len - 15);
+    memcpy(op, anchor, lit_len);
+    op += lit_len;
+
+    return op - dst;
+}
+
+
+// Decompress 'size' bytes of 'src' into 'dst', which holds 'dst_size'
+// bytes.  Returns the decompressed size or -1 if the data is corrupt.
+int lz_decompress(const unsigned char *src, int size,
+                  unsigned char *dst, int dst_size)
+{
+    const unsigned char *ip = src;
+    const unsigned char *end = src + size;
+    unsigned char *op = dst;
+    unsigned char *op_end = dst + dst_size;
+
+    while (ip < end) {
+        int token = *ip++;
+
+        // literals
+        int len = token >> 4;
+        if (len == 15) {
+            int b;
+            do {
+                if (ip >= end)
+                    return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if (len > end - ip || len > op_end - op)
+            return -1;
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+
+        // the last sequence has no match
+        if (ip >= end)
+            break;
+
+        // match
+        if (end - ip < 2)
+            return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - dst)
+            return -1;
+
+        len = (token & 15);
+        if (len == 15) {
+            int b;
+            do {
+                if (ip >= end)
+                    return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += g_lz_min_match;
+        if (len > op_end - op)
+            return -1;
+
+        // matches may overlap their own output
+        const unsigned char *match = op - offset;
+        for (int i=0; i<len; i++)
+            op[i] = match[i];
+        op += len;
+    }
+
+    return op - dst;
+}
@@ -0,0 +1,151 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Ignore masks: regions of a capture (clocks, cursors, spinners) that
+  comparisons and change detection should not look at.
+
+  A mask is a frame the size of the capture holding one word per pixel:
+  0x00ffffff where the pixel counts and 0 where it is ignored.  Kernels
+  AND their per-pixel differences with it in place of the constant that
+  drops the unused fourth byte, so a masked pass costs one extra load.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <string.h>
+#include <immintrin.h>
+
+// windows includes
+#include <windows.h>
+
+#include <vector>
+
+
+// mask word of a pixel that is compared
+const unsigned int g_mask_keep = 0x00ffffff;
+
+
+// Build the mask of the capture rectangle (x,y)-(x2,y2).  'ignore' holds
+// screen rectangles to leave out; 'image' (may be NULL) is a picture of
+// the capture's size whose black pixels are left out as well.
+bool mask_create(Frame *mask, int x, int y, int x2, int y2,
+                 const std::vector<RECT> &ignore, const char *image)
+{
+    int width = x2 - x;
+    int height = y2 - y;
+    if (!frame_create(mask, x, y, width, height))
+        return false;
+
+    for (int j=0; j<height; j++) {
+        unsigned int *row = (unsigned int*) (mask->pixels + j * mask->stride);
+        for (int i=0; i<width; i++)
+            row[i] = g_mask_keep;
+    }
+
+    for (unsigned int k=0; k<ignore.size(); k++) {
+        RECT r;
+        RECT capture = {x, y, x2, y2};
+        if (!IntersectRect(&r, &ignore[k], &capture))
+            continue;
+        for (int j=r.top; j<r.bottom; j++)
+            memset(mask->pixels + (j - y) * mask->stride + (r.left - x) * 4,
+                   0, (r.right - r.left) * 4);
+    }
+
+    if (image) {
+        Frame picture;
+        if (!load_image_file(image, &picture)) {
+            frame_free(mask);
+            return false;
+        }
+        if (picture.width != width || picture.height != height) {
+            printf("error: mask '%s' is %dx%d but the capture is %dx%d\n",
+                   image, picture.width, picture.height, width, height);
+            frame_free(&picture);
+            frame_free(mask);
+            return false;
+        }
+        for (int j=0; j<height; j++) {
+            unsigned int *row = (unsigned int*) (mask->pixels +
+                                                 j * mask->stride);
+            const unsigned int *p = (const unsigned int*) (picture.pixels +
+                                                           j * picture.stride);
+            for (int i=0; i<width; i++)
+                if ((p[i] & g_mask_keep) == 0)
+                    row[i] = 0;
+        }
+        frame_free(&picture);
+    }
+
+    return true;
+}
+
+
+// Number of pixels a mask keeps
+long long mask_count(const Frame *mask)
+{
+    long long count = 0;
+    for (int j=0; j<mask->height; j++) {
+        const unsigned int *row = (const unsigned int*) (mask->pixels +
+                                                         j * mask->stride);
+        for (int i=0; i<mask->width; i++)
+            count += row[i] != 0;
+    }
+    return count;
+}
+
+
+// Row 'y' of 'mask', or NULL if there is no mask
+inline const unsigned int *mask_row(const Frame *mask, int y)
+{
+    return mask ? (const unsigned int*) (mask->pixels + y * mask->stride) :
+        NULL;
+}
+
+
+// AND bytes [start, count) of a row of one byte per pixel (such as gray
+// values) with the low byte of each mask word, zeroing ignored pixels
+typedef void (*MaskBytesFunc)(const unsigned int *mask, unsigned char *row,
+                              int start, int count);
+
+
+void mask_bytes_c(const unsigned int *mask, unsigned char *row, int start,
+                  int count)
+{
+    for (int i=start; i<count; i++)
+        row[i] &= (unsigned char) mask[i];
+}
+
+
+TARGET_SSE2
+void mask_bytes_sse2(const unsigned int *mask, unsigned char *row,
+                     int start, int count)
+{
+    // mask words become 0xff or 0 bytes: keep the low byte, then pack
+    const __m128i low = _mm_set1_epi32(0xff);
+    int i = start;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i *m = (const __m128i*) (mask + i);
+        __m128i a = _mm_packs_epi32(
+            _mm_and_si128(_mm_loadu_si128(m), low),
+            _mm_and_si128(_mm_loadu_si128(m + 1), low));
+        __m128i b = _mm_packs_epi32(
+            _mm_and_si128(_mm_loadu_si128(m + 2), low),
+            _mm_and_si128(_mm_loadu_si128(m + 3), low));
+        __m128i *p = (__m128i*) (row + i);
+        _mm_storeu_si128(p, _mm_and_si128(_mm_loadu_si128(p),
+                                          _mm_packus_epi16(a, b)));
+    }
+    mask_bytes_c(mask, row, i, count);
+}
+
+
+MaskBytesFunc mask_bytes_func()
+{
+    if (cpu_features() & CPU_SSE2)
+        return mask_bytes_sse2;
+    return mask_bytes_c;
+}
@@ -0,0 +1,131 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Motion search: how far a region of the screen moved between two frames,
+  as when a page scrolls.
+
+  Each row (or column) of the region is hashed once per frame.  The
+  offset is that of the longest run of rows whose hashes match at one
+  offset.  Runs are anchored on rows whose hash occurs only once in the
+  previous frame (blank rows match anywhere) and then followed row by
+  row, so the search is linear in the height.
+
+=============================================================================*/
+
+// c includes
+#include <string.h>
+
+#include <vector>
+
+
+// the unused fourth byte of a pixel is not hashed
+const unsigned long long g_motion_keep = 0x00ffffff00ffffffull;
+
+
+// Hash rows [y0, y1) of a frame's pixels over columns [x0, x1), two
+// pixels at a time
+void motion_row_hashes(const unsigned char *pixels, int stride,
+                       int x0, int x1, int y0, int y1,
+                       std::vector<unsigned long long> *hashes)
+{
+    hashes->resize(y1 - y0);
+    for (int y=y0; y<y1; y++) {
+        const unsigned char *row = pixels + y * stride;
+        unsigned long long h = g_fnv_basis;
+        int x = x0;
+        for (; x + 2 <= x1; x += 2) {
+            unsigned long long p;
+            memcpy(&p, row + x*4, 8);
+            h = (h ^ (p & g_motion_keep)) * g_fnv_prime;
+            h ^= h >> 29;
+        }
+        if (x < x1)
+            h = (h ^ (*(const unsigned int*) (row + x*4) & 0x00ffffff)) *
+                g_fnv_prime;
+        (*hashes)[y - y0] = h;
+    }
+}
+
+
+// Hash columns [x0, x1) of a frame's pixels over rows [y0, y1).  The
+// rows are walked in memory order, one hash per column.
+void motion_col_hashes(const unsigned char *pixels, int stride,
+                       int x0, int x1, int y0, int y1,
+                       std::vector<unsigned long long> *hashes)
+{
+    hashes->assign(x1 - x0, g_fnv_basis);
+    if (x1 <= x0)
+        return;
+    unsigned long long *h = &(*hashes)[0];
+    for (int y=y0; y<y1; y++) {
+        const unsigned int *row = (const unsigned int*) (pixels + y * stride);
+        for (int x=x0; x<x1; x++)
+            h[x - x0] = (h[x - x0] ^ (row[x] & 0x00ffffff)) * g_fnv_prime;
+    }
+}
+
+
+// Slot of hash 'h' in an open-addressed table: the slot holding it, or
+// the empty slot (row -1) where it would go
+int motion_slot(const std::vector<unsigned long long> &keys,
+                const std::vector<int> &rows, unsigned long long h)
+{
+    int mask = rows.size() - 1;
+    int s = (int) ((h * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+    while (rows[s] != -1 && keys[s] != h)
+        s = (s + 1) & mask;
+    return s;
+}
+
+
+// Find how far the rows [top, bottom) moved between two frames' hashes:
+// the offset d != 0 (d > 0 only, unless 'both_ways') for which the
+// longest run of rows i of 'cur' match row i + d of 'prev'.  The run is
+// rows [*start, *start + *length) of 'cur'.  Returns 0 if no run reaches
+// 'min_run' rows.
+int motion_offset(const std::vector<unsigned long long> &prev,
+                  const std::vector<unsigned long long> &cur,
+                  int top, int bottom, int min_run, bool both_ways,
+                  int *start, int *length)
+{
+    // prev's rows by hash: the row if its hash is unique in [top, bottom),
+    // -2 if it repeats
+    int size = 1;
+    while (size < 2 * (bottom - top))
+        size <<= 1;
+    std::vector<unsigned long long> keys(size);
+    std::vector<int> rows(size, -1);
+    for (int j=top; j<bottom; j++) {
+        int s = motion_slot(keys, rows, prev[j]);
+        keys[s] = prev[j];
+        rows[s] = rows[s] == -1 ? j : -2;
+    }
+
+    int best = 0, best_run = 0, best_start = 0;
+    int d = 0, run = 0;
+    for (int i=top; i<=bottom; i++) {
+        if (i < bottom && run > 0 && i + d >= top && i + d < bottom &&
+            cur[i] == prev[i + d]) {
+            run++;
+            continue;
+        }
+        if ((d > 0 || (d < 0 && both_ways)) && run > best_run) {
+            best = d;
+            best_run = run;
+            best_start = i - run;
+        }
+        if (i == bottom)
+            break;
+
+        // anchor a new run on a unique row
+        int row = rows[motion_slot(keys, rows, cur[i])];
+        run = row >= 0 ? 1 : 0;
+        d = row >= 0 ? row - i : 0;
+    }
+
+    *start = best_start;
+    *length = best_run;
+    return best_run >= min_run ? best : 0;
+}
@@ -0,0 +1,541 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Perceptual hashes: 64-bit fingerprints of a frame that stay close (in
+  Hamming distance) when the picture changes only a little, and an index
+  file of them that can be searched for near matches.
+
+  Both hashes start from the frame's luma averaged down to a small grid,
+  in one pass over the frame.  The pHash keeps the signs (against their
+  median) of the 8x8 lowest frequencies of a 32x32 DCT; the dHash keeps
+  the signs of the horizontal gradients of a 9x8 grid.
+
+  The index is a BK-tree kept in a file.  Each node is appended once and
+  hangs under the node it first differs from, in the slot of that node's
+  child table for their distance; a search reads only the nodes whose
+  slots the triangle inequality allows, not their siblings.
+
+  Several boxcutter processes may share an index: every open, add and
+  search holds a LockFileEx lock on the whole file (exclusive to write)
+  and rereads the header under it.  Offsets are 32-bit and stdio seeks
+  take a long, so an index stops growing at 2 GB (a few million
+  captures).
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <io.h>
+#include <immintrin.h>
+
+// windows includes
+#include <windows.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+
+// side of the luma grid the DCT is taken of
+const int g_phash_size = 32;
+
+// side of the block of low frequencies kept
+const int g_phash_low = 8;
+
+// Hamming distances between 64-bit hashes: 0 to 64
+const int g_phash_edges = 65;
+
+const char g_phash_magic[4] = {'B', 'X', 'P', 'H'};
+const unsigned int g_phash_version = 1;
+
+// largest index file: node offsets must fit in a long for fseek()
+const unsigned int g_phash_max_size = 0x7fffffff;
+
+
+struct PhashHeader
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int count;         // hashes in the index
+    unsigned int root;          // file offset of the root node, 0 if none
+};
+
+
+// A node of the index, followed in the file by its name
+struct PhashNode
+{
+    unsigned long long hash;
+    unsigned int name_size;
+    unsigned int children[g_phash_edges];  // file offset of the child at
+                                           // each distance, 0 if none
+};
+
+
+struct PhashIndex
+{
+    FILE *file;
+    PhashHeader header;
+    CRITICAL_SECTION lock;      // adds may come from several threads
+};
+
+
+// A hash of the index within the distance searched for
+struct PhashHit
+{
+    int distance;
+    unsigned long long hash;
+    std::string name;
+};
+
+
+inline int phash_distance(unsigned long long a, unsigned long long b)
+{
+    return __builtin_popcountll(a ^ b);
+}
+
+
+//=============================================================================
+// Hashing
+
+// Sum of the 'n' bytes at 'p'
+typedef unsigned int (*PhashSumFunc)(const unsigned char *p, int n);
+
+
+unsigned int phash_sum_c(const unsigned char *p, int n)
+{
+    unsigned int sum = 0;
+    for (int i=0; i<n; i++)
+        sum += p[i];
+    return sum;
+}
+
+
+TARGET_SSE2
+unsigned int phash_sum_sse2(const unsigned char *p, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(
+            _mm_loadu_si128((const __m128i*) (p + i)), zero));
+    acc = _mm_add_epi64(acc, _mm_srli_si128(acc, 8));
+    return _mm_cvtsi128_si32(acc) + phash_sum_c(p + i, n - i);
+}
+
+
+// Dot product of two 32-float vectors
+typedef float (*PhashDotFunc)(const float *a, const float *b);
+
+
+float phash_dot_c(const float *a, const float *b)
+{
+    float sum = 0.0f;
+    for (int i=0; i<g_phash_size; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+
+TARGET_SSE2
+float phash_dot_sse2(const float *a, const float *b)
+{
+    __m128 acc = _mm_setzero_ps();
+    for (int i=0; i<g_phash_size; i+=4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                         _mm_loadu_ps(b + i)));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+}
+
+
+// A grid of cells, each the average luma of a rectangle of the frame.
+// Cells are at least one pixel, so small frames repeat pixels.
+struct PhashGrid
+{
+    int cols, rows;
+    std::vector<int> x0, x1, y0, y1;
+    std::vector<float> cells;
+};
+
+
+void phash_grid_init(PhashGrid *grid, int cols, int rows, int width,
+                     int height)
+{
+    grid->cols = cols;
+    grid->rows = rows;
+    grid->x0.resize(cols);
+    grid->x1.resize(cols);
+    grid->y0.resize(rows);
+    grid->y1.resize(rows);
+    for (int c=0; c<cols; c++) {
+        grid->x0[c] = c * width / cols;
+        grid->x1[c] = std::max((c + 1) * width / cols, grid->x0[c] + 1);
+    }
+    for (int r=0; r<rows; r++) {
+        grid->y0[r] = r * height / rows;
+        grid->y1[r] = std::max((r + 1) * height / rows, grid->y0[r] + 1);
+    }
+    grid->cells.assign(cols * rows, 0.0f);
+}
+
+
+// Average the luma of 'frame' into each grid, reading the frame once.
+// Pixels that 'ignore' (may be NULL) masks count as black.
+void phash_shrink(const Frame *frame, const Frame *ignore,
+                  PhashGrid **grids, int ngrids)
+{
+    static GrayRowFunc gray_row = gray_row_func();
+    static MaskBytesFunc mask_bytes = mask_bytes_func();
+    static PhashSumFunc phash_sum = (cpu_features() & CPU_SSE2) ?
+        phash_sum_sse2 : phash_sum_c;
+
+    std::vector<unsigned char> gray(frame->width + 32);
+    for (int y=0; y<frame->height; y++) {
+        gray_row(frame->pixels + y * frame->stride, &gray[0], 0,
+                 frame->width);
+        if (ignore)
+            mask_bytes(mask_row(ignore, y), &gray[0], 0, frame->width);
+        for (int g=0; g<ngrids; g++) {
+            PhashGrid *grid = grids[g];
+            for (int r=0; r<grid->rows; r++) {
+                if (y < grid->y0[r] || y >= grid->y1[r])
+                    continue;
+                float *cells = &grid->cells[r * grid->cols];
+                for (int c=0; c<grid->cols; c++)
+                    cells[c] += phash_sum(&gray[grid->x0[c]],
+                                          grid->x1[c] - grid->x0[c]);
+            }
+        }
+    }
+
+    for (int g=0; g<ngrids; g++) {
+        PhashGrid *grid = grids[g];
+        for (int r=0; r<grid->rows; r++)
+            for (int c=0; c<grid->cols; c++)
+                grid->cells[r * grid->cols + c] /=
+                    (float) (grid->x1[c] - grid->x0[c]) *
+                    (grid->y1[r] - grid->y0[r]);
+    }
+}
+
+
+// Cosines of the DCT-II, one row of g_phash_size per frequency
+struct PhashBasis
+{
+    float cos[g_phash_low][g_phash_size];
+};
+
+
+PhashBasis phash_basis()
+{
+    PhashBasis basis;
+    for (int u=0; u<g_phash_low; u++)
+        for (int x=0; x<g_phash_size; x++)
+            basis.cos[u][x] = (float) cos((2*x + 1) * u * M_PI /
+                                          (2 * g_phash_size));
+    return basis;
+}
+
+
+// Compute the pHash and dHash of a frame.  The pixels masked by 'ignore'
+// (may be NULL, else the frame's size) are left out: they hash as black
+// whatever they show.
+void phash_frame(const Frame *frame, const Frame *ignore,
+                 unsigned long long *phash, unsigned long long *dhash)
+{
+    static PhashDotFunc phash_dot = (cpu_features() & CPU_SSE2) ?
+        phash_dot_sse2 : phash_dot_c;
+    static const PhashBasis basis = phash_basis();
+
+    PhashGrid dct_grid, grad_grid;
+    phash_grid_init(&dct_grid, g_phash_size, g_phash_size,
+                    frame->width, frame->height);
+    phash_grid_init(&grad_grid, 9, 8, frame->width, frame->height);
+    PhashGrid *grids[2] = {&dct_grid, &grad_grid};
+    phash_shrink(frame, ignore, grids, 2);
+
+    // the rows' low frequencies, transposed so that the columns' DCT
+    // reads them contiguously
+    float rows[g_phash_low][g_phash_size];
+    for (int y=0; y<g_phash_size; y++)
+        for (int u=0; u<g_phash_low; u++)
+            rows[u][y] = phash_dot(basis.cos[u],
+                                   &dct_grid.cells[y * g_phash_size]);
+
+    float coefs[g_phash_low * g_phash_low];
+    for (int v=0; v<g_phash_low; v++)
+        for (int u=0; u<g_phash_low; u++)
+            coefs[v * g_phash_low + u] = phash_dot(basis.cos[v], rows[u]);
+
+    float sorted[g_phash_low * g_phash_low];
+    memcpy(sorted, coefs, sizeof(coefs));
+    int mid = g_phash_low * g_phash_low / 2;
+    std::nth_element(sorted, sorted + mid, sorted + g_phash_low * g_phash_low);
+    float median = sorted[mid];
+
+    *phash = 0;
+    for (int i=0; i<g_phash_low * g_phash_low; i++)
+        *phash = (*phash << 1) | (coefs[i] > median);
+
+    *dhash = 0;
+    for (int r=0; r<8; r++)
+        for (int c=0; c<8; c++)
+            *dhash = (*dhash << 1) |
+                (grad_grid.cells[r * 9 + c + 1] >
+                 grad_grid.cells[r * 9 + c]);
+}
+
+
+//=============================================================================
+// Index file
+
+bool phash_read(PhashIndex *index, unsigned int offset, void *data,
+                int size)
+{
+    return fseek(index->file, offset, SEEK_SET) == 0 &&
+        fread(data, size, 1, index->file) == 1;
+}
+
+
+bool phash_write(PhashIndex *index, unsigned int offset, const void *data,
+                 int size)
+{
+    return fseek(index->file, offset, SEEK_SET) == 0 &&
+        fwrite(data, size, 1, index->file) == 1;
+}
+
+
+// Lock the whole index file against other processes: shared to read,
+// exclusive to write.  Blocks until the lock is granted.
+bool phash_lock(PhashIndex *index, bool exclusive)
+{
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    HANDLE file = (HANDLE) _get_osfhandle(_fileno(index->file));
+    return LockFileEx(file, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0,
+                      MAXDWORD, MAXDWORD, &overlapped) != 0;
+}
+
+
+void phash_unlock(PhashIndex *index)
+{
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    HANDLE file = (HANDLE) _get_osfhandle(_fileno(index->file));
+    UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &overlapped);
+}
+
+
+// Reread the header, which another process may have changed
+bool phash_read_header(PhashIndex *index)
+{
+    return phash_read(index, 0, &index->header, sizeof(PhashHeader)) &&
+        memcmp(index->header.magic, g_phash_magic, 4) == 0 &&
+        index->header.version == g_phash_version;
+}
+
+
+// Open the index 'filename'.  If 'write' is true, it is created when
+// missing and hashes can be added.
+bool phash_index_open(PhashIndex *index, const char *filename, bool write)
+{
+    // create a missing index without truncating one that another
+    // process has just created
+    if (write) {
+        FILE *file = fopen(filename, "ab");
+        if (file)
+            fclose(file);
+    }
+    index->file = fopen(filename, write ? "r+b" : "rb");
+    if (!index->file) {
+        printf("error: cannot open index '%s'\n", filename);
+        return false;
+    }
+
+    // other processes write the file: read it unbuffered, under the lock
+    setvbuf(index->file, NULL, _IONBF, 0);
+    if (!phash_lock(index, write)) {
+        printf("error: cannot lock index '%s'\n", filename);
+        fclose(index->file);
+        return false;
+    }
+
+    bool ret = true;
+    if (fseek(index->file, 0, SEEK_END) == 0 && ftell(index->file) == 0 &&
+        write) {
+        memcpy(index->header.magic, g_phash_magic, 4);
+        index->header.version = g_phash_version;
+        index->header.count = 0;
+        index->header.root = 0;
+        if (!phash_write(index, 0, &index->header, sizeof(PhashHeader)) ||
+            fflush(index->file) != 0) {
+            printf("error: cannot write index '%s'\n", filename);
+            ret = false;
+        }
+    } else if (!phash_read_header(index)) {
+        printf("error: '%s' is not a boxcutter index\n", filename);
+        ret = false;
+    }
+    phash_unlock(index);
+
+    if (!ret) {
+        fclose(index->file);
+        return false;
+    }
+    InitializeCriticalSection(&index->lock);
+    return true;
+}
+
+
+void phash_index_close(PhashIndex *index)
+{
+    fclose(index->file);
+    DeleteCriticalSection(&index->lock);
+}
+
+
+// Append 'hash' with the name 'name' to the tree.  The caller holds the
+// file's exclusive lock.
+bool phash_insert(PhashIndex *index, unsigned long long hash,
+                  const char *name)
+{
+    if (!phash_read_header(index) || fseek(index->file, 0, SEEK_END) != 0)
+        return false;
+    long end = ftell(index->file);
+
+    PhashNode node;
+    memset(&node, 0, sizeof(node));
+    node.hash = hash;
+    node.name_size = strlen(name);
+    if (end < 0 || (unsigned long long) end + sizeof(node) +
+        node.name_size > g_phash_max_size) {
+        printf("error: the index has reached its 2 GB limit\n");
+        return false;
+    }
+
+    // walk down to the node that has no child at our distance
+    unsigned int parent = index->header.root;
+    unsigned int link = 0;      // where that node's slot lives
+    while (parent) {
+        PhashNode p;
+        if (!phash_read(index, parent, &p, sizeof(p)))
+            return false;
+        int d = phash_distance(hash, p.hash);
+        if (!p.children[d]) {
+            link = parent + offsetof(PhashNode, children) +
+                d * sizeof(unsigned int);
+            break;
+        }
+        parent = p.children[d];
+    }
+
+    // write the node before linking it, so that a failed write leaves
+    // the tree as it was
+    if (!phash_write(index, end, &node, sizeof(node)) ||
+        !phash_write(index, end + sizeof(node), name, node.name_size))
+        return false;
+    if (link) {
+        unsigned int offset = end;
+        if (!phash_write(index, link, &offset, sizeof(offset)))
+            return false;
+    } else {
+        index->header.root = end;
+    }
+    index->header.count++;
+    return phash_write(index, 0, &index->header, sizeof(PhashHeader)) &&
+        fflush(index->file) == 0;
+}
+
+
+// Add 'hash' with the name 'name' to an index opened for writing
+bool phash_index_add(PhashIndex *index, unsigned long long hash,
+                     const char *name)
+{
+    EnterCriticalSection(&index->lock);
+    bool ret = phash_lock(index, true);
+    if (ret) {
+        ret = phash_insert(index, hash, name);
+        phash_unlock(index);
+    }
+    LeaveCriticalSection(&index->lock);
+    if (!ret)
+        printf("error: cannot add '%s' to the index\n", name);
+    return ret;
+}
+
+
+bool phash_hit_closer(const PhashHit &a, const PhashHit &b)
+{
+    return a.distance < b.distance;
+}
+
+
+// Find every hash of the index within 'max_distance' of 'hash', closest
+// first
+bool phash_index_search(PhashIndex *index, unsigned long long hash,
+                        int max_distance, std::vector<PhashHit> *hits)
+{
+    hits->clear();
+    std::vector<unsigned int> hit_offsets;
+    std::vector<unsigned int> stack;
+
+    EnterCriticalSection(&index->lock);
+    bool ret = phash_lock(index, false);
+    bool locked = ret;
+    if (ret && (ret = phash_read_header(index)) && index->header.root)
+        stack.push_back(index->header.root);
+    while (ret && !stack.empty()) {
+        unsigned int offset = stack.back();
+        stack.pop_back();
+        PhashNode node;
+        if (!(ret = phash_read(index, offset, &node, sizeof(node))))
+            break;
+
+        int d = phash_distance(hash, node.hash);
+        if (d <= max_distance) {
+            PhashHit hit;
+            hit.distance = d;
+            hit.hash = node.hash;
+            hits->push_back(hit);
+            hit_offsets.push_back(offset);
+        }
+
+        // only children at distances in [d - max, d + max] can be close
+        // enough
+        int lo = std::max(d - max_distance, 0);
+        int hi = std::min(d + max_distance, g_phash_edges - 1);
+        for (int e=lo; e<=hi; e++)
+            if (node.children[e])
+                stack.push_back(node.children[e]);
+    }
+
+    for (unsigned int i=0; ret && i<hits->size(); i++) {
+        PhashNode node;
+        ret = phash_read(index, hit_offsets[i], &node, sizeof(node));
+        if (ret) {
+            std::vector<char> name(node.name_size + 1);
+            ret = node.name_size == 0 ||
+                phash_read(index, hit_offsets[i] + sizeof(node), &name[0],
+                           node.name_size);
+            (*hits)[i].name = &name[0];
+        }
+    }
+    if (locked)
+        phash_unlock(index);
+    LeaveCriticalSection(&index->lock);
+
+    if (!ret) {
+        printf("error: cannot read the index\n");
+        return false;
+    }
+    std::stable_sort(hits->begin(), hits->end(), phash_hit_closer);
+    return true;
+}
@@ -79,6 +79,26 @@ int GetEncoderClsid(const WCHAR* format, CLSID* pClsid)
   return -1;  // Failure
 }
 
+// GDI+ session held open while several threads save images.  Nested
+// GdiplusStartup() calls from save_png_file() then only adjust the
+// reference count.
+ULONG_PTR g_gdiplus_token = 0;
+
+void png_startup()
+{
+    GdiplusStartupInput gdiplusStartupInput;
+    if (!g_gdiplus_token)
+        GdiplusStartup(&g_gdiplus_token, &gdiplusStartupInput, NULL);
+}
+
+void png_shutdown()
+{
+    if (g_gdiplus_token) {
+        GdiplusShutdown(g_gdiplus_token);
+        g_gdiplus_token = 0;
+    }
+}
+
 bool save_png_file(HBITMAP hBmp, HDC hDC, const char *filename)
 {
     GdiplusStartupInput gdiplusStartupInput;
@@ -105,6 +125,92 @@ bool save_png_file(HBITMAP hBmp, HDC hDC, const char *filename)
     return stat == Ok;
 }
 
+// Encode a bitmap as PNG into memory.  '*data' is allocated with malloc().
+bool encode_png_memory(HBITMAP hBmp, unsigned char **data, int *size)
+{
+    GdiplusStartupInput gdiplusStartupInput;
+    ULONG_PTR gdiplusToken;
+    GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
+
+    IStream *stream = NULL;
+    Bitmap* b = Bitmap::FromHBITMAP(hBmp, NULL);
+    
+    CLSID  encoderClsid;
+    Status stat = GenericError;
+    if (b && GetEncoderClsid(L"image/png", &encoderClsid) != -1 &&
+        CreateStreamOnHGlobal(NULL, TRUE, &stream) == S_OK) {
+        stat = b->Save(stream, &encoderClsid, NULL);
+    }
+    if (b)
+        delete b;
+
+    *data = NULL;
+    *size = 0;
+    if (stat == Ok) {
+        // the stream position is the encoded size
+        LARGE_INTEGER zero;
+        ULARGE_INTEGER pos;
+        HGLOBAL hglobal;
+        zero.QuadPart = 0;
+        if (stream->Seek(zero, STREAM_SEEK_CUR, &pos) == S_OK &&
+            GetHGlobalFromStream(stream, &hglobal) == S_OK) {
+            *size = (int) pos.QuadPart;
+            *data = (unsigned char*) malloc(*size);
+            memcpy(*data, GlobalLock(hglobal), *size);
+            GlobalUnlock(hglobal);
+        } else {
+            stat = GenericError;
+        }
+    }
+    if (stream)
+        stream->Release();
+  
+    // cleanup
+    GdiplusShutdown(gdiplusToken);
+    return stat == Ok;
+}
+
+// Load a PNG, BMP, or other image GDI+ can read into a new frame
+bool load_image_file(const char *filename, Frame *frame)
+{
+    GdiplusStartupInput gdiplusStartupInput;
+    ULONG_PTR gdiplusToken;
+    GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
+
+    int len = strlen(filename);
+    WCHAR* wfilename = new WCHAR[len+1];
+    MultiByteToWideChar(CP_ACP, 0, filename, len+1, wfilename, len+1);
+    Bitmap* b = Bitmap::FromFile(wfilename);
+    delete [] wfilename;
+
+    bool ret = false;
+    if (b && b->GetLastStatus() == Ok &&
+        frame_create(frame, 0, 0, b->GetWidth(), b->GetHeight())) {
+        // convert straight into the frame's rows
+        Rect rect(0, 0, frame->width, frame->height);
+        BitmapData data;
+        data.Width = frame->width;
+        data.Height = frame->height;
+        data.Stride = frame->stride;
+        data.PixelFormat = PixelFormat32bppRGB;
+        data.Scan0 = frame->pixels;
+        data.Reserved = 0;
+        ret = b->LockBits(&rect, ImageLockModeRead | ImageLockModeUserInputBuf,
+                          PixelFormat32bppRGB, &data) == Ok &&
+            b->UnlockBits(&data) == Ok;
+        if (!ret)
+            frame_free(frame);
+    }
+    if (b)
+        delete b;
+    if (!ret)
+        printf("error: cannot load image '%s'\n", filename);
+
+    // cleanup
+    GdiplusShutdown(gdiplusToken);
+    return ret;
+}
+
 /*
 OLD CODE for stand-alone version
 
@@ -0,0 +1,163 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  A small pool of worker threads for running independent tasks (such as
+  encoding several screenshots) on all cores.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+
+#include <deque>
+
+// windows includes
+#include <windows.h>
+
+
+typedef void (*TaskFunc)(void *arg);
+
+struct Task
+{
+    TaskFunc func;
+    void *arg;
+};
+
+struct ThreadPool
+{
+    HANDLE *threads;
+    int nthreads;
+    std::deque<Task> queue;     // tasks waiting for a worker
+    int pending;                // tasks queued or running
+    bool stop;
+    CRITICAL_SECTION lock;      // protects queue, pending, stop
+    HANDLE work_sem;            // counts queued tasks
+    HANDLE idle_event;          // set when pending drops to zero
+};
+
+
+// Number of processors available to this process
+int get_num_cpus()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+
+// Worker thread: run tasks until the pool stops
+DWORD WINAPI pool_worker(LPVOID param)
+{
+    ThreadPool *pool = (ThreadPool*) param;
+
+    while (true) {
+        WaitForSingleObject(pool->work_sem, INFINITE);
+
+        EnterCriticalSection(&pool->lock);
+        if (pool->queue.empty()) {
+            // woken up by pool_free()
+            bool stop = pool->stop;
+            LeaveCriticalSection(&pool->lock);
+            if (stop)
+                break;
+            continue;
+        }
+        Task task = pool->queue.front();
+        pool->queue.pop_front();
+        LeaveCriticalSection(&pool->lock);
+
+        task.func(task.arg);
+
+        EnterCriticalSection(&pool->lock);
+        if (--pool->pending == 0)
+            SetEvent(pool->idle_event);
+        LeaveCriticalSection(&pool->lock);
+    }
+
+    return 0;
+}
+
+
+// Start a pool of 'nthreads' workers (one per processor if nthreads <= 0)
+bool pool_init(ThreadPool *pool, int nthreads)
+{
+    if (nthreads <= 0)
+        nthreads = get_num_cpus();
+
+    pool->nthreads = 0;
+    pool->pending = 0;
+    pool->stop = false;
+    InitializeCriticalSection(&pool->lock);
+    pool->work_sem = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+    pool->idle_event = CreateEvent(NULL, TRUE, TRUE, NULL);
+    pool->threads = new HANDLE [nthreads];
+
+    // fewer workers than asked for is fine, none is not
+    for (int i=0; i<nthreads && pool->work_sem && pool->idle_event; i++) {
+        HANDLE thread = CreateThread(NULL, 0, pool_worker, pool, 0, NULL);
+        if (!thread)
+            break;
+        pool->threads[pool->nthreads++] = thread;
+    }
+
+    if (pool->nthreads == 0) {
+        printf("error: cannot start worker threads\n");
+        if (pool->work_sem)
+            CloseHandle(pool->work_sem);
+        if (pool->idle_event)
+            CloseHandle(pool->idle_event);
+        delete [] pool->threads;
+        pool->threads = NULL;
+        DeleteCriticalSection(&pool->lock);
+        return false;
+    }
+    return true;
+}
+
+
+// Queue a task to be run by the next free worker
+void pool_add(ThreadPool *pool, TaskFunc func, void *arg)
+{
+    Task task;
+    task.func = func;
+    task.arg = arg;
+
+    EnterCriticalSection(&pool->lock);
+    pool->queue.push_back(task);
+    if (pool->pending++ == 0)
+        ResetEvent(pool->idle_event);
+    LeaveCriticalSection(&pool->lock);
+
+    ReleaseSemaphore(pool->work_sem, 1, NULL);
+}
+
+
+// Block until every queued task has finished
+void pool_wait(ThreadPool *pool)
+{
+    WaitForSingleObject(pool->idle_event, INFINITE);
+}
+
+
+// Finish all queued tasks and stop the workers
+void pool_free(ThreadPool *pool)
+{
+    pool_wait(pool);
+
+    EnterCriticalSection(&pool->lock);
+    pool->stop = true;
+    LeaveCriticalSection(&pool->lock);
+    ReleaseSemaphore(pool->work_sem, pool->nthreads, NULL);
+
+    for (int i=0; i<pool->nthreads; i++) {
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+    }
+    delete [] pool->threads;
+
+    CloseHandle(pool->work_sem);
+    CloseHandle(pool->idle_event);
+    DeleteCriticalSection(&pool->lock);
+}
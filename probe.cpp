@@ -0,0 +1,162 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Pixel probes: read the colors of a fixed set of screen points without
+  capturing the whole screen.
+
+  Nearby points are grouped into clusters, and only each cluster's
+  bounding rectangle is copied, into its own band of one small bitmap
+  that is kept between reads.  A read is then one BitBlt per cluster.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <string.h>
+
+// windows includes
+#include <windows.h>
+
+#include <vector>
+
+
+// two clusters are merged if their joint bounding rectangle holds at most
+// this many pixels more than their own rectangles
+const int g_probe_merge_area = 4096;
+
+
+struct ProbeSet
+{
+    std::vector<POINT> points;
+    std::vector<RECT> clusters;     // screen rectangles to copy
+    std::vector<int> bands;         // row of 'atlas' each cluster starts at
+    std::vector<int> offsets;       // byte offset of each point in 'atlas'
+    Frame atlas;                    // the clusters, top to bottom
+    HDC screen_dc;
+};
+
+
+int probe_area(const RECT *r)
+{
+    return (r->right - r->left) * (r->bottom - r->top);
+}
+
+
+// Group the points into as few rectangles as merging allows
+void probe_cluster(ProbeSet *probe)
+{
+    std::vector<RECT> &clusters = probe->clusters;
+    clusters.clear();
+    for (unsigned int i=0; i<probe->points.size(); i++) {
+        RECT r;
+        SetRect(&r, probe->points[i].x, probe->points[i].y,
+                probe->points[i].x + 1, probe->points[i].y + 1);
+        clusters.push_back(r);
+    }
+
+    // merge the cheapest pair until no pair is cheap enough
+    while (true) {
+        int best_cost = g_probe_merge_area + 1;
+        int best_a = -1, best_b = -1;
+        RECT best;
+        for (unsigned int a=0; a<clusters.size(); a++) {
+            for (unsigned int b=a+1; b<clusters.size(); b++) {
+                RECT u;
+                UnionRect(&u, &clusters[a], &clusters[b]);
+                int cost = probe_area(&u) - probe_area(&clusters[a]) -
+                    probe_area(&clusters[b]);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_a = a;
+                    best_b = b;
+                    best = u;
+                }
+            }
+        }
+        if (best_a < 0)
+            break;
+        clusters[best_a] = best;
+        clusters.erase(clusters.begin() + best_b);
+    }
+}
+
+
+// Prepare to read the 'n' points (xy[2*i], xy[2*i+1])
+bool probe_create(ProbeSet *probe, const int *xy, int n)
+{
+    frame_init(&probe->atlas);
+    probe->screen_dc = NULL;
+    if (n <= 0) {
+        printf("error: no points to probe\n");
+        return false;
+    }
+
+    probe->points.resize(n);
+    for (int i=0; i<n; i++) {
+        probe->points[i].x = xy[2*i];
+        probe->points[i].y = xy[2*i+1];
+    }
+    probe_cluster(probe);
+
+    // stack the clusters in one bitmap
+    int width = 0, height = 0;
+    probe->bands.clear();
+    for (unsigned int i=0; i<probe->clusters.size(); i++) {
+        const RECT &r = probe->clusters[i];
+        probe->bands.push_back(height);
+        height += r.bottom - r.top;
+        if (r.right - r.left > width)
+            width = r.right - r.left;
+    }
+    if (!frame_create(&probe->atlas, 0, 0, width, height))
+        return false;
+
+    probe->offsets.resize(n);
+    for (int i=0; i<n; i++) {
+        const POINT &p = probe->points[i];
+        for (unsigned int c=0; c<probe->clusters.size(); c++) {
+            const RECT &r = probe->clusters[c];
+            if (p.x >= r.left && p.x < r.right &&
+                p.y >= r.top && p.y < r.bottom) {
+                probe->offsets[i] = (probe->bands[c] + p.y - r.top) *
+                    probe->atlas.stride + (p.x - r.left) * 4;
+                break;
+            }
+        }
+    }
+
+    probe->screen_dc = GetDC(0);
+    return true;
+}
+
+
+// Read the current colors of the points into 'colors' as 0xRRGGBB
+bool probe_read(ProbeSet *probe, unsigned int *colors)
+{
+    for (unsigned int c=0; c<probe->clusters.size(); c++) {
+        const RECT &r = probe->clusters[c];
+        if (!BitBlt(probe->atlas.dc, 0, probe->bands[c],
+                    r.right - r.left, r.bottom - r.top,
+                    probe->screen_dc, r.left, r.top, SRCCOPY)) {
+            printf("error: BitBlt failed\n");
+            return false;
+        }
+    }
+    GdiFlush();
+
+    for (unsigned int i=0; i<probe->points.size(); i++)
+        colors[i] = *(const unsigned int*) (probe->atlas.pixels +
+                                            probe->offsets[i]) & 0x00ffffff;
+    return true;
+}
+
+
+void probe_free(ProbeSet *probe)
+{
+    frame_free(&probe->atlas);
+    if (probe->screen_dc)
+        ReleaseDC(0, probe->screen_dc);
+    probe->screen_dc = NULL;
+}
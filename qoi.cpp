@@ -0,0 +1,120 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  QOI ("Quite OK Image") encoder.  Lossless like PNG but a single cheap
+  pass over the pixels, which suits streaming many frames.
+  Format: https://qoiformat.org/qoi-specification.pdf
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define QOI_OP_INDEX  0x00
+#define QOI_OP_DIFF   0x40
+#define QOI_OP_LUMA   0x80
+#define QOI_OP_RUN    0xc0
+#define QOI_OP_RGB    0xfe
+
+#define QOI_HASH(r, g, b) (((r) * 3 + (g) * 5 + (b) * 7 + 255 * 11) % 64)
+
+
+inline unsigned char *qoi_write32(unsigned char *p, unsigned int v)
+{
+    *p++ = (v >> 24) & 0xff;
+    *p++ = (v >> 16) & 0xff;
+    *p++ = (v >> 8) & 0xff;
+    *p++ = v & 0xff;
+    return p;
+}
+
+
+// Encode 32-bit BGRX pixels (top row first) as a 3-channel QOI image in
+// memory.  '*data' is allocated with malloc().
+bool encode_qoi_memory(const unsigned char *pixels, int width, int height,
+                       int stride, unsigned char **data, int *size)
+{
+    // worst case: one QOI_OP_RGB per pixel plus header and end marker
+    int max_size = 14 + width * height * 4 + 8;
+    unsigned char *out = (unsigned char*) malloc(max_size);
+    if (!out) {
+        printf("error: out of memory\n");
+        return false;
+    }
+
+    unsigned char *p = out;
+    memcpy(p, "qoif", 4);
+    p = qoi_write32(p + 4, width);
+    p = qoi_write32(p, height);
+    *p++ = 3;   // channels
+    *p++ = 0;   // sRGB
+
+    unsigned int index[64];
+    memset(index, 0, sizeof(index));
+    unsigned int prev = 0;  // r, g, b = 0
+    int run = 0;
+
+    for (int y=0; y<height; y++) {
+        const unsigned char *row = pixels + y * stride;
+        for (int x=0; x<width; x++) {
+            int b = row[x*4], g = row[x*4+1], r = row[x*4+2];
+            unsigned int px = (r << 16) | (g << 8) | b;
+
+            if (px == prev) {
+                if (++run == 62) {
+                    *p++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            int h = QOI_HASH(r, g, b);
+            if (index[h] == (px | 0xff000000u)) {
+                *p++ = QOI_OP_INDEX | h;
+            } else {
+                index[h] = px | 0xff000000u;
+
+                signed char vr = (signed char) (r - ((prev >> 16) & 0xff));
+                signed char vg = (signed char) (g - ((prev >> 8) & 0xff));
+                signed char vb = (signed char) (b - (prev & 0xff));
+                signed char vg_r = vr - vg;
+                signed char vg_b = vb - vg;
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 &&
+                    vb > -3 && vb < 2) {
+                    *p++ = QOI_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) |
+                        (vb + 2);
+                } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 &&
+                           vg_b > -9 && vg_b < 8) {
+                    *p++ = QOI_OP_LUMA | (vg + 32);
+                    *p++ = ((vg_r + 8) << 4) | (vg_b + 8);
+                } else {
+                    *p++ = QOI_OP_RGB;
+                    *p++ = r;
+                    *p++ = g;
+                    *p++ = b;
+                }
+            }
+            prev = px;
+        }
+    }
+    if (run > 0)
+        *p++ = QOI_OP_RUN | (run - 1);
+
+    // end marker
+    memcpy(p, "\0\0\0\0\0\0\0\1", 8);
+    p += 8;
+
+    *data = out;
+    *size = p - out;
+    return true;
+}
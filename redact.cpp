@@ -0,0 +1,492 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Redaction: cover parts of the screen (passwords, personal data) in every
+  capture before anything else reads the pixels.
+
+  Each redaction is a screen rectangle, or the rectangle of a window
+  looked up again for every capture, with one effect:
+
+    fill        a solid color
+    pixelate    blocks of N x N pixels replaced by their mean
+    blur        a box blur of radius R, across then down
+
+  Redactions are applied by the frame filter (frame.cpp) right after the
+  pixels are copied from the screen, so encoders, sinks, comparisons and
+  shared memory only ever see the covered pixels.  Only the pixels inside
+  the rectangles are read or written.  A window is looked up both before
+  and after the copy, and the union of its two rectangles is covered, so
+  a window moving during the copy is not missed.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+// windows includes
+#include <windows.h>
+
+#include <vector>
+#include <algorithm>
+
+
+enum {
+    REDACT_FILL,
+    REDACT_PIXELATE,
+    REDACT_BLUR
+};
+
+// default block size and radius
+const int g_redact_block = 16;
+const int g_redact_radius = 12;
+
+// largest block size and radius
+const int g_redact_max_size = 256;
+
+
+// One region to cover
+struct Redaction
+{
+    RECT rect;              // screen coordinates, unless 'hwnd' is set
+    HWND hwnd;              // window whose rectangle is covered, or NULL
+    int effect;
+    unsigned int color;     // REDACT_FILL: 0xRRGGBB
+    int size;               // REDACT_PIXELATE: block size, REDACT_BLUR: radius
+};
+
+
+// the redactions applied to every capture
+std::vector<Redaction> g_redactions;
+
+
+// Parse an effect: 'fill[=RRGGBB]', 'pixelate[=N]', or 'blur[=R]'
+bool redact_parse_effect(const char *text, Redaction *redaction)
+{
+    char extra;
+    const char *end;
+    redaction->color = 0;
+    redaction->size = 0;
+    if (strcmp(text, "fill") == 0 ||
+        (strncmp(text, "fill=", 5) == 0 &&
+         (end = color_parse(text + 5, &redaction->color)) && !*end)) {
+        redaction->effect = REDACT_FILL;
+        return true;
+    }
+
+    int size = -1;
+    if (strcmp(text, "pixelate") == 0 ||
+        sscanf(text, "pixelate=%d%c", &size, &extra) == 1) {
+        redaction->effect = REDACT_PIXELATE;
+        redaction->size = size < 0 ? g_redact_block : size;
+        return redaction->size >= 2 &&
+            redaction->size <= g_redact_max_size;
+    }
+    if (strcmp(text, "blur") == 0 ||
+        sscanf(text, "blur=%d%c", &size, &extra) == 1) {
+        redaction->effect = REDACT_BLUR;
+        redaction->size = size < 0 ? g_redact_radius : size;
+        return redaction->size >= 1 &&
+            redaction->size <= g_redact_max_size;
+    }
+    return false;
+}
+
+
+// Split 'SPEC[:EFFECT]' at its last ':' if what follows is an effect.
+// Without one the effect is a black fill.  Returns the length of SPEC.
+int redact_parse_spec(const char *text, Redaction *redaction)
+{
+    redaction->effect = REDACT_FILL;
+    redaction->color = 0;
+    redaction->size = 0;
+
+    const char *colon = strrchr(text, ':');
+    if (colon) {
+        Redaction effect;
+        if (redact_parse_effect(colon + 1, &effect)) {
+            redaction->effect = effect.effect;
+            redaction->color = effect.color;
+            redaction->size = effect.size;
+            return colon - text;
+        }
+    }
+    return strlen(text);
+}
+
+
+//=============================================================================
+// Fill
+
+// Set pixels [start, count) of a row to 'color'
+typedef void (*RedactFillFunc)(unsigned int *row, int start, int count,
+                               unsigned int color);
+
+
+void redact_fill_c(unsigned int *row, int start, int count,
+                   unsigned int color)
+{
+    for (int i=start; i<count; i++)
+        row[i] = color;
+}
+
+
+TARGET_SSE2
+void redact_fill_sse2(unsigned int *row, int start, int count,
+                      unsigned int color)
+{
+    const __m128i c = _mm_set1_epi32(color);
+    int i = start;
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*) (row + i), c);
+    redact_fill_c(row, i, count, color);
+}
+
+
+TARGET_AVX2
+void redact_fill_avx2(unsigned int *row, int start, int count,
+                      unsigned int color)
+{
+    const __m256i c = _mm256_set1_epi32(color);
+    int i = start;
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_si256((__m256i*) (row + i), c);
+    redact_fill_sse2(row, i, count, color);
+}
+
+
+RedactFillFunc redact_fill_func()
+{
+    int features = cpu_features();
+    if (features & CPU_AVX2)
+        return redact_fill_avx2;
+    if (features & CPU_SSE2)
+        return redact_fill_sse2;
+    return redact_fill_c;
+}
+
+
+// Fill the frame rectangle 'r' with 'color'
+void redact_fill_rect(Frame *frame, const RECT *r, unsigned int color)
+{
+    static RedactFillFunc redact_fill = redact_fill_func();
+
+    for (int y=r->top; y<r->bottom; y++)
+        redact_fill((unsigned int*) (frame->pixels + y * frame->stride) +
+                    r->left, 0, r->right - r->left, color & 0x00ffffff);
+}
+
+
+//=============================================================================
+// Pixelate
+
+// Replace the n x n blocks of the frame rectangle 'r' with their means.
+// Blocks start at the corner (ox, oy), so they stay in place when the
+// rectangle is clipped by the frame.
+void redact_pixelate(Frame *frame, const RECT *r, int ox, int oy, int n)
+{
+    static ThumbSumFunc sum_rows = thumb_sum_func();
+    static RedactFillFunc redact_fill = redact_fill_func();
+
+    int width = r->right - r->left;
+    std::vector<unsigned short> sums(width * 4);
+    std::vector<unsigned int> pattern(width);
+
+    int bx0 = r->left - (r->left - ox) % n;
+    for (int by=r->top - (r->top - oy) % n; by<r->bottom; by+=n) {
+        int y0 = std::max(by, (int) r->top);
+        int y1 = std::min(by + n, (int) r->bottom);
+
+        // n rows of at most 255 add up within 16 bits
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int y=y0; y<y1; y++)
+            sum_rows(frame->pixels + y * frame->stride + r->left * 4, 0,
+                     width * 4, &sums[0]);
+
+        // one row of block means, copied down the band
+        for (int bx=bx0; bx<r->right; bx+=n) {
+            int x0 = std::max(bx, (int) r->left) - r->left;
+            int x1 = std::min(bx + n, (int) r->right) - r->left;
+            unsigned int count = (x1 - x0) * (y1 - y0);
+            unsigned int color = 0;
+            for (int c=0; c<3; c++) {
+                unsigned int s = count / 2;
+                for (int x=x0; x<x1; x++)
+                    s += sums[x*4 + c];
+                color |= (s / count) << (c * 8);
+            }
+            redact_fill(&pattern[0], x0, x1, color);
+        }
+        for (int y=y0; y<y1; y++)
+            memcpy(frame->pixels + y * frame->stride + r->left * 4,
+                   &pattern[0], width * 4);
+    }
+}
+
+
+//=============================================================================
+// Blur
+
+// Box blur one row of 'count' pixels with radius 'r' into 'dst', the
+// edge pixels repeated.  'inv' is 1 / (2r + 1).
+typedef void (*RedactRowFunc)(const unsigned int *src, int count, int r,
+                              float inv, unsigned int *dst);
+
+// Write out = sums * inv for bytes [start, count) of a row, then move
+// the window down: sums += add - sub
+typedef void (*RedactColsFunc)(int *sums, const unsigned char *add,
+                               const unsigned char *sub, unsigned char *out,
+                               int start, int count, float inv);
+
+
+void redact_row_c(const unsigned int *src, int count, int r, float inv,
+                  unsigned int *dst)
+{
+    const unsigned char *p = (const unsigned char*) src;
+    int sum[4];
+    for (int c=0; c<4; c++) {
+        sum[c] = p[c] * (r + 1);
+        for (int i=1; i<=r; i++)
+            sum[c] += p[std::min(i, count - 1)*4 + c];
+    }
+
+    unsigned char *out = (unsigned char*) dst;
+    for (int x=0; x<count; x++) {
+        const unsigned char *add = p + std::min(x + r + 1, count - 1) * 4;
+        const unsigned char *sub = p + std::max(x - r, 0) * 4;
+        for (int c=0; c<4; c++) {
+            out[x*4 + c] = (unsigned char) (sum[c] * inv + 0.5f);
+            sum[c] += add[c] - sub[c];
+        }
+    }
+}
+
+
+// the four channels of a pixel as 32-bit lanes
+TARGET_SSE2
+inline __m128i redact_pixel_sse2(unsigned int pixel)
+{
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero), zero);
+}
+
+
+TARGET_SSE2
+void redact_row_sse2(const unsigned int *src, int count, int r, float inv,
+                     unsigned int *dst)
+{
+    // p * (r + 1) fits the low 16 bits of each lane
+    __m128i sum = _mm_mullo_epi16(redact_pixel_sse2(src[0]),
+                                  _mm_set1_epi32(r + 1));
+    for (int i=1; i<=r; i++)
+        sum = _mm_add_epi32(sum,
+                            redact_pixel_sse2(src[std::min(i, count - 1)]));
+
+    const __m128 scale = _mm_set1_ps(inv);
+    for (int x=0; x<count; x++) {
+        __m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+        v = _mm_packs_epi32(v, v);
+        dst[x] = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+        sum = _mm_add_epi32(sum, _mm_sub_epi32(
+            redact_pixel_sse2(src[std::min(x + r + 1, count - 1)]),
+            redact_pixel_sse2(src[std::max(x - r, 0)])));
+    }
+}
+
+
+RedactRowFunc redact_row_func()
+{
+    if (cpu_features() & CPU_SSE2)
+        return redact_row_sse2;
+    return redact_row_c;
+}
+
+
+void redact_cols_c(int *sums, const unsigned char *add,
+                   const unsigned char *sub, unsigned char *out,
+                   int start, int count, float inv)
+{
+    for (int i=start; i<count; i++) {
+        out[i] = (unsigned char) (sums[i] * inv + 0.5f);
+        sums[i] += add[i] - sub[i];
+    }
+}
+
+
+TARGET_SSE2
+void redact_cols_sse2(int *sums, const unsigned char *add,
+                      const unsigned char *sub, unsigned char *out,
+                      int start, int count, float inv)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(inv);
+    int i = start;
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (add + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (sub + i));
+        __m128i a16[2] = {_mm_unpacklo_epi8(a, zero),
+                          _mm_unpackhi_epi8(a, zero)};
+        __m128i b16[2] = {_mm_unpacklo_epi8(b, zero),
+                          _mm_unpackhi_epi8(b, zero)};
+        __m128i v[4];
+        for (int k=0; k<4; k++) {
+            __m128i *s = (__m128i*) (sums + i + k*4);
+            __m128i sum = _mm_loadu_si128(s);
+            v[k] = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+            __m128i da = (k & 1) ? _mm_unpackhi_epi16(a16[k/2], zero) :
+                _mm_unpacklo_epi16(a16[k/2], zero);
+            __m128i db = (k & 1) ? _mm_unpackhi_epi16(b16[k/2], zero) :
+                _mm_unpacklo_epi16(b16[k/2], zero);
+            _mm_storeu_si128(s, _mm_add_epi32(sum, _mm_sub_epi32(da, db)));
+        }
+        _mm_storeu_si128((__m128i*) (out + i),
+                         _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]),
+                                          _mm_packs_epi32(v[2], v[3])));
+    }
+    redact_cols_c(sums, add, sub, out, i, count, inv);
+}
+
+
+TARGET_AVX2
+void redact_cols_avx2(int *sums, const unsigned char *add,
+                      const unsigned char *sub, unsigned char *out,
+                      int start, int count, float inv)
+{
+    const __m256 scale = _mm256_set1_ps(inv);
+    int i = start;
+    for (; i + 8 <= count; i += 8) {
+        __m256i *s = (__m256i*) (sums + i);
+        __m256i sum = _mm256_loadu_si256(s);
+        __m256i v = _mm256_cvtps_epi32(
+            _mm256_mul_ps(_mm256_cvtepi32_ps(sum), scale));
+        __m256i a = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i*) (add + i)));
+        __m256i b = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i*) (sub + i)));
+        _mm256_storeu_si256(s, _mm256_add_epi32(sum,
+                                                _mm256_sub_epi32(a, b)));
+
+        __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(v),
+                                    _mm256_extracti128_si256(v, 1));
+        _mm_storel_epi64((__m128i*) (out + i), _mm_packus_epi16(w, w));
+    }
+    redact_cols_sse2(sums, add, sub, out, i, count, inv);
+}
+
+
+RedactColsFunc redact_cols_func()
+{
+    int features = cpu_features();
+    if (features & CPU_AVX2)
+        return redact_cols_avx2;
+    if (features & CPU_SSE2)
+        return redact_cols_sse2;
+    return redact_cols_c;
+}
+
+
+// Box blur the frame rectangle 'r' with radius 'radius': each row into a
+// copy, then the copy's columns back into the frame.  Pixels outside 'r'
+// are not read; the edge pixels are repeated instead.
+void redact_blur(Frame *frame, const RECT *r, int radius)
+{
+    static RedactRowFunc blur_row = redact_row_func();
+    static RedactColsFunc blur_cols = redact_cols_func();
+
+    int width = r->right - r->left, height = r->bottom - r->top;
+    int bytes = width * 4;
+    float inv = 1.0f / (2 * radius + 1);
+
+    std::vector<unsigned char> across(bytes * height);
+    for (int y=0; y<height; y++) {
+        const unsigned char *row = frame->pixels +
+            (r->top + y) * frame->stride + r->left * 4;
+        blur_row((const unsigned int*) row, width, radius, inv,
+                 (unsigned int*) &across[y * bytes]);
+    }
+
+    std::vector<int> sums(bytes);
+    for (int i=0; i<bytes; i++) {
+        sums[i] = across[i] * (radius + 1);
+        for (int j=1; j<=radius; j++)
+            sums[i] += across[std::min(j, height - 1) * bytes + i];
+    }
+    for (int y=0; y<height; y++) {
+        const unsigned char *add =
+            &across[std::min(y + radius + 1, height - 1) * bytes];
+        const unsigned char *sub = &across[std::max(y - radius, 0) * bytes];
+        blur_cols(&sums[0], add, sub, frame->pixels +
+                  (r->top + y) * frame->stride + r->left * 4, 0, bytes, inv);
+    }
+}
+
+
+//=============================================================================
+// Applying redactions
+
+// Where each of 'g_redactions' is on the screen now, in 'rects': empty
+// for a window that is hidden, minimized or gone
+void redact_rects(RECT *rects)
+{
+    for (unsigned int i=0; i<g_redactions.size(); i++) {
+        const Redaction *redaction = &g_redactions[i];
+        rects[i] = redaction->rect;
+        if (redaction->hwnd && (!IsWindowVisible(redaction->hwnd) ||
+                                IsIconic(redaction->hwnd) ||
+                                !GetWindowRect(redaction->hwnd, &rects[i])))
+            SetRect(&rects[i], 0, 0, 0, 0);
+    }
+}
+
+
+// Note where the redactions are just before a frame is copied from the
+// screen.  Used as the frame prefilter.
+void *redact_before_grab(const Frame *frame)
+{
+    RECT *rects = (RECT*) malloc(g_redactions.size() * sizeof(RECT));
+    if (rects)
+        redact_rects(rects);
+    return rects;
+}
+
+
+// Cover the redactions 'g_redactions' in a frame just copied from the
+// screen, where they are now and where 'before' (from
+// redact_before_grab(), may be NULL) saw them.  Used as the frame filter.
+void redact_frame(Frame *frame, void *before)
+{
+    RECT bounds;
+    SetRect(&bounds, frame->x, frame->y, frame->x + frame->width,
+            frame->y + frame->height);
+
+    std::vector<RECT> after(g_redactions.size());
+    redact_rects(&after[0]);
+
+    for (unsigned int i=0; i<g_redactions.size(); i++) {
+        const Redaction *redaction = &g_redactions[i];
+        RECT rect = after[i], r;
+        if (before)
+            UnionRect(&rect, &after[i], &((const RECT*) before)[i]);
+        if (!IntersectRect(&r, &rect, &bounds))
+            continue;
+        OffsetRect(&r, -frame->x, -frame->y);
+
+        switch (redaction->effect) {
+        case REDACT_FILL:
+            redact_fill_rect(frame, &r, redaction->color);
+            break;
+        case REDACT_PIXELATE:
+            redact_pixelate(frame, &r, rect.left - frame->x,
+                            rect.top - frame->y, redaction->size);
+            break;
+        case REDACT_BLUR:
+            redact_blur(frame, &r, redaction->size);
+            break;
+        }
+    }
+}
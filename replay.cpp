@@ -0,0 +1,465 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Instant replay: a memory-bounded ring of compressed frames.
+
+  Frames are cut into tiles.  A key frame stores every tile; other frames
+  store only the tiles that changed since the previous frame, XORed with
+  it so that unchanged pixels inside a changed tile become zeros.  The
+  stored tiles are then LZ compressed.
+
+  When a window scrolls, every tile of it changes.  So before the tiles
+  are compared, the largest block of changed tiles is searched for a
+  vertical or horizontal move (motion.cpp); if one is found, the frame
+  starts with a "copy this rectangle from that offset" op, which is
+  applied to the previous frame, and only the newly exposed tiles are
+  left to store.  When the ring is over its time or
+  memory budget, whole groups of frames (a key frame and its deltas) are
+  dropped from the front.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+// windows includes
+#include <windows.h>
+
+
+// tile size in pixels
+const int g_replay_tile = 64;
+
+// rows (or columns) that must match at one offset to make a move
+const int g_replay_min_move = 16;
+
+
+// A compressed frame
+struct ReplayFrame
+{
+    unsigned char *data;    // header, tile mask, and compressed tiles
+    int size;
+    bool key;               // decodable without the previous frame
+    DWORD time;             // capture time (GetTickCount)
+};
+
+
+// Layout of ReplayFrame::data
+struct ReplayHeader
+{
+    int raw_size;           // bytes of tile pixels before compression
+    int lz_size;            // bytes of compressed tile pixels
+    int moves;              // ReplayMove ops
+    // followed by the moves, one byte per tile (changed or not), then the
+    // LZ data
+};
+
+
+// Copy the rectangle (x,y,w,h) of the previous frame from (x+dx, y+dy)
+struct ReplayMove
+{
+    int x, y, w, h;
+    int dx, dy;
+};
+
+
+// Tile grid shared by the encoder and decoder
+struct ReplayCodec
+{
+    int width, height;
+    int tiles_x, tiles_y;
+    unsigned char *prev;        // previous frame, width*4 bytes per row
+    unsigned char *scratch;     // tile pixels before compression
+    unsigned char *lz;          // compressed tile pixels
+};
+
+
+void replay_codec_init(ReplayCodec *codec, int width, int height)
+{
+    codec->width = width;
+    codec->height = height;
+    codec->tiles_x = (width + g_replay_tile - 1) / g_replay_tile;
+    codec->tiles_y = (height + g_replay_tile - 1) / g_replay_tile;
+
+    int size = width * height * 4;
+    codec->prev = (unsigned char*) calloc(size, 1);
+    codec->scratch = (unsigned char*) malloc(size);
+    codec->lz = (unsigned char*) malloc(lz_bound(size));
+}
+
+
+void replay_codec_free(ReplayCodec *codec)
+{
+    free(codec->prev);
+    free(codec->scratch);
+    free(codec->lz);
+}
+
+
+// Apply a move to the previous frame
+void replay_apply_move(ReplayCodec *codec, const ReplayMove *move)
+{
+    int stride = codec->width * 4;
+    for (int i=0; i<move->h; i++) {
+        // rows move up: copy from the top down, and the other way around
+        int row = move->dy > 0 ? i : move->h - 1 - i;
+        unsigned char *dst = codec->prev + (move->y + row) * stride +
+            move->x * 4;
+        memmove(dst, dst + move->dy * stride + move->dx * 4, move->w * 4);
+    }
+}
+
+
+// Whether the tile at (tx, ty) differs from the previous frame
+bool replay_tile_changed(const ReplayCodec *codec, const Frame *frame,
+                         int tx, int ty)
+{
+    int x = tx * g_replay_tile;
+    int y = ty * g_replay_tile;
+    int w = std::min(g_replay_tile, codec->width - x) * 4;
+    int h = std::min(g_replay_tile, codec->height - y);
+    int prev_stride = codec->width * 4;
+    const unsigned char *cur = frame->pixels + y*frame->stride + x*4;
+    const unsigned char *prev = codec->prev + y*prev_stride + x*4;
+    for (int i=0; i<h; i++)
+        if (memcmp(cur + i*frame->stride, prev + i*prev_stride, w) != 0)
+            return true;
+    return false;
+}
+
+
+// Find a vertical or horizontal move of the largest connected block of
+// changed tiles in 'mask'.  Returns false if there is none.
+bool replay_find_move(const ReplayCodec *codec, const Frame *frame,
+                      const unsigned char *mask, ReplayMove *move)
+{
+    // the largest block, by a flood fill over the tile grid
+    int tiles_x = codec->tiles_x, ntiles = tiles_x * codec->tiles_y;
+    std::vector<int> label(ntiles, -1), queue;
+    int best_size = 0, bx0 = 0, by0 = 0, bx1 = 0, by1 = 0;
+    for (int t=0; t<ntiles; t++) {
+        if (!mask[t] || label[t] >= 0)
+            continue;
+        int tx0 = t % tiles_x, ty0 = t / tiles_x, tx1 = tx0, ty1 = ty0;
+        queue.assign(1, t);
+        label[t] = t;
+        for (unsigned int k=0; k<queue.size(); k++) {
+            int u = queue[k], ux = u % tiles_x, uy = u / tiles_x;
+            tx0 = std::min(tx0, ux);
+            tx1 = std::max(tx1, ux);
+            ty0 = std::min(ty0, uy);
+            ty1 = std::max(ty1, uy);
+            const int next[4] = {ux > 0 ? u - 1 : -1,
+                                 ux + 1 < tiles_x ? u + 1 : -1,
+                                 u - tiles_x, u + tiles_x};
+            for (int n=0; n<4; n++) {
+                int v = next[n];
+                if (v >= 0 && v < ntiles && mask[v] && label[v] < 0) {
+                    label[v] = t;
+                    queue.push_back(v);
+                }
+            }
+        }
+        if ((int) queue.size() > best_size) {
+            best_size = queue.size();
+            bx0 = tx0 * g_replay_tile;
+            by0 = ty0 * g_replay_tile;
+            bx1 = std::min((tx1 + 1) * g_replay_tile, codec->width);
+            by1 = std::min((ty1 + 1) * g_replay_tile, codec->height);
+        }
+    }
+    if (best_size < 2)
+        return false;
+
+    // shrink the block to the rows and columns that changed
+    int prev_stride = codec->width * 4;
+    int y0 = by0, y1 = by1, x0 = bx1, x1 = bx0;
+    while (y0 < y1 && memcmp(frame->pixels + y0 * frame->stride + bx0 * 4,
+                             codec->prev + y0 * prev_stride + bx0 * 4,
+                             (bx1 - bx0) * 4) == 0)
+        y0++;
+    while (y1 > y0 && memcmp(frame->pixels + (y1-1) * frame->stride + 
+                             bx0 * 4,
+                             codec->prev + (y1-1) * prev_stride + bx0 * 4,
+                             (bx1 - bx0) * 4) == 0)
+        y1--;
+    for (int y=y0; y<y1; y++) {
+        const unsigned int *a = (const unsigned int*) (frame->pixels +
+                                                       y * frame->stride);
+        const unsigned int *b = (const unsigned int*) (codec->prev +
+                                                       y * prev_stride);
+        for (int x=bx0; x<x0; x++)
+            if (a[x] != b[x]) {
+                x0 = x;
+                break;
+            }
+        for (int x=bx1-1; x>=x1; x--)
+            if (a[x] != b[x]) {
+                x1 = x + 1;
+                break;
+            }
+    }
+    if (x1 - x0 < g_replay_min_move || y1 - y0 < g_replay_min_move)
+        return false;
+
+    // rows first: pages mostly scroll up and down
+    std::vector<unsigned long long> prev_hashes, cur_hashes;
+    int start, length;
+    motion_row_hashes(codec->prev, prev_stride, x0, x1, y0, y1, 
+                      &prev_hashes);
+    motion_row_hashes(frame->pixels, frame->stride, x0, x1, y0, y1,
+                      &cur_hashes);
+    int d = motion_offset(prev_hashes, cur_hashes, 0, y1 - y0,
+                          g_replay_min_move, true, &start, &length);
+    if (d != 0) {
+        move->x = x0;
+        move->w = x1 - x0;
+        move->y = y0 + start;
+        move->h = length;
+        move->dx = 0;
+        move->dy = d;
+        return true;
+    }
+
+    motion_col_hashes(codec->prev, prev_stride, x0, x1, y0, y1, 
+                      &prev_hashes);
+    motion_col_hashes(frame->pixels, frame->stride, x0, x1, y0, y1,
+                      &cur_hashes);
+    d = motion_offset(prev_hashes, cur_hashes, 0, x1 - x0,
+                      g_replay_min_move, true, &start, &length);
+    if (d != 0) {
+        move->x = x0 + start;
+        move->w = length;
+        move->y = y0;
+        move->h = y1 - y0;
+        move->dx = d;
+        move->dy = 0;
+        return true;
+    }
+    return false;
+}
+
+
+// Compress a frame, as a key frame or as a delta against the previously
+// encoded frame
+void replay_encode(ReplayCodec *codec, const Frame *frame, bool key,
+                   ReplayFrame *out)
+{
+    int ntiles = codec->tiles_x * codec->tiles_y;
+    int prev_stride = codec->width * 4;
+    unsigned char *mask = (unsigned char*) malloc(ntiles);
+    unsigned char *raw = codec->scratch;
+
+    // find which tiles changed
+    for (int ty=0; ty<codec->tiles_y; ty++)
+        for (int tx=0; tx<codec->tiles_x; tx++)
+            mask[ty * codec->tiles_x + tx] = key ||
+                replay_tile_changed(codec, frame, tx, ty);
+
+    // move what scrolled, then look again at the tiles it covers
+    ReplayMove move;
+    int nmoves = 0;
+    if (!key && replay_find_move(codec, frame, mask, &move)) {
+        replay_apply_move(codec, &move);
+        nmoves = 1;
+        for (int ty=move.y / g_replay_tile;
+             ty<=(move.y + move.h - 1) / g_replay_tile; ty++)
+            for (int tx=move.x / g_replay_tile;
+                 tx<=(move.x + move.w - 1) / g_replay_tile; tx++)
+                mask[ty * codec->tiles_x + tx] =
+                    replay_tile_changed(codec, frame, tx, ty);
+    }
+
+    for (int ty=0; ty<codec->tiles_y; ty++) {
+        for (int tx=0; tx<codec->tiles_x; tx++) {
+            if (!mask[ty * codec->tiles_x + tx])
+                continue;
+
+            int x = tx * g_replay_tile;
+            int y = ty * g_replay_tile;
+            int w = std::min(g_replay_tile, codec->width - x) * 4;
+            int h = std::min(g_replay_tile, codec->height - y);
+            const unsigned char *cur = frame->pixels + y*frame->stride + x*4;
+            unsigned char *prev = codec->prev + y*prev_stride + x*4;
+
+            for (int i=0; i<h; i++) {
+                const unsigned char *src = cur + i*frame->stride;
+                unsigned char *ref = prev + i*prev_stride;
+                if (key) {
+                    memcpy(raw, src, w);
+                } else {
+                    for (int j=0; j<w; j++)
+                        raw[j] = src[j] ^ ref[j];
+                }
+                memcpy(ref, src, w);
+                raw += w;
+            }
+        }
+    }
+
+    ReplayHeader header;
+    header.raw_size = raw - codec->scratch;
+    header.lz_size = lz_compress(codec->scratch, header.raw_size, codec->lz);
+    header.moves = nmoves;
+
+    int moves_size = nmoves * sizeof(ReplayMove);
+    out->size = sizeof(header) + moves_size + ntiles + header.lz_size;
+    out->data = (unsigned char*) malloc(out->size);
+    out->key = key;
+    unsigned char *p = out->data;
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, &move, moves_size);
+    p += moves_size;
+    memcpy(p, mask, ntiles);
+    memcpy(p + ntiles, codec->lz, header.lz_size);
+    free(mask);
+}
+
+
+// Decompress a frame into 'frame' (of the codec's size).  Delta frames
+// must be decoded in order after their key frame.
+bool replay_decode(ReplayCodec *codec, const ReplayFrame *in, Frame *frame)
+{
+    int ntiles = codec->tiles_x * codec->tiles_y;
+    int prev_stride = codec->width * 4;
+    ReplayHeader header;
+    memcpy(&header, in->data, sizeof(header));
+    const unsigned char *moves = in->data + sizeof(header);
+    const unsigned char *mask = moves + header.moves * sizeof(ReplayMove);
+
+    for (int i=0; i<header.moves; i++) {
+        ReplayMove move;
+        memcpy(&move, moves + i * sizeof(ReplayMove), sizeof(move));
+        if (move.x < 0 || move.y < 0 || move.w <= 0 || move.h <= 0 ||
+            move.x + move.w > codec->width ||
+            move.y + move.h > codec->height ||
+            move.x + move.dx < 0 || move.y + move.dy < 0 ||
+            move.x + move.dx + move.w > codec->width ||
+            move.y + move.dy + move.h > codec->height) {
+            printf("error: corrupt replay frame\n");
+            return false;
+        }
+        replay_apply_move(codec, &move);
+    }
+
+    if (lz_decompress(mask + ntiles, header.lz_size, codec->scratch,
+                      header.raw_size) != header.raw_size) {
+        printf("error: corrupt replay frame\n");
+        return false;
+    }
+
+    const unsigned char *raw = codec->scratch;
+    for (int ty=0; ty<codec->tiles_y; ty++) {
+        for (int tx=0; tx<codec->tiles_x; tx++) {
+            if (!mask[ty * codec->tiles_x + tx])
+                continue;
+
+            int x = tx * g_replay_tile;
+            int y = ty * g_replay_tile;
+            int w = std::min(g_replay_tile, codec->width - x) * 4;
+            int h = std::min(g_replay_tile, codec->height - y);
+            unsigned char *prev = codec->prev + y*prev_stride + x*4;
+
+            for (int i=0; i<h; i++) {
+                unsigned char *ref = prev + i*prev_stride;
+                if (in->key) {
+                    memcpy(ref, raw, w);
+                } else {
+                    for (int j=0; j<w; j++)
+                        ref[j] ^= raw[j];
+                }
+                raw += w;
+            }
+        }
+    }
+
+    for (int i=0; i<codec->height; i++)
+        memcpy(frame->pixels + i*frame->stride, codec->prev + i*prev_stride,
+               prev_stride);
+    return true;
+}
+
+
+//=============================================================================
+// Ring of compressed frames
+
+struct ReplayRing
+{
+    std::deque<ReplayFrame> frames;
+    size_t bytes;               // total compressed bytes held
+    size_t max_bytes;
+    DWORD max_time;             // milliseconds of history to keep
+    CRITICAL_SECTION lock;
+};
+
+
+void replay_ring_init(ReplayRing *ring, DWORD max_time, size_t max_bytes)
+{
+    ring->bytes = 0;
+    ring->max_bytes = max_bytes;
+    ring->max_time = max_time;
+    InitializeCriticalSection(&ring->lock);
+}
+
+
+// Drop the oldest group of frames (a key frame and the deltas after it)
+void replay_ring_pop_group(ReplayRing *ring)
+{
+    do {
+        ring->bytes -= ring->frames.front().size;
+        free(ring->frames.front().data);
+        ring->frames.pop_front();
+    } while (!ring->frames.empty() && !ring->frames.front().key);
+}
+
+
+// Add a frame and drop old ones that no longer fit the budget.  The
+// newest group is always kept.
+void replay_ring_push(ReplayRing *ring, const ReplayFrame *frame)
+{
+    EnterCriticalSection(&ring->lock);
+    ring->frames.push_back(*frame);
+    ring->bytes += frame->size;
+
+    while (true) {
+        // find where the second group starts
+        unsigned int next = 1;
+        while (next < ring->frames.size() && !ring->frames[next].key)
+            next++;
+        if (next >= ring->frames.size())
+            break;
+
+        DWORD age = frame->time - ring->frames[next].time;
+        if (ring->bytes <= ring->max_bytes && age < ring->max_time)
+            break;
+        replay_ring_pop_group(ring);
+    }
+    LeaveCriticalSection(&ring->lock);
+}
+
+
+// Drop every frame, as after they are saved.  The next frame pushed
+// must be a key frame.
+void replay_ring_clear(ReplayRing *ring)
+{
+    EnterCriticalSection(&ring->lock);
+    while (!ring->frames.empty())
+        replay_ring_pop_group(ring);
+    LeaveCriticalSection(&ring->lock);
+}
+
+
+void replay_ring_free(ReplayRing *ring)
+{
+    while (!ring->frames.empty())
+        replay_ring_pop_group(ring);
+    DeleteCriticalSection(&ring->lock);
+}
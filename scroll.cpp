@@ -0,0 +1,268 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Scrolling capture: scroll a region with the mouse wheel and stitch the
+  frames into one tall PNG.
+
+  Every row of a frame is hashed once, and the hashes are kept for the
+  next frame.  The scroll offset between two frames is found by the
+  motion search (motion.cpp) in linear time.  Rows that stay put at the
+  top and bottom (headers and footers) are left out of the search and
+  written only once.
+
+  The stitched image is filtered and compressed a strip of rows at a
+  time and written as it grows, so memory stays at two frames no matter
+  how long the page is.  The height is patched into the header at the
+  end.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// windows includes
+#include <windows.h>
+
+#include <vector>
+#include <algorithm>
+
+
+// rows that must match at one offset before it is trusted
+const int g_scroll_min_run = 16;
+
+// rows compressed together when stitching
+const int g_stitch_strip = 64;
+
+
+//=============================================================================
+// Scrolling
+
+// Rows [top, bottom) that changed between two frames' hashes: 'top'
+// counts the unchanged rows at the top and 'bottom' ends before the
+// unchanged rows at the bottom.  Returns false if no row changed.
+bool scroll_changed_rows(const std::vector<unsigned long long> &prev,
+                         const std::vector<unsigned long long> &cur,
+                         int *top, int *bottom)
+{
+    int height = cur.size();
+    int t = 0;
+    while (t < height && prev[t] == cur[t])
+        t++;
+    if (t == height)
+        return false;
+    int b = height;
+    while (b > t && prev[b-1] == cur[b-1])
+        b--;
+    *top = t;
+    *bottom = b;
+    return true;
+}
+
+
+// Turn the mouse wheel over the point (x, y) by 'notches' notches down
+bool scroll_wheel(int x, int y, int notches)
+{
+    if (!SetCursorPos(x, y))
+        return false;
+
+    INPUT input;
+    memset(&input, 0, sizeof(input));
+    input.type = INPUT_MOUSE;
+    input.mi.dwFlags = MOUSEEVENTF_WHEEL;
+    input.mi.mouseData = (DWORD) (-WHEEL_DELTA * notches);
+    return SendInput(1, &input, sizeof(INPUT)) == 1;
+}
+
+
+//=============================================================================
+// Stitched PNG
+
+// A PNG written a strip of rows at a time, before its height is known
+struct StitchWriter
+{
+    StreamWriter stream;
+    int width;
+    int height;                         // rows added so far
+    DeflateStream deflate;
+    std::vector<unsigned char> packed;  // compressed bytes for the next IDAT
+    std::vector<unsigned char> strip;   // filtered rows not yet compressed
+    std::vector<unsigned char> line;    // this row and the one above, RGB
+    int strip_rows;
+};
+
+
+// Start a stitched RGB PNG of the given width on a file (not stdout, as
+// the header is patched at the end)
+bool stitch_open(StitchWriter *writer, const char *filename, int width)
+{
+    if (!stream_open(&writer->stream, filename))
+        return false;
+    writer->width = width;
+    writer->height = 0;
+    writer->strip.clear();
+    writer->strip_rows = 0;
+    writer->line.assign(width * 3 * 2, 0);
+    writer->packed.clear();
+    deflate_begin(&writer->deflate, &writer->packed);
+
+    // the height is filled in by stitch_close()
+    const unsigned char signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    unsigned char ihdr[13];
+    put32be(ihdr, width);
+    put32be(ihdr + 4, 0);
+    ihdr[8] = 8;        // bits per sample
+    ihdr[9] = 2;        // RGB
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    if (stream_write(&writer->stream, signature, 8) &&
+        png_write_chunk(&writer->stream, "IHDR", ihdr, 13))
+        return true;
+    stream_close(&writer->stream);
+    return false;
+}
+
+
+// Compress the pending strip and write out what the compressor made
+bool stitch_flush(StitchWriter *writer)
+{
+    if (writer->strip_rows > 0)
+        deflate_add(&writer->deflate, &writer->strip[0],
+                    writer->strip.size());
+    writer->strip.clear();
+    writer->strip_rows = 0;
+
+    bool ret = writer->packed.empty() ||
+        png_write_chunk(&writer->stream, "IDAT", &writer->packed[0],
+                        writer->packed.size());
+    writer->packed.clear();
+    return ret;
+}
+
+
+// Append rows [y0, y1) of a frame
+bool stitch_add(StitchWriter *writer, const Frame *frame, int y0, int y1)
+{
+    int row_bytes = writer->width * 3;
+    for (int y=y0; y<y1; y++) {
+        // this row goes where the row above was
+        unsigned char *cur = &writer->line[(writer->height & 1) * row_bytes];
+        const unsigned char *up =
+            &writer->line[(~writer->height & 1) * row_bytes];
+        const unsigned char *src = frame->pixels + y * frame->stride;
+        for (int x=0; x<writer->width; x++) {
+            cur[x*3] = src[x*4+2];
+            cur[x*3+1] = src[x*4+1];
+            cur[x*3+2] = src[x*4];
+        }
+
+        int offset = writer->strip.size();
+        writer->strip.resize(offset + row_bytes + 1);
+        png_filter_row(cur, up, row_bytes, 3, &writer->strip[offset]);
+        writer->height++;
+
+        if (++writer->strip_rows == g_stitch_strip && !stitch_flush(writer))
+            return false;
+    }
+    return true;
+}
+
+
+// Finish the PNG and patch its height into the header
+bool stitch_close(StitchWriter *writer)
+{
+    bool ret = stitch_flush(writer);
+    deflate_end(&writer->deflate);
+    ret = ret && png_write_chunk(&writer->stream, "IDAT",
+                                 &writer->packed[0], writer->packed.size()) &&
+        png_write_chunk(&writer->stream, "IEND", NULL, 0);
+
+    unsigned char ihdr[17];
+    memcpy(ihdr, "IHDR", 4);
+    put32be(ihdr + 4, writer->width);
+    put32be(ihdr + 8, writer->height);
+    ihdr[12] = 8;
+    ihdr[13] = 2;
+    ihdr[14] = ihdr[15] = ihdr[16] = 0;
+    unsigned char crc[4];
+    put32be(crc, crc32_update(0, ihdr, 17));
+    ret = ret && stream_patch(&writer->stream, 8 + 8 + 4, ihdr + 8, 4) &&
+        stream_patch(&writer->stream, 8 + 8 + 13, crc, 4);
+
+    stream_close(&writer->stream);
+    writer->packed.clear();
+    writer->strip.clear();
+    return ret;
+}
+
+
+//=============================================================================
+// Stitching
+
+enum {
+    SCROLL_MOVED,       // the page moved and its new rows were taken
+    SCROLL_END,         // nothing moved: the end of the page
+    SCROLL_LOST,        // no offset explains the new frame
+    SCROLL_ERROR
+};
+
+
+struct ScrollStitch
+{
+    StitchWriter writer;
+    std::vector<unsigned long long> prev_hashes, hashes;
+    int written;        // rows of the latest frame already in the image
+};
+
+
+// Start stitching into the PNG 'filename' from the first frame
+bool scroll_begin(ScrollStitch *stitch, const char *filename,
+                  const Frame *first)
+{
+    if (!stitch_open(&stitch->writer, filename, first->width))
+        return false;
+    motion_row_hashes(first->pixels, first->stride, 0, first->width, 0,
+                      first->height, &stitch->prev_hashes);
+    stitch->written = 0;
+    return true;
+}
+
+
+// Take the next frame 'cur' after 'prev'.  Rows of 'prev' known to have
+// scrolled (rather than being a footer) are added to the image.  Unless
+// the page moved, 'prev' stays the latest frame.
+int scroll_next(ScrollStitch *stitch, const Frame *prev, const Frame *cur)
+{
+    motion_row_hashes(cur->pixels, cur->stride, 0, cur->width, 0,
+                      cur->height, &stitch->hashes);
+    int top, bottom, start, length;
+    if (!scroll_changed_rows(stitch->prev_hashes, stitch->hashes,
+                             &top, &bottom))
+        return SCROLL_END;
+    int d = motion_offset(stitch->prev_hashes, stitch->hashes, top, bottom,
+                          g_scroll_min_run, false, &start, &length);
+    if (d == 0)
+        return SCROLL_LOST;
+
+    // prev's rows above 'bottom' are in cur 'd' rows higher up
+    if (stitch->written < bottom &&
+        !stitch_add(&stitch->writer, prev, stitch->written, bottom))
+        return SCROLL_ERROR;
+    stitch->written = std::max(std::max(stitch->written, bottom) - d, 0);
+    stitch->prev_hashes.swap(stitch->hashes);
+    return SCROLL_MOVED;
+}
+
+
+// Add the rest of the latest frame, footer included, and finish the PNG.
+// Returns the height of the image, or -1 on errors.
+int scroll_end(ScrollStitch *stitch, const Frame *last)
+{
+    bool ok = stitch_add(&stitch->writer, last, stitch->written,
+                         last->height);
+    ok = stitch_close(&stitch->writer) && ok;
+    return ok ? stitch->writer.height : -1;
+}
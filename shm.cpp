@@ -0,0 +1,296 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Shared-memory frame ring: a publisher captures straight into one of N
+  frame slots of a named file mapping, and any number of other processes
+  map it and read the latest frame in place.
+
+  Each slot is guarded by a sequence counter (a seqlock).  The publisher
+  makes the counter odd while it writes the slot and even again when the
+  slot is complete.  Readers never block the publisher: they note the
+  counter, read the pixels, and check that the counter has not moved.
+  Since the publisher always fills the slot after the newest one, a
+  reader has N-1 frame intervals before its slot is reused.
+
+  When frames are filtered (redacted), the raw pixels must never reach
+  the shared section: the publisher grabs and filters a private frame
+  and copies it into the slot inside the odd window.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <string.h>
+
+// windows includes
+#include <windows.h>
+
+
+// pixel slots start on page boundaries
+const int g_shm_page = 4096;
+
+// most slots a ring may have
+const int g_shm_max_slots = 64;
+
+
+// Per-slot state, kept in the first page of the mapping
+struct ShmSlot
+{
+    volatile LONG seq;          // odd while the slot is being written
+    unsigned int pad;
+    unsigned long long timestamp;   // microseconds since 1970-01-01 UTC
+    unsigned long long number;      // frames published before this one
+    char reserved[40];              // one cache line per slot
+};
+
+
+// Start of the mapping (little endian)
+struct ShmHeader
+{
+    char magic[4];              // "BXSR"
+    unsigned int header_size;   // sizeof(ShmHeader)
+    unsigned int nslots;
+    unsigned int width;
+    unsigned int height;
+    unsigned int stride;        // bytes per row
+    int x, y;                   // screen coordinates of pixel (0,0)
+    unsigned int slot_offset;   // offset of the first slot's pixels
+    unsigned int slot_size;     // distance between slots' pixels
+    volatile LONG latest;       // newest complete slot, -1 if none yet
+    volatile LONG frames;       // frames published so far
+    char reserved[16];
+    ShmSlot slots[g_shm_max_slots];
+};
+
+
+// Publisher side of a ring
+struct ShmRing
+{
+    HANDLE mapping;
+    ShmHeader *header;
+    Frame frames[g_shm_max_slots];  // DIB sections on the mapping
+    Frame staging;                  // private grab, with a frame filter
+    int nslots;
+    int next;                       // slot to write next
+};
+
+
+// Reader side of a ring
+struct ShmReader
+{
+    HANDLE mapping;
+    ShmHeader *header;
+    unsigned char *base;
+};
+
+
+void shm_free(ShmRing *ring);
+void shm_close_reader(ShmReader *reader);
+
+
+// Create the ring 'name' of 'nslots' frames of the screen rectangle
+// (x,y)-(x2,y2)
+bool shm_create(ShmRing *ring, const char *name, int nslots,
+                int x, int y, int x2, int y2)
+{
+    memset(ring, 0, sizeof(ShmRing));
+    if (nslots < 2 || nslots > g_shm_max_slots) {
+        printf("error: shared memory ring needs 2 to %d slots\n",
+               g_shm_max_slots);
+        return false;
+    }
+    if (x2 <= x || y2 <= y) {
+        printf("error: empty capture rectangle\n");
+        return false;
+    }
+
+    int width = x2 - x;
+    int height = y2 - y;
+    unsigned int slot_offset = (sizeof(ShmHeader) + g_shm_page - 1) /
+        g_shm_page * g_shm_page;
+    unsigned int slot_size = ((unsigned int) width * 4 * height +
+                              g_shm_page - 1) / g_shm_page * g_shm_page;
+    unsigned long long size = slot_offset +
+        (unsigned long long) slot_size * nslots;
+
+    ring->mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+                                      PAGE_READWRITE, (DWORD) (size >> 32),
+                                      (DWORD) size, name);
+    if (!ring->mapping) {
+        printf("error: cannot create shared memory '%s'\n", name);
+        return false;
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        printf("error: shared memory '%s' is already in use\n", name);
+        CloseHandle(ring->mapping);
+        ring->mapping = NULL;
+        return false;
+    }
+
+    // the header is mapped here; the slots are mapped by their DIB sections
+    ring->header = (ShmHeader*) MapViewOfFile(ring->mapping, FILE_MAP_WRITE,
+                                              0, 0, slot_offset);
+    if (!ring->header) {
+        printf("error: cannot map shared memory '%s'\n", name);
+        CloseHandle(ring->mapping);
+        ring->mapping = NULL;
+        return false;
+    }
+
+    ShmHeader *header = ring->header;
+    memcpy(header->magic, "BXSR", 4);
+    header->header_size = sizeof(ShmHeader);
+    header->nslots = nslots;
+    header->width = width;
+    header->height = height;
+    header->stride = width * 4;
+    header->x = x;
+    header->y = y;
+    header->slot_offset = slot_offset;
+    header->slot_size = slot_size;
+    header->latest = -1;
+    header->frames = 0;
+
+    for (int i=0; i<nslots; i++) {
+        if (!frame_create_section(&ring->frames[i], x, y, width, height,
+                                  ring->mapping,
+                                  slot_offset + slot_size * i)) {
+            ring->nslots = i;
+            shm_free(ring);
+            return false;
+        }
+    }
+    ring->nslots = nslots;
+    ring->next = 0;
+    return true;
+}
+
+
+// Capture the screen into the next slot and make it the latest frame
+bool shm_publish(ShmRing *ring, HDC screen_dc, unsigned long long timestamp)
+{
+    ShmHeader *header = ring->header;
+    ShmSlot *slot = &header->slots[ring->next];
+    Frame *frame = &ring->frames[ring->next];
+
+    // filter a private copy first, so that unfiltered pixels are never
+    // shared
+    bool staged = g_frame_filter != NULL;
+    bool ret = true;
+    if (staged) {
+        if (!ring->staging.pixels)
+            ret = frame_create(&ring->staging, frame->x, frame->y,
+                               frame->width, frame->height);
+        ret = ret && frame_grab(&ring->staging, screen_dc);
+    }
+
+    // odd: readers of this slot will see their copy is stale
+    InterlockedIncrement(&slot->seq);
+    if (staged) {
+        for (int y=0; ret && y<frame->height; y++)
+            memcpy(frame->pixels + y * frame->stride,
+                   ring->staging.pixels + y * ring->staging.stride,
+                   frame->width * 4);
+    } else {
+        ret = frame_grab(frame, screen_dc);
+    }
+    slot->timestamp = timestamp;
+    slot->number = header->frames;
+    InterlockedIncrement(&slot->seq);
+
+    if (ret) {
+        InterlockedExchange(&header->latest, ring->next);
+        InterlockedIncrement(&header->frames);
+        ring->next = (ring->next + 1) % ring->nslots;
+    }
+    return ret;
+}
+
+
+void shm_free(ShmRing *ring)
+{
+    for (int i=0; i<ring->nslots; i++)
+        frame_free(&ring->frames[i]);
+    frame_free(&ring->staging);
+    if (ring->header)
+        UnmapViewOfFile(ring->header);
+    if (ring->mapping)
+        CloseHandle(ring->mapping);
+    memset(ring, 0, sizeof(ShmRing));
+}
+
+
+//=============================================================================
+// Readers
+
+// Map the ring 'name' for reading
+bool shm_open_reader(ShmReader *reader, const char *name)
+{
+    memset(reader, 0, sizeof(ShmReader));
+    reader->mapping = OpenFileMapping(FILE_MAP_READ, FALSE, name);
+    if (!reader->mapping) {
+        printf("error: no shared memory '%s'\n", name);
+        return false;
+    }
+
+    reader->base = (unsigned char*) MapViewOfFile(reader->mapping,
+                                                  FILE_MAP_READ, 0, 0, 0);
+    reader->header = (ShmHeader*) reader->base;
+    if (!reader->base || memcmp(reader->header->magic, "BXSR", 4) != 0 ||
+        reader->header->header_size != sizeof(ShmHeader)) {
+        printf("error: '%s' is not a boxcutter frame ring\n", name);
+        shm_close_reader(reader);
+        return false;
+    }
+    return true;
+}
+
+
+// Find the latest complete frame.  Its pixels are read in place; call
+// shm_check() with 'slot' and 'seq' afterwards to learn whether the
+// publisher overwrote them meanwhile.
+const unsigned char *shm_latest(ShmReader *reader, int *slot, LONG *seq,
+                                unsigned long long *timestamp)
+{
+    ShmHeader *header = reader->header;
+    for (int tries=0; tries<header->nslots; tries++) {
+        LONG latest = header->latest;
+        if (latest < 0 || latest >= (LONG) header->nslots)
+            return NULL;
+
+        ShmSlot *s = &header->slots[latest];
+        LONG before = s->seq;
+        MemoryBarrier();
+        if (before & 1)
+            // the publisher lapped the ring; look again
+            continue;
+
+        if (timestamp)
+            *timestamp = s->timestamp;
+        *slot = latest;
+        *seq = before;
+        return reader->base + header->slot_offset +
+            header->slot_size * latest;
+    }
+    return NULL;
+}
+
+
+// Return true if a frame from shm_latest() was intact while it was read
+bool shm_check(ShmReader *reader, int slot, LONG seq)
+{
+    MemoryBarrier();
+    return reader->header->slots[slot].seq == seq;
+}
+
+
+void shm_close_reader(ShmReader *reader)
+{
+    if (reader->base)
+        UnmapViewOfFile(reader->base);
+    if (reader->mapping)
+        CloseHandle(reader->mapping);
+    memset(reader, 0, sizeof(ShmReader));
+}
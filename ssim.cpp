@@ -0,0 +1,470 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Structural similarity (SSIM) of two frames, and its multi-scale form
+  (MS-SSIM): a score from 0 to 1 that tolerates the small shifts of
+  anti-aliased edges that a per-pixel comparison counts as differences.
+
+  Both frames are reduced to gray, and every 8x8 window is compared by
+  its means, variances, and covariance.  The window sums are box filters
+  kept as running column sums, updated a row at a time with AVX2, and
+  held in integers so that the statistics are exact.  The rows of
+  windows are split into bands over the thread pool.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include <vector>
+#include <algorithm>
+
+
+// side of the square window
+const int g_ssim_window = 8;
+
+// row bands per worker thread
+const int g_ssim_bands = 4;
+
+// constants of the SSIM formula, (0.01 * 255)^2 and (0.03 * 255)^2,
+// scaled to sums over a window (times window pixels squared)
+const float g_ssim_c1 = 6.5025f * 4096;
+const float g_ssim_c2 = 58.5225f * 4096;
+
+// MS-SSIM weights of scales 1 to 5
+const int g_ssim_max_scales = 5;
+const double g_ssim_weights[g_ssim_max_scales] = {
+    0.0448, 0.2856, 0.3001, 0.2363, 0.1333
+};
+
+
+// Column sums over the rows of a window: of a, b, a*a, b*b, and a*b
+struct SsimSums
+{
+    std::vector<int> a, b, aa, bb, ab;
+};
+
+
+// Add (sign 1) or subtract (sign -1) the pixels [start, width) of gray
+// rows 'a' and 'b' to or from the column sums
+typedef void (*SsimColsFunc)(const unsigned char *a, const unsigned char *b,
+                             int start, int width, int sign,
+                             SsimSums *sums);
+
+
+void ssim_cols_c(const unsigned char *a, const unsigned char *b,
+                 int start, int width, int sign, SsimSums *sums)
+{
+    for (int x=start; x<width; x++) {
+        int va = a[x] * sign, vb = b[x] * sign;
+        sums->a[x] += va;
+        sums->b[x] += vb;
+        sums->aa[x] += va * a[x];
+        sums->bb[x] += vb * b[x];
+        sums->ab[x] += va * b[x];
+    }
+}
+
+
+TARGET_AVX2
+void ssim_cols_avx2(const unsigned char *a, const unsigned char *b,
+                    int start, int width, int sign, SsimSums *sums)
+{
+    const __m256i s = _mm256_set1_epi32(sign);
+    int *sa = &sums->a[0], *sb = &sums->b[0];
+    int *saa = &sums->aa[0], *sbb = &sums->bb[0], *sab = &sums->ab[0];
+
+    int x = start;
+    for (; x + 8 <= width; x += 8) {
+        __m256i va = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i*) (a + x)));
+        __m256i vb = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i*) (b + x)));
+        __m256i aa = _mm256_sign_epi32(_mm256_mullo_epi32(va, va), s);
+        __m256i bb = _mm256_sign_epi32(_mm256_mullo_epi32(vb, vb), s);
+        __m256i ab = _mm256_sign_epi32(_mm256_mullo_epi32(va, vb), s);
+        va = _mm256_sign_epi32(va, s);
+        vb = _mm256_sign_epi32(vb, s);
+
+#define SSIM_ADD(p, v) \
+        _mm256_storeu_si256((__m256i*) (p + x), _mm256_add_epi32( \
+            _mm256_loadu_si256((const __m256i*) (p + x)), v))
+        SSIM_ADD(sa, va);
+        SSIM_ADD(sb, vb);
+        SSIM_ADD(saa, aa);
+        SSIM_ADD(sbb, bb);
+        SSIM_ADD(sab, ab);
+#undef SSIM_ADD
+    }
+    ssim_cols_c(a, b, x, width, sign, sums);
+}
+
+
+// Score the windows [start, nwin) of one row from the column sums: add
+// their SSIM and their contrast-structure term (SSIM without the
+// luminance term) to '*ssim_sum' and '*cs_sum', and store each SSIM in
+// 'map' if not NULL
+typedef void (*SsimRowFunc)(const SsimSums *sums, int start, int nwin,
+                            float *map, double *ssim_sum, double *cs_sum);
+
+
+void ssim_row_c(const SsimSums *sums, int start, int nwin, float *map,
+                double *ssim_sum, double *cs_sum)
+{
+    const int n = g_ssim_window * g_ssim_window;
+    double ssim_total = 0.0, cs_total = 0.0;
+    for (int x=start; x<nwin; x++) {
+        int a = 0, b = 0, aa = 0, bb = 0, ab = 0;
+        for (int k=0; k<g_ssim_window; k++) {
+            a += sums->a[x+k];
+            b += sums->b[x+k];
+            aa += sums->aa[x+k];
+            bb += sums->bb[x+k];
+            ab += sums->ab[x+k];
+        }
+
+        // everything times n^2, exact in 32 bits
+        float l = (float) (2 * a * b + g_ssim_c1) /
+            (float) (a * a + b * b + g_ssim_c1);
+        float cs = (float) (2 * (n * ab - a * b) + g_ssim_c2) /
+            (float) ((n * aa - a * a) + (n * bb - b * b) + g_ssim_c2);
+        ssim_total += l * cs;
+        cs_total += cs;
+        if (map)
+            map[x] = l * cs;
+    }
+    *ssim_sum += ssim_total;
+    *cs_sum += cs_total;
+}
+
+
+TARGET_AVX2
+inline __m256i ssim_window_sum(const int *p)
+{
+    __m256i s = _mm256_loadu_si256((const __m256i*) p);
+    for (int k=1; k<g_ssim_window; k++)
+        s = _mm256_add_epi32(s, _mm256_loadu_si256((const __m256i*) (p+k)));
+    return s;
+}
+
+
+TARGET_AVX2
+void ssim_row_avx2(const SsimSums *sums, int start, int nwin, float *map,
+                   double *ssim_sum, double *cs_sum)
+{
+    const __m256 c1 = _mm256_set1_ps(g_ssim_c1);
+    const __m256 c2 = _mm256_set1_ps(g_ssim_c2);
+    __m256 ssim_acc = _mm256_setzero_ps();
+    __m256 cs_acc = _mm256_setzero_ps();
+
+    int x = start;
+    for (; x + 8 <= nwin; x += 8) {
+        __m256i a = ssim_window_sum(&sums->a[x]);
+        __m256i b = ssim_window_sum(&sums->b[x]);
+        __m256i aa = ssim_window_sum(&sums->aa[x]);
+        __m256i bb = ssim_window_sum(&sums->bb[x]);
+        __m256i ab = ssim_window_sum(&sums->ab[x]);
+
+        // the sums of a window's pixels fit in 16 bits, so one multiply
+        // of the low halves gives each product
+        __m256i a_b = _mm256_madd_epi16(a, b);
+        __m256i a_a = _mm256_madd_epi16(a, a);
+        __m256i b_b = _mm256_madd_epi16(b, b);
+        __m256 l_num = _mm256_add_ps(
+            _mm256_cvtepi32_ps(_mm256_add_epi32(a_b, a_b)), c1);
+        __m256 l_den = _mm256_add_ps(
+            _mm256_cvtepi32_ps(_mm256_add_epi32(a_a, b_b)), c1);
+
+        // times the 64 pixels of a window
+        __m256i cov = _mm256_sub_epi32(_mm256_slli_epi32(ab, 6), a_b);
+        __m256i var = _mm256_sub_epi32(
+            _mm256_slli_epi32(_mm256_add_epi32(aa, bb), 6),
+            _mm256_add_epi32(a_a, b_b));
+        __m256 cs_num = _mm256_add_ps(
+            _mm256_cvtepi32_ps(_mm256_add_epi32(cov, cov)), c2);
+        __m256 cs_den = _mm256_add_ps(_mm256_cvtepi32_ps(var), c2);
+
+        // one reciprocal for both terms, refined by a Newton step
+        // (division is several times slower)
+        __m256 den = _mm256_mul_ps(l_den, cs_den);
+        __m256 r = _mm256_rcp_ps(den);
+        r = _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(2.0f),
+                                           _mm256_mul_ps(den, r)));
+        __m256 ssim = _mm256_mul_ps(_mm256_mul_ps(l_num, cs_num), r);
+        __m256 cs = _mm256_mul_ps(_mm256_mul_ps(cs_num, l_den), r);
+        ssim_acc = _mm256_add_ps(ssim_acc, ssim);
+        cs_acc = _mm256_add_ps(cs_acc, cs);
+        if (map)
+            _mm256_storeu_ps(map + x, ssim);
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, ssim_acc);
+    for (int i=0; i<8; i++)
+        *ssim_sum += lanes[i];
+    _mm256_storeu_ps(lanes, cs_acc);
+    for (int i=0; i<8; i++)
+        *cs_sum += lanes[i];
+
+    ssim_row_c(sums, x, nwin, map, ssim_sum, cs_sum);
+}
+
+
+//=============================================================================
+// Scoring
+
+// Score one band of rows of windows of a level
+struct SsimTask
+{
+    const GrayImage *a, *b;
+    int y0, y1;                 // rows of windows
+    float *map;                 // SSIM of each window, or NULL
+    int map_stride;
+    double ssim_sum, cs_sum;
+};
+
+
+void ssim_task(void *arg)
+{
+    static SsimColsFunc ssim_cols = (cpu_features() & CPU_AVX2) ?
+        ssim_cols_avx2 : ssim_cols_c;
+    static SsimRowFunc ssim_row = (cpu_features() & CPU_AVX2) ?
+        ssim_row_avx2 : ssim_row_c;
+
+    SsimTask *task = (SsimTask*) arg;
+    const GrayImage *a = task->a, *b = task->b;
+    int width = a->width;
+    int nwin = width - g_ssim_window + 1;
+
+    SsimSums sums;
+    sums.a.assign(width, 0);
+    sums.b.assign(width, 0);
+    sums.aa.assign(width, 0);
+    sums.bb.assign(width, 0);
+    sums.ab.assign(width, 0);
+
+    task->ssim_sum = 0.0;
+    task->cs_sum = 0.0;
+    for (int y=task->y0; y<task->y1; y++) {
+        if (y == task->y0) {
+            for (int k=0; k<g_ssim_window; k++)
+                ssim_cols(a->pixels + (y+k) * a->stride,
+                          b->pixels + (y+k) * b->stride, 0, width, 1,
+                          &sums);
+        } else {
+            // slide the window down a row
+            int add = y + g_ssim_window - 1, sub = y - 1;
+            ssim_cols(a->pixels + add * a->stride,
+                      b->pixels + add * b->stride, 0, width, 1, &sums);
+            ssim_cols(a->pixels + sub * a->stride,
+                      b->pixels + sub * b->stride, 0, width, -1, &sums);
+        }
+        ssim_row(&sums, 0, nwin,
+                 task->map ? task->map + y * task->map_stride : NULL,
+                 &task->ssim_sum, &task->cs_sum);
+    }
+}
+
+
+// Mean SSIM and contrast-structure term of the windows of two gray
+// images of the same size, at least g_ssim_window on a side.  Runs on
+// 'pool', or on this thread if it is NULL.
+void ssim_level(ThreadPool *pool, const GrayImage *a, const GrayImage *b,
+                float *map, double *ssim, double *cs)
+{
+    int nwin_x = a->width - g_ssim_window + 1;
+    int nwin_y = a->height - g_ssim_window + 1;
+    int nbands = pool ? pool->nthreads * g_ssim_bands : 1;
+
+    std::vector<SsimTask> tasks;
+    for (int i=0; i<nbands; i++) {
+        SsimTask task;
+        task.a = a;
+        task.b = b;
+        task.y0 = i * nwin_y / nbands;
+        task.y1 = (i + 1) * nwin_y / nbands;
+        task.map = map;
+        task.map_stride = nwin_x;
+        if (task.y1 > task.y0)
+            tasks.push_back(task);
+    }
+    for (unsigned int i=0; i<tasks.size(); i++) {
+        if (pool)
+            pool_add(pool, ssim_task, &tasks[i]);
+        else
+            ssim_task(&tasks[i]);
+    }
+    if (pool)
+        pool_wait(pool);
+
+    double ssim_sum = 0.0, cs_sum = 0.0;
+    for (unsigned int i=0; i<tasks.size(); i++) {
+        ssim_sum += tasks[i].ssim_sum;
+        cs_sum += tasks[i].cs_sum;
+    }
+    double count = (double) nwin_x * nwin_y;
+    *ssim = ssim_sum / count;
+    *cs = cs_sum / count;
+}
+
+
+// Draw the SSIM of each window into 'heatmap' over a faded gray copy of
+// 'frame': red where the frames differ, darker where 'ignore' (may be
+// NULL) leaves pixels out
+void ssim_draw_heatmap(const float *map, const Frame *frame,
+                       const Frame *ignore, Frame *heatmap)
+{
+    int nwin_x = frame->width - g_ssim_window + 1;
+    int nwin_y = frame->height - g_ssim_window + 1;
+    int half = g_ssim_window / 2;
+
+    // each pixel shows the window centered on it, or the nearest one
+    std::vector<int> cols(heatmap->width);
+    for (int x=0; x<heatmap->width; x++)
+        cols[x] = std::min(std::max(x - half, 0), nwin_x - 1);
+
+    // how red each window is, out of 256: 1 is identical, 0 and below
+    // unrelated
+    std::vector<int> heat(nwin_x);
+    int heat_row = -1;
+
+    for (int y=0; y<heatmap->height; y++) {
+        int r = std::min(std::max(y - half, 0), nwin_y - 1);
+        if (r != heat_row) {
+            const float *row = map + r * nwin_x;
+            for (int x=0; x<nwin_x; x++)
+                heat[x] = (int) (std::min(std::max(1.0f - row[x], 0.0f),
+                                          1.0f) * 256);
+            heat_row = r;
+        }
+
+        unsigned int *out = (unsigned int*) (heatmap->pixels +
+                                             y * heatmap->stride);
+        const unsigned char *p = frame->pixels + y * frame->stride;
+        const unsigned int *keep = mask_row(ignore, y);
+        for (int x=0; x<heatmap->width; x++) {
+            int gray = (p[x*4] + p[x*4+1] * 2 + p[x*4+2]) / 8;
+            if (!keep || keep[x])
+                gray += 128;
+            int h = heat[cols[x]];
+            unsigned int red = gray + (((255 - gray) * h) >> 8);
+            unsigned int rest = (gray * (256 - h)) >> 8;
+            out[x] = (red << 16) | (rest << 8) | rest;
+        }
+    }
+}
+
+
+// Compare two frames of the same size by SSIM, or by MS-SSIM over
+// 'scales' scales (as many as the size allows, at most
+// g_ssim_max_scales) if 'scales' > 1.  Pixels 'ignore' (may be NULL)
+// leaves out count as identical.  If 'heatmap' is given (a frame the
+// size of 'b'), the SSIM of the full-size windows is drawn in it.  If
+// 'threaded' is false, everything runs on the calling thread, for
+// callers that already keep every core busy.
+bool ssim_frames(const Frame *a, const Frame *b, const Frame *ignore,
+                 int scales, Frame *heatmap, double *score, bool threaded)
+{
+    if (a->width < g_ssim_window || a->height < g_ssim_window) {
+        printf("error: SSIM needs images of at least %dx%d pixels\n",
+               g_ssim_window, g_ssim_window);
+        return false;
+    }
+
+    ThreadPool threads, *pool = NULL;
+    if (threaded) {
+        if (!pool_init(&threads, 0))
+            return false;
+        pool = &threads;
+    }
+
+    // the scales that still hold a window
+    scales = std::min(std::max(scales, 1), g_ssim_max_scales);
+    int levels = 1;
+    while (levels < scales &&
+           std::min(a->width, a->height) >> levels >= g_ssim_window)
+        levels++;
+
+    GrayImage ga, gb;
+    ga.pixels = gb.pixels = NULL;
+    std::vector<float> map;
+    bool ret = gray_alloc(&ga, a->width, a->height) &&
+        gray_alloc(&gb, b->width, b->height);
+    if (ret && heatmap)
+        map.resize((a->width - g_ssim_window + 1) *
+                   (a->height - g_ssim_window + 1));
+
+    double total = 1.0, weights = 0.0;
+    for (int l=0; l<levels && ret; l++) {
+        std::vector<GrayTask> gray_tasks;
+        GrayTask proto;
+        if (l == 0 && pool) {
+            proto.frame = a;
+            proto.src = NULL;
+            proto.dst = &ga;
+            find_bands(pool, &proto, ga.height, &gray_tasks);
+            proto.frame = b;
+            proto.dst = &gb;
+            find_bands(pool, &proto, gb.height, &gray_tasks);
+        } else if (l == 0) {
+            gray_rows(a, &ga, 0, ga.height);
+            gray_rows(b, &gb, 0, gb.height);
+        }
+
+        if (l == 0) {
+            // ignored pixels of 'a' take the values of 'b'
+            for (int y=0; ignore && y<ga.height; y++) {
+                const unsigned int *keep = mask_row(ignore, y);
+                unsigned char *pa = ga.pixels + y * ga.stride;
+                const unsigned char *pb = gb.pixels + y * gb.stride;
+                for (int x=0; x<ga.width; x++)
+                    if (!keep[x])
+                        pa[x] = pb[x];
+            }
+        } else {
+            // halve both images in place: each row reads only rows at
+            // or below its own, so one pass from the top is safe
+            GrayImage ha = ga, hb = gb;
+            ha.width >>= 1;
+            ha.height >>= 1;
+            hb.width = ha.width;
+            hb.height = ha.height;
+            gray_half_rows(&ga, &ha, 0, ha.height);
+            gray_half_rows(&gb, &hb, 0, hb.height);
+            ga.width = gb.width = ha.width;
+            ga.height = gb.height = ha.height;
+        }
+
+        double ssim, cs;
+        ssim_level(pool, &ga, &gb, l == 0 && heatmap ? &map[0] : NULL,
+                   &ssim, &cs);
+
+        if (levels == 1) {
+            total = ssim;
+            weights = 1.0;
+        } else {
+            double w = g_ssim_weights[l];
+            double term = l == levels - 1 ? ssim : cs;
+            total *= pow(std::max(term, 0.0), w);
+            weights += w;
+        }
+    }
+    if (pool)
+        pool_free(pool);
+
+    if (ret) {
+        // scales left out share their weight
+        *score = pow(total, 1.0 / weights);
+        if (heatmap)
+            ssim_draw_heatmap(&map[0], b, ignore, heatmap);
+    }
+    gray_free(&ga);
+    gray_free(&gb);
+    return ret;
+}
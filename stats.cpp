@@ -0,0 +1,217 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Image statistics: per-channel histograms, mean and variance, the number
+  of distinct colors, and the dominant colors of a frame.
+
+  The frame is read once.  Each worker thread takes one band of rows and
+  fills its own partial counts (histograms, a bit per 24-bit color, and
+  coarse 4-4-4 color bins), so the workers never share a cache line;
+  the partials are summed at the end.  A job can be started before an
+  encode of the same frame and finished after it, so that both read the
+  pixels at the same time.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <algorithm>
+
+
+// dominant colors reported
+const int g_stats_dominant = 8;
+
+// coarse color bins: 4 bits per channel
+const int g_stats_bins = 4096;
+
+// words of the bitset with one bit per 24-bit color
+const int g_stats_seen_words = (1 << 24) / 32;
+
+
+// A dominant color: the mean of a coarse bin's pixels
+struct StatsColor
+{
+    unsigned int color;         // 0xRRGGBB
+    long long pixels;
+};
+
+
+struct ImageStats
+{
+    long long pixels;
+    long long hist[3][256];     // blue, green, red
+    double mean[3];
+    double variance[3];
+    long long distinct;         // distinct colors
+    std::vector<StatsColor> dominant;   // most common first
+};
+
+
+// One worker's share of the frame and its partial counts
+struct StatsTask
+{
+    const Frame *frame;
+    int y0, y1;
+    unsigned int hist[3][256];
+    unsigned int bins[g_stats_bins];
+    unsigned long long bin_sums[g_stats_bins][3];
+    unsigned int *seen;
+};
+
+
+struct StatsJob
+{
+    ThreadPool pool;
+    bool started;                   // false if the pool could not start
+    std::vector<StatsTask*> tasks;
+    const Frame *frame;
+};
+
+
+void stats_task(void *arg)
+{
+    StatsTask *task = (StatsTask*) arg;
+    const Frame *frame = task->frame;
+
+    for (int y=task->y0; y<task->y1; y++) {
+        const unsigned int *row = (const unsigned int*) (frame->pixels +
+                                                         y * frame->stride);
+        for (int x=0; x<frame->width; x++) {
+            unsigned int p = row[x] & 0x00ffffff;
+            unsigned int b = p & 0xff, g = (p >> 8) & 0xff, r = p >> 16;
+            task->hist[0][b]++;
+            task->hist[1][g]++;
+            task->hist[2][r]++;
+            task->seen[p >> 5] |= 1u << (p & 31);
+
+            unsigned int bin = ((r >> 4) << 8) | ((g >> 4) << 4) | (b >> 4);
+            task->bins[bin]++;
+            task->bin_sums[bin][0] += b;
+            task->bin_sums[bin][1] += g;
+            task->bin_sums[bin][2] += r;
+        }
+    }
+}
+
+
+// Start computing the statistics of 'frame', one band per worker.  The
+// frame must stay unchanged until stats_end().
+bool stats_begin(StatsJob *job, const Frame *frame)
+{
+    job->frame = frame;
+    job->tasks.clear();
+    job->started = pool_init(&job->pool, 0);
+    if (!job->started)
+        return false;
+
+    int nbands = job->pool.nthreads;
+    for (int i=0; i<nbands; i++) {
+        StatsTask *task = (StatsTask*) calloc(1, sizeof(StatsTask));
+        if (task)
+            task->seen = (unsigned int*) calloc(g_stats_seen_words,
+                                                sizeof(unsigned int));
+        if (!task || !task->seen) {
+            printf("error: out of memory\n");
+            free(task);
+            break;
+        }
+        task->frame = frame;
+        task->y0 = i * frame->height / nbands;
+        task->y1 = (i + 1) * frame->height / nbands;
+        job->tasks.push_back(task);
+    }
+
+    // queue only once every band exists, so a failure leaves no work
+    if ((int) job->tasks.size() == nbands)
+        for (int i=0; i<nbands; i++)
+            pool_add(&job->pool, stats_task, job->tasks[i]);
+    return (int) job->tasks.size() == nbands;
+}
+
+
+bool stats_color_more(const StatsColor &a, const StatsColor &b)
+{
+    return a.pixels > b.pixels;
+}
+
+
+// Wait for a job from stats_begin() and sum its partials into 'stats'.
+// Returns false if the job could not be started.
+bool stats_end(StatsJob *job, ImageStats *stats)
+{
+    if (!job->started)
+        return false;
+    pool_free(&job->pool);
+    int ntasks = job->tasks.size();
+    bool ret = ntasks == job->pool.nthreads;
+
+    memset(stats->hist, 0, sizeof(stats->hist));
+    std::vector<long long> bins(g_stats_bins);
+    std::vector<unsigned long long> bin_sums(g_stats_bins * 3);
+    for (int i=0; ret && i<ntasks; i++) {
+        StatsTask *task = job->tasks[i];
+        for (int c=0; c<3; c++)
+            for (int v=0; v<256; v++)
+                stats->hist[c][v] += task->hist[c][v];
+        for (int k=0; k<g_stats_bins; k++) {
+            bins[k] += task->bins[k];
+            for (int c=0; c<3; c++)
+                bin_sums[k*3 + c] += task->bin_sums[k][c];
+        }
+
+        // fold every bitset into the first
+        if (i > 0) {
+            unsigned int *seen = job->tasks[0]->seen;
+            for (int w=0; w<g_stats_seen_words; w++)
+                seen[w] |= task->seen[w];
+        }
+    }
+
+    if (ret) {
+        stats->pixels = (long long) job->frame->width * job->frame->height;
+        for (int c=0; c<3; c++) {
+            double sum = 0.0, sum_sq = 0.0;
+            for (int v=0; v<256; v++) {
+                sum += (double) stats->hist[c][v] * v;
+                sum_sq += (double) stats->hist[c][v] * v * v;
+            }
+            double n = stats->pixels > 0 ? (double) stats->pixels : 1.0;
+            stats->mean[c] = sum / n;
+            stats->variance[c] = sum_sq / n - stats->mean[c] * stats->mean[c];
+        }
+
+        stats->distinct = 0;
+        const unsigned int *seen = job->tasks[0]->seen;
+        for (int w=0; w<g_stats_seen_words; w++)
+            stats->distinct += __builtin_popcount(seen[w]);
+
+        stats->dominant.clear();
+        for (int k=0; k<g_stats_bins; k++) {
+            if (bins[k] == 0)
+                continue;
+            StatsColor c;
+            c.pixels = bins[k];
+            c.color = ((bin_sums[k*3 + 2] / bins[k]) << 16) |
+                ((bin_sums[k*3 + 1] / bins[k]) << 8) |
+                (bin_sums[k*3] / bins[k]);
+            stats->dominant.push_back(c);
+        }
+        std::sort(stats->dominant.begin(), stats->dominant.end(),
+                  stats_color_more);
+        if ((int) stats->dominant.size() > g_stats_dominant)
+            stats->dominant.resize(g_stats_dominant);
+    }
+
+    for (int i=0; i<ntasks; i++) {
+        free(job->tasks[i]->seen);
+        free(job->tasks[i]);
+    }
+    job->tasks.clear();
+    return ret;
+}
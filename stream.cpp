@@ -0,0 +1,189 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Frame streams: frames written back to back to stdout, a pipe, or a file,
+  each preceded by a fixed-size header, so a consumer can read them without
+  temporary files.  Writes bypass the C runtime (which may be in text
+  mode) and go straight to the OS handle in large blocks.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// windows includes
+#include <windows.h>
+
+
+// Header before every frame on a stream (little endian, 40 bytes).  Raw
+// frames are tagged "BGRA" but hold BGRX pixels: the fourth byte is
+// padding with no defined value, not alpha.
+struct StreamHeader
+{
+    char magic[4];                  // "BXCF"
+    unsigned int header_size;       // sizeof(StreamHeader)
+    unsigned int width;
+    unsigned int height;
+    unsigned int stride;            // bytes per row for "BGRA", else 0
+    char format[4];                 // "BGRA", "PNG ", "BMP ", or "QOI "
+    unsigned long long timestamp;   // microseconds since 1970-01-01 UTC
+    unsigned long long size;        // bytes of frame data that follow
+};
+
+
+// small writes are gathered into blocks of this size
+const int g_stream_block = 1 << 20;
+
+
+struct StreamWriter
+{
+    HANDLE handle;
+    bool owned;             // close the handle when done
+    unsigned char *buf;
+    int used;
+};
+
+
+// Open a stream on a file, or on stdout if filename is "-"
+bool stream_open(StreamWriter *stream, const char *filename)
+{
+    if (strcmp(filename, "-") == 0) {
+        stream->handle = GetStdHandle(STD_OUTPUT_HANDLE);
+        stream->owned = false;
+    } else {
+        stream->handle = CreateFile(filename, GENERIC_WRITE, 0, NULL,
+                                    CREATE_ALWAYS,
+                                    FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        stream->owned = true;
+    }
+    if (!stream->handle || stream->handle == INVALID_HANDLE_VALUE) {
+        printf("error: cannot open output '%s'\n", filename);
+        return false;
+    }
+
+    stream->buf = (unsigned char*) malloc(g_stream_block);
+    stream->used = 0;
+    return true;
+}
+
+
+// Write directly to the handle
+bool stream_write_through(StreamWriter *stream, const void *data,
+                          size_t size)
+{
+    const unsigned char *p = (const unsigned char*) data;
+    while (size > 0) {
+        DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD) size;
+        DWORD written;
+        if (!WriteFile(stream->handle, p, chunk, &written, NULL) ||
+            written == 0) {
+            printf("error: cannot write output stream\n");
+            return false;
+        }
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+
+// Write out any gathered data
+bool stream_flush(StreamWriter *stream)
+{
+    bool ret = stream_write_through(stream, stream->buf, stream->used);
+    stream->used = 0;
+    return ret;
+}
+
+
+// Write data, gathering small pieces into blocks
+bool stream_write(StreamWriter *stream, const void *data, size_t size)
+{
+    if (stream->used + size <= (size_t) g_stream_block) {
+        memcpy(stream->buf + stream->used, data, size);
+        stream->used += size;
+        return true;
+    }
+
+    // big writes skip the block buffer
+    return stream_flush(stream) &&
+        stream_write_through(stream, data, size);
+}
+
+
+// Overwrite bytes already written at 'offset' (files only)
+bool stream_patch(StreamWriter *stream, unsigned int offset, 
+                  const void *data, int size)
+{
+    if (!stream_flush(stream))
+        return false;
+
+    LONG high = 0;
+    bool ret = SetFilePointer(stream->handle, offset, &high, FILE_BEGIN) != 
+        INVALID_SET_FILE_POINTER && 
+        stream_write_through(stream, data, size);
+    high = 0;
+    SetFilePointer(stream->handle, 0, &high, FILE_END);
+    return ret;
+}
+
+
+void stream_close(StreamWriter *stream)
+{
+    stream_flush(stream);
+    if (stream->owned)
+        CloseHandle(stream->handle);
+    free(stream->buf);
+}
+
+
+// Current time in microseconds since 1970-01-01 UTC
+unsigned long long stream_timestamp()
+{
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    unsigned long long t = ((unsigned long long) ft.dwHighDateTime << 32) |
+        ft.dwLowDateTime;
+    return (t - 116444736000000000ULL) / 10;
+}
+
+
+// Write one frame as raw pixels ("raw") or encoded ("png", "bmp", "qoi")
+bool stream_write_frame(StreamWriter *stream, Frame *frame,
+                        const char *format, unsigned long long timestamp)
+{
+    StreamHeader header;
+    memcpy(header.magic, "BXCF", 4);
+    header.header_size = sizeof(StreamHeader);
+    header.width = frame->width;
+    header.height = frame->height;
+    header.timestamp = timestamp;
+
+    if (strcasecmp(format, "raw") == 0) {
+        memcpy(header.format, "BGRA", 4);
+        header.stride = frame->stride;
+        header.size = (unsigned long long) frame->stride * frame->height;
+        return stream_write(stream, &header, sizeof(header)) &&
+            stream_write(stream, frame->pixels, header.size);
+    }
+
+    unsigned char *data;
+    int size;
+    if (!encode_frame(frame, format, &data, &size))
+        return false;
+
+    memset(header.format, ' ', 4);
+    for (int i=0; i<4 && format[i]; i++)
+        header.format[i] = toupper(format[i]);
+    header.stride = 0;
+    header.size = size;
+    bool ret = stream_write(stream, &header, sizeof(header)) &&
+        stream_write(stream, data, size);
+    free(data);
+    return ret;
+}
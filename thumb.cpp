@@ -0,0 +1,455 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Thumbnails: downscaled copies of a capture, saved next to it.
+
+  A thumbnail is made in two steps.  The frame is first shrunk by the
+  largest whole factors kx and ky that fit: rows are added ky at a time
+  into 16-bit sums with AVX2 or SSE2, and each run of kx sums is
+  averaged.  When the capture is an exact multiple of the thumbnail (as
+  with 2x and 3x HiDPI screens), that is all.  Otherwise the rest of the
+  scale (less than 2) is an area filter over the small intermediate
+  image, weighting each pixel by how much of it an output pixel covers.
+  It makes one output row at a time: the (at most three) source rows
+  under it are blended into a single row of floats, one SSE2 register
+  per pixel, which is then blended across.
+
+  The thumbnails of a capture are made and saved on the thread pool
+  while the full-size image is encoded, so they read the frame while it
+  is still in cache.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+// windows includes
+#include <windows.h>
+
+#include <vector>
+#include <algorithm>
+
+
+// largest box factor ky whose sums fit 16 bits
+const int g_thumb_max_rows = 257;
+
+
+// The box a thumbnail must fit in
+struct ThumbSize
+{
+    int width, height;
+};
+
+
+// Make the filename 'name_WxH.ext' from 'name.ext'
+void thumb_filename(char *out, int size, const char *filename,
+                    const ThumbSize *box)
+{
+    const char *ext = strrchr(filename, '.');
+    const char *slash = strrchr(filename, '\\');
+    if (!slash)
+        slash = strrchr(filename, '/');
+    if (!ext || (slash && ext < slash))
+        ext = filename + strlen(filename);
+
+    snprintf(out, size, "%.*s_%dx%d%s", (int) (ext - filename), filename,
+             box->width, box->height, ext);
+}
+
+
+// Size of a frame scaled down (never up) to fit 'box', keeping its shape
+void thumb_fit(const Frame *frame, const ThumbSize *box, int *width,
+               int *height)
+{
+    double scale = std::min(std::min((double) box->width / frame->width,
+                                     (double) box->height / frame->height),
+                            1.0);
+    *width = std::max((int) (frame->width * scale + 0.5), 1);
+    *height = std::max((int) (frame->height * scale + 0.5), 1);
+}
+
+
+//=============================================================================
+// Box filter: whole factors
+
+// Add bytes [start, size) of a row to 16-bit 'sums'.  'start' is a
+// multiple of 16.
+typedef void (*ThumbSumFunc)(const unsigned char *row, int start, int size,
+                             unsigned short *sums);
+
+
+void thumb_sum_c(const unsigned char *row, int start, int size,
+                 unsigned short *sums)
+{
+    for (int i=start; i<size; i++)
+        sums[i] += row[i];
+}
+
+
+TARGET_SSE2
+void thumb_sum_sse2(const unsigned char *row, int start, int size,
+                    unsigned short *sums)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = start;
+    for (; i + 16 <= size; i += 16) {
+        __m128i p = _mm_loadu_si128((const __m128i*) (row + i));
+        __m128i *s = (__m128i*) (sums + i);
+        _mm_storeu_si128(s, _mm_add_epi16(_mm_loadu_si128(s),
+                                          _mm_unpacklo_epi8(p, zero)));
+        _mm_storeu_si128(s + 1, _mm_add_epi16(_mm_loadu_si128(s + 1),
+                                              _mm_unpackhi_epi8(p, zero)));
+    }
+    thumb_sum_c(row, i, size, sums);
+}
+
+
+TARGET_AVX2
+void thumb_sum_avx2(const unsigned char *row, int start, int size,
+                    unsigned short *sums)
+{
+    int i = start;
+    for (; i + 32 <= size; i += 32) {
+        __m256i lo = _mm256_cvtepu8_epi16(
+            _mm_loadu_si128((const __m128i*) (row + i)));
+        __m256i hi = _mm256_cvtepu8_epi16(
+            _mm_loadu_si128((const __m128i*) (row + i + 16)));
+        __m256i *s = (__m256i*) (sums + i);
+        _mm256_storeu_si256(s, _mm256_add_epi16(_mm256_loadu_si256(s), lo));
+        _mm256_storeu_si256(s + 1, _mm256_add_epi16(_mm256_loadu_si256(s + 1),
+                                                    hi));
+    }
+    thumb_sum_sse2(row, i, size, sums);
+}
+
+
+ThumbSumFunc thumb_sum_func()
+{
+    int features = cpu_features();
+    if (features & CPU_AVX2)
+        return thumb_sum_avx2;
+    if (features & CPU_SSE2)
+        return thumb_sum_sse2;
+    return thumb_sum_c;
+}
+
+
+// Shrink 'src' by whole factors into a new frame 'dst': each pixel is
+// the rounded mean of a kx x ky block
+bool thumb_box(const Frame *src, int kx, int ky, Frame *dst)
+{
+    static ThumbSumFunc thumb_sum = thumb_sum_func();
+
+    int width = src->width / kx, height = src->height / ky;
+    if (!frame_create(dst, 0, 0, width, height))
+        return false;
+
+    // (s + n/2) / n as a multiply, exact while n < 4096
+    unsigned int n = kx * ky;
+    unsigned long long recip = ((1ull << 32) + n - 1) / n;
+    bool exact = n < 4096;
+
+    int bytes = width * kx * 4;
+    std::vector<unsigned short> sums(bytes);
+    for (int y=0; y<height; y++) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int i=0; i<ky; i++)
+            thumb_sum(src->pixels + (y * ky + i) * src->stride, 0, bytes,
+                      &sums[0]);
+
+        unsigned char *out = dst->pixels + y * dst->stride;
+        for (int x=0; x<width; x++) {
+            const unsigned short *block = &sums[x * kx * 4];
+            for (int c=0; c<3; c++) {
+                unsigned int s = n / 2;
+                for (int j=0; j<kx; j++)
+                    s += block[j*4 + c];
+                out[x*4 + c] = exact ? (s * recip) >> 32 : s / n;
+            }
+            out[x*4 + 3] = 0;
+        }
+    }
+    return true;
+}
+
+
+//=============================================================================
+// Area filter: the rest of the scale
+
+// Weights of the source pixels under each output pixel along one axis
+struct ThumbSpan
+{
+    int first;
+    std::vector<float> weights;
+};
+
+
+void thumb_spans(int src_size, int dst_size, std::vector<ThumbSpan> *spans)
+{
+    double scale = (double) src_size / dst_size;
+    spans->resize(dst_size);
+    for (int i=0; i<dst_size; i++) {
+        double begin = i * scale, end = (i + 1) * scale;
+        ThumbSpan &span = (*spans)[i];
+        span.first = (int) begin;
+        span.weights.clear();
+        for (int j=span.first; j<end && j<src_size; j++) {
+            double cover = std::min(end, j + 1.0) -
+                std::max(begin, (double) j);
+            span.weights.push_back(cover / scale);
+        }
+    }
+}
+
+
+// Make one output row of the area filter: blend the source rows 'rows'
+// ('span' says their weights) into 'blend' (4 floats per source pixel),
+// then blend that across by 'xs' into the 'width' pixels of 'out'
+typedef void (*ThumbAreaRowFunc)(const unsigned char *const *rows,
+                                 const ThumbSpan *span, int src_width,
+                                 const ThumbSpan *xs, int width,
+                                 float *blend, unsigned char *out);
+
+
+void thumb_area_row_c(const unsigned char *const *rows,
+                      const ThumbSpan *span, int src_width,
+                      const ThumbSpan *xs, int width, float *blend,
+                      unsigned char *out)
+{
+    int n = span->weights.size();
+    for (int i=0; i<src_width*4; i++) {
+        float sum = 0.0f;
+        for (int j=0; j<n; j++)
+            sum += span->weights[j] * rows[j][i];
+        blend[i] = sum;
+    }
+
+    for (int x=0; x<width; x++) {
+        const ThumbSpan &cols = xs[x];
+        for (int c=0; c<3; c++) {
+            float sum = 0.0f;
+            for (unsigned int j=0; j<cols.weights.size(); j++)
+                sum += cols.weights[j] * blend[(cols.first + j) * 4 + c];
+            out[x*4 + c] = (unsigned char) std::min(sum + 0.5f, 255.0f);
+        }
+        out[x*4 + 3] = 0;
+    }
+}
+
+
+TARGET_SSE2
+void thumb_area_row_sse2(const unsigned char *const *rows,
+                         const ThumbSpan *span, int src_width,
+                         const ThumbSpan *xs, int width, float *blend,
+                         unsigned char *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int n = span->weights.size();
+
+    // down: four pixels (16 channels) at a time
+    int x = 0;
+    for (; x + 4 <= src_width; x += 4) {
+        __m128 sum[4] = {_mm_setzero_ps(), _mm_setzero_ps(),
+                         _mm_setzero_ps(), _mm_setzero_ps()};
+        for (int j=0; j<n; j++) {
+            __m128 w = _mm_set1_ps(span->weights[j]);
+            __m128i p = _mm_loadu_si128((const __m128i*) (rows[j] + x*4));
+            __m128i lo = _mm_unpacklo_epi8(p, zero);
+            __m128i hi = _mm_unpackhi_epi8(p, zero);
+            __m128i px[4] = {_mm_unpacklo_epi16(lo, zero),
+                             _mm_unpackhi_epi16(lo, zero),
+                             _mm_unpacklo_epi16(hi, zero),
+                             _mm_unpackhi_epi16(hi, zero)};
+            for (int k=0; k<4; k++)
+                sum[k] = _mm_add_ps(sum[k], _mm_mul_ps(
+                                        w, _mm_cvtepi32_ps(px[k])));
+        }
+        for (int k=0; k<4; k++)
+            _mm_storeu_ps(blend + (x + k) * 4, sum[k]);
+    }
+    for (; x<src_width; x++) {
+        __m128 sum = _mm_setzero_ps();
+        for (int j=0; j<n; j++) {
+            __m128i p = _mm_cvtsi32_si128(
+                *(const int*) (rows[j] + x*4));
+            p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(p, zero), zero);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(span->weights[j]),
+                                             _mm_cvtepi32_ps(p)));
+        }
+        _mm_storeu_ps(blend + x*4, sum);
+    }
+
+    // across: one pixel per register
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 top = _mm_set1_ps(255.0f);
+    const __m128i color = _mm_set1_epi32(0x00ffffff);
+    for (x=0; x<width; x++) {
+        const ThumbSpan &cols = xs[x];
+        __m128 sum = _mm_setzero_ps();
+        for (unsigned int j=0; j<cols.weights.size(); j++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(
+                                 _mm_set1_ps(cols.weights[j]),
+                                 _mm_loadu_ps(blend +
+                                              (cols.first + j) * 4)));
+        __m128i p = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(sum, half), top));
+        p = _mm_packus_epi16(_mm_packs_epi32(p, p), zero);
+        *(int*) (out + x*4) = _mm_cvtsi128_si32(_mm_and_si128(p, color));
+    }
+}
+
+
+ThumbAreaRowFunc thumb_area_row_func()
+{
+    if (cpu_features() & CPU_SSE2)
+        return thumb_area_row_sse2;
+    return thumb_area_row_c;
+}
+
+
+// Scale 'src' down to the size of 'dst' (less than 2x in each direction
+// after thumb_box) by area averaging, one output row at a time
+void thumb_area(const Frame *src, Frame *dst)
+{
+    static ThumbAreaRowFunc area_row = thumb_area_row_func();
+
+    std::vector<ThumbSpan> xs, ys;
+    thumb_spans(src->width, dst->width, &xs);
+    thumb_spans(src->height, dst->height, &ys);
+
+    std::vector<float> blend(src->width * 4);
+    std::vector<const unsigned char*> rows;
+    for (int y=0; y<dst->height; y++) {
+        const ThumbSpan &span = ys[y];
+        rows.clear();
+        for (unsigned int j=0; j<span.weights.size(); j++)
+            rows.push_back(src->pixels + (span.first + j) * src->stride);
+        area_row(&rows[0], &span, src->width, &xs[0], dst->width,
+                 &blend[0], dst->pixels + y * dst->stride);
+    }
+}
+
+
+//=============================================================================
+// Making and saving thumbnails
+
+// Scale 'frame' down into a new frame 'thumb' that fits 'box'
+bool thumb_make(const Frame *frame, const ThumbSize *box, Frame *thumb)
+{
+    int width, height;
+    thumb_fit(frame, box, &width, &height);
+    int kx = frame->width / width;
+    int ky = std::min(frame->height / height, g_thumb_max_rows);
+
+    Frame mid;
+    const Frame *src = frame;
+    if (kx > 1 || ky > 1) {
+        if (!thumb_box(frame, kx, ky, &mid))
+            return false;
+        if (mid.width == width && mid.height == height) {
+            *thumb = mid;
+            return true;
+        }
+        src = &mid;
+    }
+
+    bool ret = frame_create(thumb, 0, 0, width, height);
+    if (ret)
+        thumb_area(src, thumb);
+    if (src == &mid)
+        frame_free(&mid);
+    return ret;
+}
+
+
+// Save a thumbnail of 'frame' that fits 'box' next to 'filename'
+bool thumb_save(const Frame *frame, const ThumbSize *box,
+                const char *filename)
+{
+    char name[MAX_PATH];
+    thumb_filename(name, MAX_PATH, filename, box);
+    Frame thumb;
+    if (!thumb_make(frame, box, &thumb)) {
+        printf("error: cannot make thumbnail '%s'\n", name);
+        return false;
+    }
+    bool ret = save_frame(&thumb, name);
+    if (ret)
+        printf("thumbnail saved to file: %s\n", name);
+    else
+        printf("error: cannot save thumbnail '%s'\n", name);
+    frame_free(&thumb);
+    return ret;
+}
+
+
+// One thumbnail being made by a worker
+struct ThumbTask
+{
+    const Frame *frame;
+    ThumbSize box;
+    const char *filename;
+    bool ok;
+};
+
+
+struct ThumbJob
+{
+    ThreadPool pool;
+    bool started;
+    std::vector<ThumbTask> tasks;
+};
+
+
+void thumb_task(void *arg)
+{
+    ThumbTask *task = (ThumbTask*) arg;
+    task->ok = thumb_save(task->frame, &task->box, task->filename);
+}
+
+
+// Start making and saving the thumbnails 'boxes' of 'frame' (saved as
+// 'filename') on the thread pool.  The frame must stay unchanged until
+// thumb_end().
+bool thumb_begin(ThumbJob *job, const Frame *frame,
+                 const std::vector<ThumbSize> &boxes, const char *filename)
+{
+    job->tasks.clear();
+    job->started = !boxes.empty() && pool_init(&job->pool, 0);
+    if (!job->started)
+        return boxes.empty();
+
+    png_startup();
+    for (unsigned int i=0; i<boxes.size(); i++) {
+        ThumbTask task;
+        task.frame = frame;
+        task.box = boxes[i];
+        task.filename = filename;
+        task.ok = false;
+        job->tasks.push_back(task);
+    }
+    for (unsigned int i=0; i<job->tasks.size(); i++)
+        pool_add(&job->pool, thumb_task, &job->tasks[i]);
+    return true;
+}
+
+
+// Wait for the thumbnails from thumb_begin().  Returns false if one could
+// not be saved.
+bool thumb_end(ThumbJob *job)
+{
+    if (!job->started)
+        return true;
+    pool_free(&job->pool);
+    png_shutdown();
+
+    bool ret = true;
+    for (unsigned int i=0; i<job->tasks.size(); i++)
+        ret = ret && job->tasks[i].ok;
+    job->tasks.clear();
+    return ret;
+}
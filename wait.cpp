@@ -0,0 +1,218 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Waiting for the screen: poll a region until it stops changing or until
+  it changes, then hand back the last frame.
+
+  Each poll grabs into one of two frames that live for the whole wait.
+  A sparse hash of a fixed scatter of pixels decides cheaply whether a
+  poll can differ at all; only when it says "same" is the poll compared
+  with the frame it is held against, every 16th row first, with the SIMD
+  row kernels of compare.cpp, to catch changes between the sample points.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <string.h>
+
+// windows includes
+#include <windows.h>
+
+#include <vector>
+
+
+// pixels in the sparse hash
+const int g_wait_samples = 1024;
+
+// rows compared first when the sparse hashes match: every this many
+const int g_wait_row_step = 16;
+
+
+enum {
+    WAIT_STABLE,        // until unchanged for a number of polls
+    WAIT_CHANGE         // until different from the first poll
+};
+
+enum {
+    WAIT_DONE,
+    WAIT_EXPIRED,
+    WAIT_ERROR
+};
+
+
+// Sample points of the sparse hash
+struct WaitSampler
+{
+    std::vector<unsigned int> offsets;  // byte offsets into the frame
+    std::vector<unsigned int> keep;     // ignore-mask words of the points
+};
+
+
+// Scatter the sample points over a frame's area: one per cell of a grid,
+// at a fixed pseudo-random spot inside the cell so that regular patterns
+// (text lines, grids) are not sampled in lockstep
+void wait_init_sampler(WaitSampler *sampler, const Frame *frame,
+                       const Frame *ignore)
+{
+    int cols = 1, rows = 1;
+    while (cols * rows < g_wait_samples) {
+        if (frame->width / (cols + 1) >= frame->height / (rows + 1) &&
+            cols < frame->width)
+            cols++;
+        else if (rows < frame->height)
+            rows++;
+        else
+            break;
+    }
+
+    unsigned int seed = 12345;
+    sampler->offsets.clear();
+    sampler->keep.clear();
+    for (int r=0; r<rows; r++) {
+        int y0 = r * frame->height / rows;
+        int h = (r + 1) * frame->height / rows - y0;
+        for (int c=0; c<cols; c++) {
+            int x0 = c * frame->width / cols;
+            int w = (c + 1) * frame->width / cols - x0;
+            seed = seed * 1103515245 + 12345;
+            int x = x0 + (seed >> 16) % w;
+            seed = seed * 1103515245 + 12345;
+            int y = y0 + (seed >> 16) % h;
+
+            sampler->offsets.push_back(y * frame->stride + x * 4);
+            sampler->keep.push_back(ignore ? mask_row(ignore, y)[x] :
+                                    g_mask_keep);
+        }
+    }
+}
+
+
+unsigned long long wait_sample_hash(const WaitSampler *sampler,
+                                    const Frame *frame)
+{
+    unsigned long long h = g_fnv_basis;
+    int n = sampler->offsets.size();
+    for (int i=0; i<n; i++) {
+        unsigned int p = *(const unsigned int*) (frame->pixels +
+                                                 sampler->offsets[i]);
+        h = (h ^ (p & sampler->keep[i])) * g_fnv_prime;
+    }
+    return h;
+}
+
+
+// Whether two frames of the same size show the same pixels, leaving out
+// those 'ignore' (may be NULL) masks.  Every g_wait_row_step-th row is
+// compared first, so most changes the sparse hash missed are found
+// after reading a fraction of the frames; the first difference ends it.
+bool wait_frames_equal(const Frame *a, const Frame *b, const Frame *ignore)
+{
+    static CompareRowFunc compare_row = compare_row_func();
+
+    int max_diff = 0;
+    for (int phase=0; phase<g_wait_row_step; phase++) {
+        for (int y=phase; y<a->height; y+=g_wait_row_step) {
+            if (compare_row(a->pixels + y * a->stride,
+                            b->pixels + y * b->stride, 0, a->width, 0,
+                            mask_row(ignore, y), NULL, &max_diff) > 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+
+// Poll the screen rectangle (x,y)-(x2,y2) every 'poll' milliseconds.
+// WAIT_STABLE returns once 'stable_count' polls in a row were unchanged;
+// WAIT_CHANGE returns once a poll differs from 'from' (a frame of the
+// same rectangle), or from the first poll if 'from' is NULL.  Gives up
+// after 'timeout' milliseconds (never if timeout <= 0).  Pixels 'ignore'
+// (may be NULL) leaves out are not looked at.  On WAIT_DONE and
+// WAIT_EXPIRED, 'result' receives the last frame polled.
+int wait_screen(int mode, int stable_count, int x, int y, int x2, int y2,
+                int poll, int timeout, const Frame *ignore, const Frame *from,
+                Frame *result)
+{
+    Frame frames[2];
+    if (!frame_create(&frames[0], x, y, x2 - x, y2 - y))
+        return WAIT_ERROR;
+    if (!frame_create(&frames[1], x, y, x2 - x, y2 - y)) {
+        frame_free(&frames[0]);
+        return WAIT_ERROR;
+    }
+
+    HDC screen_dc = GetDC(0);
+    WaitSampler sampler;
+    wait_init_sampler(&sampler, &frames[0], ignore);
+
+    // sparse hash of the frame the polls are held against: the previous
+    // poll for WAIT_STABLE, 'from' or the first one for WAIT_CHANGE
+    unsigned long long ref_sample = from ? wait_sample_hash(&sampler, from) :
+        0;
+
+    int ret = WAIT_ERROR;
+    int ref = 0, cur = 0;
+    int unchanged = 0;
+    DWORD start = GetTickCount();
+
+    for (int n=0; ; n++) {
+        if (n > 0) {
+            DWORD due = start + n * poll;
+            LONG wait = (LONG) (due - GetTickCount());
+            if (wait > 0)
+                Sleep(wait);
+        }
+
+        if (!frame_grab(&frames[cur], screen_dc))
+            break;
+        unsigned long long sample = wait_sample_hash(&sampler, &frames[cur]);
+
+        if (n == 0 && !from) {
+            ref_sample = sample;
+        } else {
+            // maybe the same: check every pixel
+            bool same = sample == ref_sample &&
+                wait_frames_equal(&frames[cur], from ? from : &frames[ref],
+                                  ignore);
+
+            if (mode == WAIT_CHANGE) {
+                if (!same) {
+                    ret = WAIT_DONE;
+                    break;
+                }
+            } else {
+                unchanged = same ? unchanged + 1 : 0;
+                if (unchanged >= stable_count) {
+                    ret = WAIT_DONE;
+                    break;
+                }
+
+                // this poll is the next one's reference
+                ref_sample = sample;
+                ref = cur;
+            }
+        }
+
+        if (timeout > 0 && (LONG) (GetTickCount() - start) >= timeout) {
+            ret = WAIT_EXPIRED;
+            break;
+        }
+
+        // grab into the frame that is not the reference
+        if (mode == WAIT_STABLE || n == 0)
+            cur = 1 - ref;
+    }
+
+    ReleaseDC(0, screen_dc);
+    if (ret == WAIT_ERROR) {
+        frame_free(&frames[0]);
+        frame_free(&frames[1]);
+    } else {
+        *result = frames[cur];
+        frame_free(&frames[1 - cur]);
+    }
+    return ret;
+}
@@ -0,0 +1,150 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Window capture: find top-level windows by title or handle and render
+  each one into its own frame with PrintWindow(), which works even when
+  the window is covered by other windows.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <vector>
+
+// windows includes
+#include <windows.h>
+
+// ask the window to render DirectX/DWM content as well (Windows 8.1+)
+#ifndef PW_RENDERFULLCONTENT
+#define PW_RENDERFULLCONTENT 0x00000002
+#endif
+
+
+// A top-level window to capture
+struct WindowInfo
+{
+    HWND hwnd;
+    char title[256];
+};
+
+
+struct FindWindowsData
+{
+    const char *title;      // substring to match, NULL for all windows
+    bool minimized;         // whether to find minimized windows
+    std::vector<WindowInfo> *windows;
+};
+
+
+// Case-insensitive substring search
+bool contains_nocase(const char *text, const char *pattern)
+{
+    int n = strlen(pattern);
+    for (; *text; text++)
+        if (strncasecmp(text, pattern, n) == 0)
+            return true;
+    return n == 0;
+}
+
+
+BOOL CALLBACK find_windows_proc(HWND hwnd, LPARAM lparam)
+{
+    FindWindowsData *data = (FindWindowsData*) lparam;
+
+    // only visible application windows with a title
+    if (!IsWindowVisible(hwnd) || (!data->minimized && IsIconic(hwnd)) ||
+        GetWindow(hwnd, GW_OWNER) ||
+        (GetWindowLong(hwnd, GWL_EXSTYLE) & WS_EX_TOOLWINDOW))
+        return TRUE;
+
+    WindowInfo info;
+    info.hwnd = hwnd;
+    if (GetWindowText(hwnd, info.title, sizeof(info.title)) == 0)
+        return TRUE;
+
+    if (!data->title || contains_nocase(info.title, data->title))
+        data->windows->push_back(info);
+    return TRUE;
+}
+
+
+// Find the windows named by 'spec': "all", a window handle ("0x" and hex
+// digits, or "handle:" and a number), or a substring of the window title.
+// Minimized windows, which have nothing to render, are only found by
+// handle unless 'minimized' is set.
+bool find_windows(const char *spec, bool minimized,
+                  std::vector<WindowInfo> *windows)
+{
+    windows->clear();
+
+    // window handle
+    const char *digits = NULL;
+    if (strncasecmp(spec, "handle:", 7) == 0)
+        digits = spec + 7;
+    else if (strncasecmp(spec, "0x", 2) == 0)
+        digits = spec;
+    char *end = NULL;
+    unsigned long handle = digits ? strtoul(digits, &end, 0) : 0;
+    if (digits && (!*digits || *end != '\0')) {
+        printf("error: bad window handle '%s'\n", spec);
+        return false;
+    }
+    if (digits) {
+        WindowInfo info;
+        info.hwnd = (HWND) (ULONG_PTR) handle;
+        if (!IsWindow(info.hwnd)) {
+            printf("error: no window with handle '%s'\n", spec);
+            return false;
+        }
+        GetWindowText(info.hwnd, info.title, sizeof(info.title));
+        windows->push_back(info);
+        return true;
+    }
+
+    FindWindowsData data;
+    data.title = (strcasecmp(spec, "all") == 0) ? NULL : spec;
+    data.minimized = minimized;
+    data.windows = windows;
+    EnumWindows(find_windows_proc, (LPARAM) &data);
+
+    if (windows->empty()) {
+        printf("error: no window matches '%s'\n", spec);
+        return false;
+    }
+    return true;
+}
+
+
+// Render a window into a new frame, whether or not it is covered
+bool frame_print_window(Frame *frame, HWND hwnd)
+{
+    RECT rect;
+    if (IsIconic(hwnd) || !GetWindowRect(hwnd, &rect)) {
+        printf("error: window %p is minimized\n", hwnd);
+        return false;
+    }
+
+    if (!frame_create(frame, rect.left, rect.top,
+                      rect.right - rect.left, rect.bottom - rect.top))
+        return false;
+
+    void *before = g_frame_prefilter ? g_frame_prefilter(frame) : NULL;
+    if (!PrintWindow(hwnd, frame->dc, PW_RENDERFULLCONTENT)) {
+        printf("error: PrintWindow failed for window %p\n", hwnd);
+        free(before);
+        frame_free(frame);
+        return false;
+    }
+
+    GdiFlush();
+    if (g_frame_filter)
+        g_frame_filter(frame, before);
+    free(before);
+    return true;
+}
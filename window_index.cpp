@@ -0,0 +1,409 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  Window index: the rectangles of all visible top-level and child windows,
+  bucketed into a uniform grid of screen cells so that finding the topmost
+  window under a point only looks at the few windows overlapping that
+  point's cell.  The index is built once and then patched from WinEvent
+  notifications as windows move, appear, disappear, or come to the front.
+
+=============================================================================*/
+
+// c includes
+#include <stdio.h>
+
+#include <vector>
+#include <map>
+#include <algorithm>
+
+// windows includes
+#include <windows.h>
+
+
+// size of a grid cell in pixels
+const int g_index_cell_size = 128;
+
+
+// One indexed window
+struct WindowEntry
+{
+    HWND hwnd;
+    HWND root;      // top-level window owning 'hwnd'
+    RECT rect;      // screen coordinates
+    int order;      // z-order of the owning top-level window (lower on top)
+    int depth;      // 0 for top-level windows, deeper children are larger
+    int seq;        // enumeration order among windows of the same 'order'
+    bool valid;     // false once the window is gone or hidden
+};
+
+
+struct WindowIndex
+{
+    std::vector<WindowEntry> entries;
+    std::map<HWND, int> lookup;             // hwnd -> entry
+    std::vector<std::vector<int> > cells;   // entries sorted topmost first
+    RECT bounds;                            // area covered by the grid
+    int cols, rows;
+    HWND ignore;                            // our own overlay window
+    int top_order;                          // order given to raised windows
+    int next_seq;
+    HWINEVENTHOOK hooks[2];
+};
+
+
+// the index receiving WinEvent notifications
+WindowIndex *g_index = NULL;
+
+
+// True if entry 'a' is drawn above entry 'b'
+bool index_above(const WindowIndex *index, int a, int b)
+{
+    const WindowEntry &ea = index->entries[a];
+    const WindowEntry &eb = index->entries[b];
+    if (ea.order != eb.order)
+        return ea.order < eb.order;
+    if (ea.depth != eb.depth)
+        return ea.depth > eb.depth;
+    return ea.seq < eb.seq;
+}
+
+
+// Get the range of grid cells covered by a rectangle
+bool index_cell_range(const WindowIndex *index, const RECT *rect,
+                      int *c1, int *r1, int *c2, int *r2)
+{
+    RECT clip;
+    if (!IntersectRect(&clip, rect, &index->bounds))
+        return false;
+    *c1 = (clip.left - index->bounds.left) / g_index_cell_size;
+    *r1 = (clip.top - index->bounds.top) / g_index_cell_size;
+    *c2 = (clip.right - 1 - index->bounds.left) / g_index_cell_size;
+    *r2 = (clip.bottom - 1 - index->bounds.top) / g_index_cell_size;
+    return true;
+}
+
+
+// Add an entry to every cell its rectangle covers, keeping each cell
+// sorted topmost first
+void index_insert_cells(WindowIndex *index, int e)
+{
+    int c1, r1, c2, r2;
+    if (!index_cell_range(index, &index->entries[e].rect, &c1, &r1, &c2, &r2))
+        return;
+
+    for (int r=r1; r<=r2; r++) {
+        for (int c=c1; c<=c2; c++) {
+            std::vector<int> &cell = index->cells[r * index->cols + c];
+            int lo = 0, hi = cell.size();
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (index_above(index, cell[mid], e))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            cell.insert(cell.begin() + lo, e);
+        }
+    }
+}
+
+
+// Remove an entry from every cell its rectangle covers
+void index_remove_cells(WindowIndex *index, int e)
+{
+    int c1, r1, c2, r2;
+    if (!index_cell_range(index, &index->entries[e].rect, &c1, &r1, &c2, &r2))
+        return;
+
+    for (int r=r1; r<=r2; r++) {
+        for (int c=c1; c<=c2; c++) {
+            std::vector<int> &cell = index->cells[r * index->cols + c];
+            std::vector<int>::iterator it =
+                std::find(cell.begin(), cell.end(), e);
+            if (it != cell.end())
+                cell.erase(it);
+        }
+    }
+}
+
+
+// Number of parents between a window and its top-level window
+int window_depth(HWND hwnd)
+{
+    int depth = 0;
+    HWND root = GetAncestor(hwnd, GA_ROOT);
+    while (hwnd && hwnd != root) {
+        hwnd = GetParent(hwnd);
+        depth++;
+    }
+    return depth;
+}
+
+
+// Whether a window should be hit by the index
+bool index_wants(const WindowIndex *index, HWND hwnd, RECT *rect)
+{
+    if (hwnd == index->ignore || !IsWindowVisible(hwnd) || IsIconic(hwnd))
+        return false;
+    if (!GetWindowRect(hwnd, rect))
+        return false;
+    return rect->right > rect->left && rect->bottom > rect->top;
+}
+
+
+// Take an entry out of the grid until the window is seen again
+void index_drop(WindowIndex *index, int e)
+{
+    if (index->entries[e].valid) {
+        index_remove_cells(index, e);
+        index->entries[e].valid = false;
+    }
+}
+
+
+// Add a window to the index (or refresh it if already present).  A known
+// window that is no longer wanted, e.g. because it was minimized, is
+// dropped.
+void index_add(WindowIndex *index, HWND hwnd, int order)
+{
+    std::map<HWND, int>::iterator it = index->lookup.find(hwnd);
+
+    RECT rect;
+    if (!index_wants(index, hwnd, &rect)) {
+        if (it != index->lookup.end())
+            index_drop(index, it->second);
+        return;
+    }
+
+    int e;
+    if (it != index->lookup.end()) {
+        e = it->second;
+        if (index->entries[e].valid)
+            index_remove_cells(index, e);
+    } else {
+        WindowEntry entry;
+        entry.hwnd = hwnd;
+        entry.seq = index->next_seq++;
+        index->entries.push_back(entry);
+        e = index->entries.size() - 1;
+        index->lookup[hwnd] = e;
+    }
+
+    WindowEntry &entry = index->entries[e];
+    entry.root = GetAncestor(hwnd, GA_ROOT);
+    entry.rect = rect;
+    entry.order = order;
+    entry.depth = window_depth(hwnd);
+    entry.valid = true;
+    index_insert_cells(index, e);
+}
+
+
+// order of the top-level window owning 'hwnd', or a new topmost order
+int index_root_order(WindowIndex *index, HWND hwnd)
+{
+    HWND root = GetAncestor(hwnd, GA_ROOT);
+    std::map<HWND, int>::iterator it = index->lookup.find(root);
+    if (it != index->lookup.end() && index->entries[it->second].valid)
+        return index->entries[it->second].order;
+    return --index->top_order;
+}
+
+
+struct IndexEnumData
+{
+    WindowIndex *index;
+    int order;
+};
+
+BOOL CALLBACK index_enum_child(HWND hwnd, LPARAM lparam)
+{
+    IndexEnumData *data = (IndexEnumData*) lparam;
+    index_add(data->index, hwnd, data->order);
+    return TRUE;
+}
+
+BOOL CALLBACK index_enum_top(HWND hwnd, LPARAM lparam)
+{
+    IndexEnumData *data = (IndexEnumData*) lparam;
+    RECT rect;
+    if (!index_wants(data->index, hwnd, &rect))
+        return TRUE;
+
+    // EnumWindows() visits top-level windows topmost first and
+    // EnumChildWindows() visits children topmost first
+    data->order++;
+    index_add(data->index, hwnd, data->order);
+    EnumChildWindows(hwnd, index_enum_child, lparam);
+    return TRUE;
+}
+
+
+// Drop a top-level window and all of its children
+void index_drop_root(WindowIndex *index, HWND root)
+{
+    for (unsigned int e=0; e<index->entries.size(); e++)
+        if (index->entries[e].root == root)
+            index_drop(index, e);
+}
+
+
+// Re-read a top-level window and all of its children, since moving,
+// showing or minimizing it changes every child as well
+void index_refresh_root(WindowIndex *index, HWND root, int order)
+{
+    IndexEnumData data;
+    data.index = index;
+    data.order = order;
+
+    RECT rect;
+    if (!index_wants(index, root, &rect)) {
+        index_drop_root(index, root);
+        return;
+    }
+    index_add(index, root, order);
+    EnumChildWindows(root, index_enum_child, (LPARAM) &data);
+}
+
+
+// Called by the system whenever a window changes
+void CALLBACK index_win_event(HWINEVENTHOOK hook, DWORD event, HWND hwnd,
+                              LONG id_object, LONG id_child,
+                              DWORD thread, DWORD time)
+{
+    if (!g_index || !hwnd || id_object != OBJID_WINDOW ||
+        id_child != CHILDID_SELF)
+        return;
+
+    WindowIndex *index = g_index;
+    std::map<HWND, int>::iterator it = index->lookup.find(hwnd);
+    bool found = (it != index->lookup.end());
+    bool known = (found && index->entries[it->second].valid);
+
+    switch (event) {
+        case EVENT_OBJECT_DESTROY:
+        case EVENT_OBJECT_HIDE:
+            // a destroyed window has no ancestor left to ask for, so go
+            // by the root recorded when it was indexed
+            if (found && index->entries[it->second].root == hwnd)
+                index_drop_root(index, hwnd);
+            else if (found)
+                index_drop(index, it->second);
+            break;
+
+        case EVENT_OBJECT_CREATE:
+        case EVENT_OBJECT_SHOW:
+        case EVENT_OBJECT_LOCATIONCHANGE: {
+            // windows restored from minimized only report a location
+            // change, so top-level windows are always looked at
+            bool root = (GetAncestor(hwnd, GA_ROOT) == hwnd);
+            if (!found && !root && event == EVENT_OBJECT_LOCATIONCHANGE)
+                break;
+            int order = known ? index->entries[it->second].order :
+                index_root_order(index, hwnd);
+            if (root)
+                index_refresh_root(index, hwnd, order);
+            else
+                index_add(index, hwnd, order);
+            break;
+        }
+
+        case EVENT_SYSTEM_FOREGROUND: {
+            // move the window and all of its children to the top
+            HWND root = GetAncestor(hwnd, GA_ROOT);
+            int order = --index->top_order;
+            for (unsigned int e=0; e<index->entries.size(); e++) {
+                WindowEntry &entry = index->entries[e];
+                if (entry.valid && entry.root == root) {
+                    index_remove_cells(index, e);
+                    entry.order = order;
+                    index_insert_cells(index, e);
+                }
+            }
+            break;
+        }
+    }
+}
+
+
+// Initialize an empty index that is not yet listening for changes
+void index_init(WindowIndex *index)
+{
+    SetRectEmpty(&index->bounds);
+    index->cols = 0;
+    index->rows = 0;
+    index->ignore = NULL;
+    index->top_order = 0;
+    index->next_seq = 0;
+    index->hooks[0] = NULL;
+    index->hooks[1] = NULL;
+}
+
+
+// Enumerate all visible windows covering 'screen' into the index and start
+// listening for changes.  'ignore' is left out of the index.
+void index_build(WindowIndex *index, const RECT *screen, HWND ignore)
+{
+    index->bounds = *screen;
+    index->cols = (screen->right - screen->left + g_index_cell_size - 1) /
+        g_index_cell_size;
+    index->rows = (screen->bottom - screen->top + g_index_cell_size - 1) /
+        g_index_cell_size;
+    index->cells.assign(index->cols * index->rows, std::vector<int>());
+    index->entries.clear();
+    index->lookup.clear();
+    index->ignore = ignore;
+    index->top_order = 0;
+    index->next_seq = 0;
+
+    IndexEnumData data;
+    data.index = index;
+    data.order = 0;
+    EnumWindows(index_enum_top, (LPARAM) &data);
+
+    g_index = index;
+    index->hooks[0] = SetWinEventHook(
+        EVENT_OBJECT_CREATE, EVENT_OBJECT_LOCATIONCHANGE, NULL,
+        index_win_event, 0, 0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+    index->hooks[1] = SetWinEventHook(
+        EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, NULL,
+        index_win_event, 0, 0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+}
+
+
+// Stop listening for window changes
+void index_free(WindowIndex *index)
+{
+    for (int i=0; i<2; i++) {
+        if (index->hooks[i])
+            UnhookWinEvent(index->hooks[i]);
+        index->hooks[i] = NULL;
+    }
+    if (g_index == index)
+        g_index = NULL;
+}
+
+
+// Find the topmost indexed window containing screen point 'pt'
+bool index_find(const WindowIndex *index, POINT pt, RECT *rect)
+{
+    if (!PtInRect(&index->bounds, pt))
+        return false;
+
+    int c = (pt.x - index->bounds.left) / g_index_cell_size;
+    int r = (pt.y - index->bounds.top) / g_index_cell_size;
+    const std::vector<int> &cell = index->cells[r * index->cols + c];
+
+    for (unsigned int i=0; i<cell.size(); i++) {
+        const WindowEntry &entry = index->entries[cell[i]];
+        if (PtInRect(&entry.rect, pt)) {
+            *rect = entry.rect;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,314 @@
+/*=============================================================================
+
+  boxcutter
+  Copyright Matt Rasmussen 2008-2011
+
+  BGRX to I420 (planar YUV 4:2:0) conversion with BT.709 limited-range
+  coefficients, as wanted by video encoders.  Each chroma sample is the
+  average of a 2x2 block of pixels.  The conversion runs two rows at a
+  time in SSE2 or AVX2, chosen at run time, with plain C for the ends of
+  rows; all three give identical results.
+
+=============================================================================*/
+
+// c includes
+#include <string.h>
+#include <immintrin.h>
+
+
+// BT.709 limited range in 8.8 fixed point:
+//   Y = 16 + (47 R + 157 G + 16 B) / 256
+//   U = 128 + (-26 R - 86 G + 112 B) / 256
+//   V = 128 + (112 R - 102 G - 10 B) / 256
+#define YUV_YR 47
+#define YUV_YG 157
+#define YUV_YB 16
+#define YUV_UR -26
+#define YUV_UG -86
+#define YUV_UB 112
+#define YUV_VR 112
+#define YUV_VG -102
+#define YUV_VB -10
+
+
+// Convert pixels [start, width) of two rows (width even)
+typedef void (*YuvRowsFunc)(const unsigned char *row0,
+                            const unsigned char *row1, int start, int width,
+                            unsigned char *y0, unsigned char *y1,
+                            unsigned char *u, unsigned char *v);
+
+
+inline unsigned char yuv_luma(int b, int g, int r)
+{
+    return 16 + ((YUV_YB * b + YUV_YG * g + YUV_YR * r + 128) >> 8);
+}
+
+
+void yuv_rows_c(const unsigned char *row0, const unsigned char *row1,
+                int start, int width, unsigned char *y0, unsigned char *y1,
+                unsigned char *u, unsigned char *v)
+{
+    for (int x=start; x<width; x+=2) {
+        const unsigned char *p = row0 + x*4;
+        const unsigned char *q = row1 + x*4;
+        y0[x] = yuv_luma(p[0], p[1], p[2]);
+        y0[x+1] = yuv_luma(p[4], p[5], p[6]);
+        y1[x] = yuv_luma(q[0], q[1], q[2]);
+        y1[x+1] = yuv_luma(q[4], q[5], q[6]);
+
+        int b = (p[0] + p[4] + q[0] + q[4] + 2) >> 2;
+        int g = (p[1] + p[5] + q[1] + q[5] + 2) >> 2;
+        int r = (p[2] + p[6] + q[2] + q[6] + 2) >> 2;
+        u[x/2] = 128 + ((YUV_UB * b + YUV_UG * g + YUV_UR * r + 128) >> 8);
+        v[x/2] = 128 + ((YUV_VB * b + YUV_VG * g + YUV_VR * r + 128) >> 8);
+    }
+}
+
+
+// 8 pixels of two rows per step
+TARGET_SSE2
+void yuv_rows_sse2(const unsigned char *row0, const unsigned char *row1,
+                   int start, int width, unsigned char *y0, unsigned char *y1,
+                   unsigned char *u, unsigned char *v)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i c16 = _mm_set1_epi16(16);
+    const __m128i c128 = _mm_set1_epi16(128);
+    const __m128i two = _mm_set1_epi32(2);
+
+    int x = start;
+    for (; x + 8 <= width; x += 8) {
+        __m128i b[2], g[2], r[2], luma[2];
+        for (int i=0; i<2; i++) {
+            const unsigned char *row = (i ? row1 : row0) + x*4;
+            __m128i p0 = _mm_loadu_si128((const __m128i*) row);
+            __m128i p1 = _mm_loadu_si128((const __m128i*) (row + 16));
+
+            // planes of 16-bit samples
+            b[i] = _mm_packs_epi32(_mm_and_si128(p0, mask),
+                                   _mm_and_si128(p1, mask));
+            g[i] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+                                   _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+            r[i] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+                                   _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+
+            // the sum fits in 16 bits unsigned
+            __m128i sum = _mm_add_epi16(
+                _mm_add_epi16(_mm_mullo_epi16(b[i], _mm_set1_epi16(YUV_YB)),
+                              _mm_mullo_epi16(g[i], _mm_set1_epi16(YUV_YG))),
+                _mm_add_epi16(_mm_mullo_epi16(r[i], _mm_set1_epi16(YUV_YR)),
+                              c128));
+            luma[i] = _mm_add_epi16(_mm_srli_epi16(sum, 8), c16);
+        }
+        __m128i ys = _mm_packus_epi16(luma[0], luma[1]);
+        _mm_storel_epi64((__m128i*) (y0 + x), ys);
+        _mm_storel_epi64((__m128i*) (y1 + x), _mm_srli_si128(ys, 8));
+
+        // 2x2 averages: add the rows, then neighbouring columns
+        __m128i cb = _mm_madd_epi16(_mm_add_epi16(b[0], b[1]), ones);
+        __m128i cg = _mm_madd_epi16(_mm_add_epi16(g[0], g[1]), ones);
+        __m128i cr = _mm_madd_epi16(_mm_add_epi16(r[0], r[1]), ones);
+        cb = _mm_srli_epi32(_mm_add_epi32(cb, two), 2);
+        cg = _mm_srli_epi32(_mm_add_epi32(cg, two), 2);
+        cr = _mm_srli_epi32(_mm_add_epi32(cr, two), 2);
+        cb = _mm_packs_epi32(cb, cb);
+        cg = _mm_packs_epi32(cg, cg);
+        cr = _mm_packs_epi32(cr, cr);
+
+        __m128i us = _mm_add_epi16(
+            _mm_add_epi16(_mm_mullo_epi16(cb, _mm_set1_epi16(YUV_UB)),
+                          _mm_mullo_epi16(cg, _mm_set1_epi16(YUV_UG))),
+            _mm_add_epi16(_mm_mullo_epi16(cr, _mm_set1_epi16(YUV_UR)),
+                          c128));
+        __m128i vs = _mm_add_epi16(
+            _mm_add_epi16(_mm_mullo_epi16(cb, _mm_set1_epi16(YUV_VB)),
+                          _mm_mullo_epi16(cg, _mm_set1_epi16(YUV_VG))),
+            _mm_add_epi16(_mm_mullo_epi16(cr, _mm_set1_epi16(YUV_VR)),
+                          c128));
+        us = _mm_add_epi16(_mm_srai_epi16(us, 8), c128);
+        vs = _mm_add_epi16(_mm_srai_epi16(vs, 8), c128);
+        __m128i uv = _mm_packus_epi16(us, vs);
+        *(int*) (u + x/2) = _mm_cvtsi128_si32(uv);
+        *(int*) (v + x/2) = _mm_cvtsi128_si32(_mm_srli_si128(uv, 8));
+    }
+
+    yuv_rows_c(row0, row1, x, width, y0, y1, u, v);
+}
+
+
+// 16 pixels of two rows per step
+TARGET_AVX2
+void yuv_rows_avx2(const unsigned char *row0, const unsigned char *row1,
+                   int start, int width, unsigned char *y0, unsigned char *y1,
+                   unsigned char *u, unsigned char *v)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i c16 = _mm256_set1_epi16(16);
+    const __m256i c128 = _mm256_set1_epi16(128);
+    const __m256i two = _mm256_set1_epi32(2);
+    const __m256i uv_order = _mm256_setr_epi32(0, 4, 2, 6, 1, 5, 3, 7);
+
+    int x = start;
+    for (; x + 16 <= width; x += 16) {
+        __m256i b[2], g[2], r[2], luma[2];
+        for (int i=0; i<2; i++) {
+            const unsigned char *row = (i ? row1 : row0) + x*4;
+            __m256i p0 = _mm256_loadu_si256((const __m256i*) row);
+            __m256i p1 = _mm256_loadu_si256((const __m256i*) (row + 32));
+
+            // packing works within 128-bit lanes; put the pixels back in
+            // order afterwards
+            b[i] = _mm256_packs_epi32(_mm256_and_si256(p0, mask),
+                                      _mm256_and_si256(p1, mask));
+            g[i] = _mm256_packs_epi32(
+                _mm256_and_si256(_mm256_srli_epi32(p0, 8), mask),
+                _mm256_and_si256(_mm256_srli_epi32(p1, 8), mask));
+            r[i] = _mm256_packs_epi32(
+                _mm256_and_si256(_mm256_srli_epi32(p0, 16), mask),
+                _mm256_and_si256(_mm256_srli_epi32(p1, 16), mask));
+            b[i] = _mm256_permute4x64_epi64(b[i], 0xd8);
+            g[i] = _mm256_permute4x64_epi64(g[i], 0xd8);
+            r[i] = _mm256_permute4x64_epi64(r[i], 0xd8);
+
+            __m256i sum = _mm256_add_epi16(
+                _mm256_add_epi16(
+                    _mm256_mullo_epi16(b[i], _mm256_set1_epi16(YUV_YB)),
+                    _mm256_mullo_epi16(g[i], _mm256_set1_epi16(YUV_YG))),
+                _mm256_add_epi16(
+                    _mm256_mullo_epi16(r[i], _mm256_set1_epi16(YUV_YR)),
+                    c128));
+            luma[i] = _mm256_add_epi16(_mm256_srli_epi16(sum, 8), c16);
+        }
+        __m256i ys = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(luma[0], luma[1]), 0xd8);
+        _mm_storeu_si128((__m128i*) (y0 + x), _mm256_castsi256_si128(ys));
+        _mm_storeu_si128((__m128i*) (y1 + x),
+                         _mm256_extracti128_si256(ys, 1));
+
+        __m256i cb = _mm256_madd_epi16(_mm256_add_epi16(b[0], b[1]), ones);
+        __m256i cg = _mm256_madd_epi16(_mm256_add_epi16(g[0], g[1]), ones);
+        __m256i cr = _mm256_madd_epi16(_mm256_add_epi16(r[0], r[1]), ones);
+        cb = _mm256_srli_epi32(_mm256_add_epi32(cb, two), 2);
+        cg = _mm256_srli_epi32(_mm256_add_epi32(cg, two), 2);
+        cr = _mm256_srli_epi32(_mm256_add_epi32(cr, two), 2);
+        cb = _mm256_packs_epi32(cb, cb);
+        cg = _mm256_packs_epi32(cg, cg);
+        cr = _mm256_packs_epi32(cr, cr);
+
+        __m256i us = _mm256_add_epi16(
+            _mm256_add_epi16(
+                _mm256_mullo_epi16(cb, _mm256_set1_epi16(YUV_UB)),
+                _mm256_mullo_epi16(cg, _mm256_set1_epi16(YUV_UG))),
+            _mm256_add_epi16(
+                _mm256_mullo_epi16(cr, _mm256_set1_epi16(YUV_UR)),
+                c128));
+        __m256i vs = _mm256_add_epi16(
+            _mm256_add_epi16(
+                _mm256_mullo_epi16(cb, _mm256_set1_epi16(YUV_VB)),
+                _mm256_mullo_epi16(cg, _mm256_set1_epi16(YUV_VG))),
+            _mm256_add_epi16(
+                _mm256_mullo_epi16(cr, _mm256_set1_epi16(YUV_VR)),
+                c128));
+        us = _mm256_add_epi16(_mm256_srai_epi16(us, 8), c128);
+        vs = _mm256_add_epi16(_mm256_srai_epi16(vs, 8), c128);
+
+        // dwords 0 and 4 hold U, 2 and 6 hold V
+        __m256i uv = _mm256_permutevar8x32_epi32(
+            _mm256_packus_epi16(us, vs), uv_order);
+        __m128i uv128 = _mm256_castsi256_si128(uv);
+        _mm_storel_epi64((__m128i*) (u + x/2), uv128);
+        _mm_storel_epi64((__m128i*) (v + x/2), _mm_srli_si128(uv128, 8));
+    }
+
+    yuv_rows_sse2(row0, row1, x, width, y0, y1, u, v);
+}
+
+
+// Pick the fastest row converter for this CPU
+YuvRowsFunc yuv_rows_func()
+{
+    int features = cpu_features();
+    if (features & CPU_AVX2)
+        return yuv_rows_avx2;
+    if (features & CPU_SSE2)
+        return yuv_rows_sse2;
+    return yuv_rows_c;
+}
+
+
+// Convert a width x height image (both even) to I420: a full-size Y
+// plane followed by quarter-size U and V planes in 'out'
+void yuv_convert(const unsigned char *pixels, int width, int height,
+                 int stride, unsigned char *out)
+{
+    static YuvRowsFunc rows = yuv_rows_func();
+
+    unsigned char *y = out;
+    unsigned char *u = y + width * height;
+    unsigned char *v = u + (width / 2) * (height / 2);
+    for (int i=0; i<height; i+=2)
+        rows(pixels + i * stride, pixels + (i+1) * stride, 0, width,
+             y + i * width, y + (i+1) * width,
+             u + (i/2) * (width/2), v + (i/2) * (width/2));
+}
+
+
+//=============================================================================
+// 2x downscaling
+
+// Average 2x2 blocks of two rows into 'width' output pixels, starting at
+// output pixel 'start'
+void yuv_half_rows_c(const unsigned char *row0,
+                     const unsigned char *row1, int start, int width,
+                     unsigned char *out)
+{
+    for (int x=start*4; x<width*4; x++) {
+        int i = (x & ~3) * 2 + (x & 3);
+        int a = (row0[i] + row1[i] + 1) >> 1;
+        int b = (row0[i+4] + row1[i+4] + 1) >> 1;
+        out[x] = (a + b + 1) >> 1;
+    }
+}
+
+
+TARGET_SSE2
+void yuv_half_rows_sse2(const unsigned char *row0,
+                        const unsigned char *row1, int start,
+                        int width, unsigned char *out)
+{
+    int x = start;
+    for (; x + 4 <= width; x += 4) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*) (row0 + x*8));
+        __m128i a1 = _mm_loadu_si128((const __m128i*) (row0 + x*8 + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i*) (row1 + x*8));
+        __m128i b1 = _mm_loadu_si128((const __m128i*) (row1 + x*8 + 16));
+        __m128 v0 = _mm_castsi128_ps(_mm_avg_epu8(a0, b0));
+        __m128 v1 = _mm_castsi128_ps(_mm_avg_epu8(a1, b1));
+        __m128i even = _mm_castps_si128(
+            _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i odd = _mm_castps_si128(
+            _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+        _mm_storeu_si128((__m128i*) (out + x*4), _mm_avg_epu8(even, odd));
+    }
+
+    yuv_half_rows_c(row0, row1, x, width, out);
+}
+
+
+// Shrink a width x height image to half its size in both directions
+// (rounding down) into 'out', which has 'out_stride' bytes per row
+void yuv_half(const unsigned char *pixels, int width, int height,
+              int stride, unsigned char *out, int out_stride)
+{
+    bool sse2 = (cpu_features() & CPU_SSE2) != 0;
+    for (int i=0; i<height/2; i++) {
+        const unsigned char *row0 = pixels + 2*i * stride;
+        unsigned char *dst = out + i * out_stride;
+        if (sse2)
+            yuv_half_rows_sse2(row0, row0 + stride, 0, width / 2, dst);
+        else
+            yuv_half_rows_c(row0, row0 + stride, 0, width / 2, dst);
+    }
+}